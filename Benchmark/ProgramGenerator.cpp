@@ -0,0 +1,396 @@
+//
+//  ProgramGenerator.cpp
+//  Benchmark
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "ProgramGenerator.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace
+{
+
+constexpr std::array<const char*, 6> shape_names = { "lets", "branches", "exprs", "comments", "mixed", "loops" };
+
+constexpr std::array<std::string_view, 16> comment_words = {
+    "the", "value", "is", "kept", "in", "a", "register", "until",
+    "next", "use", "so", "spill", "only", "when", "pressure", "rises"
+};
+
+constexpr uint32_t loop_depth = 3;
+
+// Variables referred to are mostly recent ones, like real code, but any
+// earlier top-level name can come up.
+constexpr uint32_t recent_window = 64;
+
+class ProgramGenerator
+{
+public:
+    ProgramGenerator(const GeneratorOptions& options)
+        : m_options(options)
+        , m_state(options.seed)
+    {
+        // Text past the target is at most one statement, except for a deep chain.
+        m_out.reserve(options.target_bytes + 64 * 1024);
+    }
+
+    std::string generate()
+    {
+        // A few names to refer to before the first `let` of the body.
+        for (int i = 0; i < 4; i++)
+        {
+            gen_let(0);
+        }
+        while (m_out.size() < m_options.target_bytes)
+        {
+            gen_unit(m_options.shape);
+        }
+        m_out += "exit(";
+        append_name(pick_global());
+        m_out += ");\n";
+        return std::move(m_out);
+    }
+
+private:
+    // splitmix64
+    uint64_t next()
+    {
+        uint64_t z = (m_state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    inline uint32_t below(uint32_t bound) { return static_cast<uint32_t>(next() % bound); }
+
+    // Identifiers are letters only, so the index is written in base 26 after a
+    // prefix that no keyword starts with.
+    void append_name(uint32_t index, char prefix = 'v')
+    {
+        char digits[8];
+        int count = 0;
+        do
+        {
+            digits[count++] = static_cast<char>('a' + index % 26);
+            index /= 26;
+        } while (index > 0);
+        m_out += prefix;
+        while (count > 0)
+        {
+            m_out += digits[--count];
+        }
+    }
+
+    uint32_t pick_global()
+    {
+        if (m_globals <= recent_window || below(8) != 0)
+        {
+            uint32_t window = std::min(m_globals, recent_window);
+            return m_globals - 1 - below(window);
+        }
+        return below(m_globals);
+    }
+
+    void indent(uint32_t depth)
+    {
+        m_out.append(depth * 4, ' ');
+    }
+
+    void gen_unit(ProgramShape shape)
+    {
+        switch (shape)
+        {
+            case ProgramShape::lets:
+                if (below(4) == 0)
+                {
+                    gen_assign(0, 1 + below(4));
+                }
+                else
+                {
+                    gen_let(0);
+                }
+                break;
+            case ProgramShape::branches:
+                gen_if_chain(0, m_options.if_depth);
+                break;
+            case ProgramShape::exprs:
+                gen_assign(0, m_options.expr_terms);
+                break;
+            case ProgramShape::comments:
+                gen_comment();
+                gen_let(0);
+                break;
+            case ProgramShape::mixed:
+            {
+                uint32_t roll = below(16);
+                if (roll < 8)
+                {
+                    gen_unit(ProgramShape::lets);
+                }
+                else if (roll < 11)
+                {
+                    gen_unit(ProgramShape::exprs);
+                }
+                else if (roll < 13)
+                {
+                    gen_unit(ProgramShape::comments);
+                }
+                else
+                {
+                    gen_if_chain(0, 1 + below(m_options.if_depth));
+                }
+                break;
+            }
+            case ProgramShape::loops:
+                gen_loop(0, 1 + below(loop_depth));
+                break;
+        }
+    }
+
+    void gen_term()
+    {
+        if (below(3) == 0)
+        {
+            m_out += std::to_string(below(1000));
+        }
+        else
+        {
+            append_name(pick_global());
+        }
+    }
+
+    // `terms` operands joined by random operators. Division is only ever by a
+    // non-zero literal, so constant folding never finds a division by zero.
+    void gen_expr(uint32_t terms, uint32_t paren_depth = 0)
+    {
+        uint32_t done = 0;
+        while (done < terms)
+        {
+            if (done > 0)
+            {
+                static constexpr std::array<const char*, 4> ops = { " + ", " - ", " * ", " / " };
+                uint32_t op = below(4);
+                m_out += ops[op];
+                if (op == 3)
+                {
+                    m_out += std::to_string(1 + below(99));
+                    done++;
+                    continue;
+                }
+            }
+            uint32_t left = terms - done;
+            if (left >= 3 && paren_depth < 4 && below(6) == 0)
+            {
+                uint32_t inner = 2 + below(std::min(left, 8u) - 1);
+                m_out += '(';
+                gen_expr(inner, paren_depth + 1);
+                m_out += ')';
+                done += inner;
+            }
+            else
+            {
+                gen_term();
+                done++;
+            }
+        }
+    }
+
+    // Top-level lets add a name that later statements may use. Nested ones are
+    // scope-local and nothing refers to them, so they are 'u' names of their own.
+    void gen_let(uint32_t depth)
+    {
+        indent(depth);
+        m_out += "let ";
+        if (depth == 0)
+        {
+            append_name(m_globals);
+        }
+        else
+        {
+            append_name(m_locals++, 'u');
+        }
+        m_out += " = ";
+        if (m_globals == 0)
+        {
+            m_out += std::to_string(below(1000));
+        }
+        else
+        {
+            gen_expr(1 + below(4));
+        }
+        m_out += ";\n";
+        // Only visible once its own initializer is done.
+        m_globals += depth == 0;
+    }
+
+    void gen_assign(uint32_t depth, uint32_t terms)
+    {
+        indent(depth);
+        append_name(pick_global());
+        m_out += " = ";
+        gen_expr(terms);
+        m_out += ";\n";
+    }
+
+    void gen_body(uint32_t depth)
+    {
+        uint32_t count = 1 + below(2);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (below(2) == 0)
+            {
+                gen_let(depth);
+            }
+            else
+            {
+                gen_assign(depth, 1 + below(6));
+            }
+        }
+    }
+
+    // if/elif/else where only the `if` arm nests further, so one chain is
+    // linear in its depth rather than exponential. Nesting also stops at the
+    // target size, so small programs are not one whole chain over it.
+    void gen_if_chain(uint32_t depth, uint32_t levels)
+    {
+        indent(depth);
+        m_out += "if (";
+        gen_expr(1 + below(3));
+        m_out += ")\n";
+        indent(depth);
+        m_out += "{\n";
+        gen_body(depth + 1);
+        if (levels > 1 && m_out.size() < m_options.target_bytes)
+        {
+            gen_if_chain(depth + 1, levels - 1);
+        }
+        indent(depth);
+        m_out += "}\n";
+        uint32_t elifs = below(3);
+        for (uint32_t i = 0; i < elifs; i++)
+        {
+            indent(depth);
+            m_out += "elif (";
+            gen_expr(1 + below(3));
+            m_out += ")\n";
+            indent(depth);
+            m_out += "{\n";
+            gen_body(depth + 1);
+            indent(depth);
+            m_out += "}\n";
+        }
+        if (below(2) == 0)
+        {
+            indent(depth);
+            m_out += "else\n";
+            indent(depth);
+            m_out += "{\n";
+            gen_body(depth + 1);
+            indent(depth);
+            m_out += "}\n";
+        }
+    }
+
+    // A loop counting a local up to a literal, whose body also adds a multiple
+    // of the count to a global, with `levels - 1` loops nested inside it.
+    void gen_loop(uint32_t depth, uint32_t levels)
+    {
+        uint32_t counter = m_locals++;
+        indent(depth);
+        m_out += "let ";
+        append_name(counter, 'u');
+        m_out += " = 0;\n";
+        indent(depth);
+        m_out += "while (";
+        append_name(counter, 'u');
+        m_out += " < " + std::to_string(1 + below(m_options.loop_trips)) + ")\n";
+        indent(depth);
+        m_out += "{\n";
+        indent(depth + 1);
+        append_name(counter, 'u');
+        m_out += " = ";
+        append_name(counter, 'u');
+        m_out += " + 1;\n";
+        indent(depth + 1);
+        uint32_t target = pick_global();
+        append_name(target);
+        m_out += " = ";
+        append_name(target);
+        m_out += " + ";
+        append_name(counter, 'u');
+        m_out += " * " + std::to_string(2 + below(98)) + ";\n";
+        gen_body(depth + 1);
+        if (levels > 1 && m_out.size() < m_options.target_bytes)
+        {
+            gen_loop(depth + 1, levels - 1);
+        }
+        indent(depth);
+        m_out += "}\n";
+    }
+    
+    void gen_words(uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            m_out += i == 0 ? "" : " ";
+            m_out += comment_words[below(comment_words.size())];
+        }
+    }
+
+    void gen_comment()
+    {
+        if (below(3) == 0)
+        {
+            uint32_t lines = 1 + below(4);
+            for (uint32_t i = 0; i < lines; i++)
+            {
+                m_out += "// ";
+                gen_words(4 + below(12));
+                m_out += '\n';
+            }
+            return;
+        }
+        m_out += "/*\n";
+        uint32_t lines = 4 + below(12);
+        for (uint32_t i = 0; i < lines; i++)
+        {
+            m_out += " * ";
+            gen_words(6 + below(10));
+            m_out += '\n';
+        }
+        m_out += " */\n";
+    }
+
+    const GeneratorOptions& m_options;
+    uint64_t m_state;
+    std::string m_out;
+    uint32_t m_globals = 0;
+    uint32_t m_locals = 0;
+};
+
+}
+
+std::string generate_program(const GeneratorOptions& options)
+{
+    return ProgramGenerator(options).generate();
+}
+
+const char* shape_name(ProgramShape shape)
+{
+    return shape_names[static_cast<size_t>(shape)];
+}
+
+std::optional<ProgramShape> shape_from_name(std::string_view name)
+{
+    for (size_t i = 0; i < shape_names.size(); i++)
+    {
+        if (name == shape_names[i])
+        {
+            return static_cast<ProgramShape>(i);
+        }
+    }
+    return {};
+}
@@ -0,0 +1,43 @@
+//
+//  ProgramGenerator.hpp
+//  Benchmark
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Synthetic .newton programs for the throughput benchmark. Every program is
+// valid (names are declared before use and never divided by zero), so it goes
+// through all of the compiler's phases, and the same options and seed always
+// give the same text.
+
+enum class ProgramShape
+{
+    lets,       // one short `let` after another
+    branches,   // deeply nested if/elif/else chains
+    exprs,      // long arithmetic expressions with parentheses
+    comments,   // mostly /* */ and // comments, a few statements between them
+    mixed,      // all of the above, picked at random statement by statement
+    loops       // counted while loops nested a few deep, each body a few statements
+};
+
+struct GeneratorOptions
+{
+    ProgramShape shape = ProgramShape::mixed;
+    size_t target_bytes = 64 * 1024;    // generation stops at the first statement past this
+    uint32_t if_depth = 16;             // nesting of each branches chain
+    uint32_t expr_terms = 48;           // operands in each exprs expression
+    uint32_t loop_trips = 1000;         // each loop runs between 1 and this many times
+    uint64_t seed = 1;
+};
+
+std::string generate_program(const GeneratorOptions& options);
+
+const char* shape_name(ProgramShape shape);
+std::optional<ProgramShape> shape_from_name(std::string_view name);
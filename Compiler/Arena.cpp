@@ -7,10 +7,88 @@
 
 #include "Arena.hpp"
 
+#include <algorithm>
+
 ArenaAllocator::ArenaAllocator(size_t bytes)
-    : m_size(bytes) 
+    : m_next_size(std::max<size_t>(bytes, 1024))
+{
+    new_chunk(m_next_size);
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+    run_dtors();
+    while (m_chunk)
+    {
+        Chunk* prev = m_chunk->prev;
+        free(m_chunk);
+        m_chunk = prev;
+    }
+}
+
+void* ArenaAllocator::alloc_slow(size_t size, size_t align)
+{
+    m_stats.waste += static_cast<size_t>(m_end - m_offset);
+    new_chunk(size + align);
+    return alloc_bytes(size, align);
+}
+
+void ArenaAllocator::new_chunk(size_t min_bytes)
 {
-    m_buffer = static_cast<unsigned char*>(malloc(m_size));
-    m_offset = m_buffer;
+    size_t size = std::max(m_next_size, min_bytes);
+    auto chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + size));
+    if (!chunk)
+    {
+        throw std::bad_alloc();
+    }
+    chunk->prev = m_chunk;
+    chunk->size = size;
+    m_chunk = chunk;
+    m_offset = reinterpret_cast<unsigned char*>(chunk + 1);
+    m_end = m_offset + size;
+    m_next_size = size * 2;
+    m_stats.bytes_reserved += size;
+    m_stats.chunks++;
 }
 
+void ArenaAllocator::register_dtor(void* obj, void (*destroy)(void*))
+{
+    auto dtor = static_cast<Dtor*>(alloc_bytes(sizeof(Dtor), alignof(Dtor)));
+    dtor->destroy = destroy;
+    dtor->obj = obj;
+    dtor->prev = m_dtors;
+    m_dtors = dtor;
+}
+
+void ArenaAllocator::run_dtors()
+{
+    // Reverse allocation order, matching how the objects were built up.
+    for (Dtor* dtor = m_dtors; dtor; dtor = dtor->prev)
+    {
+        dtor->destroy(dtor->obj);
+    }
+    m_dtors = nullptr;
+}
+
+void ArenaAllocator::reset()
+{
+    run_dtors();
+    
+    // The newest chunk is always the largest, so keep that one.
+    Chunk* keep = m_chunk;
+    Chunk* chunk = keep->prev;
+    while (chunk)
+    {
+        Chunk* prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    keep->prev = nullptr;
+    
+    m_offset = reinterpret_cast<unsigned char*>(keep + 1);
+    m_end = m_offset + keep->size;
+    m_next_size = keep->size * 2;
+    m_stats = {};
+    m_stats.bytes_reserved = keep->size;
+    m_stats.chunks = 1;
+}
@@ -9,28 +9,92 @@
 #pragma once
 #include <stdio.h>
 #include <stdlib.h>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
 
+// Bump allocator over a chain of chunks. Each chunk is twice the size of the
+// one before it, so any input fits and the amortised cost stays at one pointer
+// bump per allocation. Objects are constructed in place; those that are not
+// trivially destructible are recorded and destroyed on reset() or destruction.
 class ArenaAllocator
 {
 public:
-    ArenaAllocator(size_t bytes);
+    struct Stats
+    {
+        size_t bytes_used = 0;     // payload handed out, excluding padding
+        size_t bytes_reserved = 0; // total capacity of all live chunks
+        size_t chunks = 0;
+        size_t waste = 0;          // alignment padding plus abandoned chunk tails
+        size_t allocations = 0;
+    };
+    
+    ArenaAllocator(size_t bytes = 64 * 1024);
+    
+    template<typename T, typename... Args>
+    inline T* alloc(Args&&... args)
+    {
+        void* mem = alloc_bytes(sizeof(T), alignof(T));
+        T* obj = new (mem) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>)
+        {
+            register_dtor(obj, [](void* ptr) { static_cast<T*>(ptr)->~T(); });
+        }
+        return obj;
+    }
     
-    template<typename T>
-    inline T* alloc()
+    inline void* alloc_bytes(size_t size, size_t align)
     {
-        void* offset = m_offset;
-        m_offset += sizeof(T);
-        return static_cast<T*>(offset);
+        size_t pad = (align - (reinterpret_cast<uintptr_t>(m_offset) & (align - 1))) & (align - 1);
+        if (static_cast<size_t>(m_end - m_offset) < size + pad)
+        {
+            return alloc_slow(size, align);
+        }
+        void* ptr = m_offset + pad;
+        m_offset += pad + size;
+        m_stats.bytes_used += size;
+        m_stats.waste += pad;
+        m_stats.allocations++;
+        return ptr;
     }
     
+    // Destroys every registered object and rewinds to a single chunk, keeping
+    // the largest one so a reused arena does not have to grow again.
+    void reset();
+    
+    [[nodiscard]] inline const Stats& stats() const { return m_stats; }
+    
     inline ArenaAllocator(const ArenaAllocator& other) = delete;
     
     inline ArenaAllocator operator = (const ArenaAllocator& other) = delete;
     
-    inline ~ArenaAllocator() { free(m_buffer); }
+    ~ArenaAllocator();
     
 private:
-    size_t m_size;
-    unsigned char* m_buffer;
-    unsigned char* m_offset;
+    struct Chunk
+    {
+        Chunk* prev;
+        size_t size;
+    };
+    
+    struct Dtor
+    {
+        void (*destroy)(void*);
+        void* obj;
+        Dtor* prev;
+    };
+    
+    void* alloc_slow(size_t size, size_t align);
+    void new_chunk(size_t min_bytes);
+    void register_dtor(void* obj, void (*destroy)(void*));
+    void run_dtors();
+    
+    Chunk* m_chunk = nullptr;
+    unsigned char* m_offset = nullptr;
+    unsigned char* m_end = nullptr;
+    Dtor* m_dtors = nullptr;
+    size_t m_next_size;
+    Stats m_stats {};
 };
@@ -0,0 +1,810 @@
+//
+//  Bytecode.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Bytecode.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+
+// Operands of a binary operation: registers, or a constant on the right.
+struct BcOperands
+{
+    uint32_t lhs;
+    uint32_t rhs;
+    bool rhs_const;
+};
+
+// a < b is b > a: the comparison that holds with the operands swapped.
+BinOp mirror(BinOp op)
+{
+    switch (op)
+    {
+        case BinOp::lt: return BinOp::gt;
+        case BinOp::le: return BinOp::ge;
+        case BinOp::gt: return BinOp::lt;
+        case BinOp::ge: return BinOp::le;
+        default: return op;
+    }
+}
+
+BinOp negate(BinOp op)
+{
+    switch (op)
+    {
+        case BinOp::eq: return BinOp::ne;
+        case BinOp::ne: return BinOp::eq;
+        case BinOp::lt: return BinOp::ge;
+        case BinOp::le: return BinOp::gt;
+        case BinOp::gt: return BinOp::le;
+        case BinOp::ge: return BinOp::lt;
+        default:
+            throw std::runtime_error("Unreachable");
+    }
+}
+
+// BinOp::add..ge are in the same order as BcOp::add..div and eq..ge.
+BcOp value_op(BinOp op, bool rhs_const)
+{
+    auto index = static_cast<uint8_t>(op);
+    if (is_comparison(op))
+        return static_cast<BcOp>(static_cast<uint8_t>(BcOp::eq) + index - static_cast<uint8_t>(BinOp::eq));
+    return static_cast<BcOp>(static_cast<uint8_t>(rhs_const ? BcOp::add_k : BcOp::add) + index);
+}
+
+BcOp branch_op(BinOp op, bool rhs_const)
+{
+    auto index = static_cast<uint8_t>(op) - static_cast<uint8_t>(BinOp::eq);
+    return static_cast<BcOp>(static_cast<uint8_t>(rhs_const ? BcOp::jeq_k : BcOp::jeq) + index);
+}
+
+bool is_jump(BcOp op)
+{
+    return op >= BcOp::jmp && op <= BcOp::jge_k;
+}
+
+// The conditional jump taken exactly when `op` is not.
+BcOp invert(BcOp op)
+{
+    switch (op)
+    {
+        case BcOp::jz: return BcOp::jnz;
+        case BcOp::jnz: return BcOp::jz;
+        case BcOp::jeq: return BcOp::jne;
+        case BcOp::jne: return BcOp::jeq;
+        case BcOp::jlt: return BcOp::jge;
+        case BcOp::jle: return BcOp::jgt;
+        case BcOp::jgt: return BcOp::jle;
+        case BcOp::jge: return BcOp::jlt;
+        case BcOp::jeq_k: return BcOp::jne_k;
+        case BcOp::jne_k: return BcOp::jeq_k;
+        case BcOp::jlt_k: return BcOp::jge_k;
+        case BcOp::jle_k: return BcOp::jgt_k;
+        case BcOp::jgt_k: return BcOp::jle_k;
+        case BcOp::jge_k: return BcOp::jlt_k;
+        default:
+            throw std::runtime_error("Unreachable");
+    }
+}
+
+// Cleans up the jumps that compiling statement by statement leaves behind,
+// the same ones the native peephole pass removes: a jump to a jmp goes
+// straight to its target, `jcc A; jmp B; A:` becomes `j!cc B`, and a jmp to
+// the next instruction and unreachable code (after an exit or break) go away.
+// Repeats until nothing changes, since each rewrite can enable another.
+void simplify_jumps(std::vector<BcInstr>& code)
+{
+    std::vector<bool> live;
+    std::vector<bool> targeted;
+    std::vector<uint32_t> work;
+    std::vector<uint32_t> new_index;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        size_t size = code.size();
+        for (BcInstr& instr : code)
+        {
+            // Bounded, since `while (1) {}` is a jmp to itself.
+            for (int hops = 0; is_jump(instr.op) && code[instr.c].op == BcOp::jmp && code[instr.c].c != instr.c && hops < 4; hops++)
+            {
+                instr.c = code[instr.c].c;
+            }
+        }
+        
+        live.assign(size, false);
+        targeted.assign(size, false);
+        work.assign(1, 0);
+        live[0] = true;
+        while (!work.empty())
+        {
+            const BcInstr& instr = code[work.back()];
+            uint32_t next = work.back() + 1;
+            work.pop_back();
+            if (is_jump(instr.op))
+            {
+                targeted[instr.c] = true;
+                if (!live[instr.c])
+                {
+                    live[instr.c] = true;
+                    work.push_back(instr.c);
+                }
+            }
+            if (instr.op != BcOp::jmp && instr.op != BcOp::exit && !live[next])
+            {
+                live[next] = true;
+                work.push_back(next);
+            }
+        }
+        
+        for (uint32_t i = 0; i < size; i++)
+        {
+            if (!live[i] || !is_jump(code[i].op))
+            {
+                continue;
+            }
+            if (code[i].op != BcOp::jmp && code[i].c == i + 2 && code[i + 1].op == BcOp::jmp && !targeted[i + 1])
+            {
+                code[i].op = invert(code[i].op);
+                code[i].c = code[i + 1].c;
+                live[i + 1] = false;
+                changed = true;
+                continue;
+            }
+            // A jmp over nothing but dead code.
+            uint32_t target = code[i].c;
+            if (code[i].op == BcOp::jmp && target > i && std::find(live.begin() + i + 1, live.begin() + target, true) == live.begin() + target)
+            {
+                live[i] = false;
+                changed = true;
+            }
+        }
+        
+        // A removed instruction's index becomes that of the next one kept,
+        // which is where control went past it.
+        new_index.resize(size + 1);
+        uint32_t kept = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            new_index[i] = kept;
+            if (live[i])
+            {
+                code[kept++] = code[i];
+            }
+        }
+        new_index[size] = kept;
+        changed |= kept != size;
+        code.resize(kept);
+        for (BcInstr& instr : code)
+        {
+            if (is_jump(instr.op))
+            {
+                instr.c = new_index[instr.c];
+            }
+        }
+    }
+}
+
+class BytecodeCompiler
+{
+public:
+    BytecodeCompiler(const NodeProg& prog)
+        : m_prog(prog), m_vars(prog.symbol_count) {}
+
+    Bytecode compile()
+    {
+        compile_stmts();
+        uint32_t status = m_var_count;
+        reserve(status + 1);
+        emit(BcOp::loadk, status, constant(0));
+        emit(BcOp::exit, status);
+
+        for (size_t index : m_fixups)
+        {
+            m_out.code[index].c = m_labels[m_out.code[index].c];
+        }
+        simplify_jumps(m_out.code);
+        return std::move(m_out);
+    }
+
+private:
+    // ---- Instructions ----
+
+    void emit(BcOp op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0)
+    {
+        m_out.code.push_back({ .op = op, .a = a, .b = b, .c = c });
+    }
+
+    void emit_jump(BcOp op, uint32_t label, uint32_t a = 0, uint32_t b = 0)
+    {
+        m_fixups.push_back(m_out.code.size());
+        emit(op, a, b, label);
+    }
+
+    uint32_t create_label()
+    {
+        m_labels.push_back(0);
+        return static_cast<uint32_t>(m_labels.size() - 1);
+    }
+
+    void define_label(uint32_t label)
+    {
+        m_labels[label] = static_cast<uint32_t>(m_out.code.size());
+    }
+
+    uint32_t constant(uint64_t value)
+    {
+        auto [it, added] = m_constant_index.try_emplace(value, static_cast<uint32_t>(m_out.constants.size()));
+        if (added)
+        {
+            m_out.constants.push_back(value);
+        }
+        return it->second;
+    }
+
+    // Registers below `count` are in use.
+    void reserve(uint32_t count)
+    {
+        m_out.register_count = std::max(m_out.register_count, count);
+    }
+
+    // ---- Expressions ----
+
+    // Expressions are compiled from an explicit stack of tasks rather than by
+    // recursion. Each value goes to a given register; whatever it needs on the
+    // way uses registers from `top` up, which are free.
+    struct ExprTask
+    {
+        enum class Kind : uint8_t
+        {
+            value,      // r[dst] = `node`
+            apply,      // r[dst] = `node`'s operator applied to `operands`
+            branch,     // jump to `label` if `node` is true, or false when !jump_if
+            test,       // jump to `label` if r[dst] is non-zero, or zero when !jump_if
+            compare,    // jump to `label` if `op` holds for `operands`, or not when !jump_if
+            label,      // define `label`
+            boolean     // r[dst] = 1, or 0 when entered at `label`
+        };
+        Kind kind;
+        NodeIndex node = no_node;
+        uint32_t dst = 0;
+        uint32_t top = 0;
+        uint32_t label = 0;
+        bool jump_if = false;
+        BinOp op = BinOp::add;
+        BcOperands operands {};
+    };
+
+    void compile_expr(NodeIndex root, uint32_t dst, uint32_t top)
+    {
+        reserve(std::max(dst + 1, top));
+        m_tasks.push_back({ .kind = ExprTask::Kind::value, .node = root, .dst = dst, .top = top });
+        run_tasks();
+    }
+
+    void compile_cond_jump(NodeIndex cond, uint32_t label, bool jump_if, uint32_t top)
+    {
+        m_tasks.push_back({ .kind = ExprTask::Kind::branch, .node = cond, .top = top, .label = label, .jump_if = jump_if });
+        run_tasks();
+    }
+
+    // The register a variable operand is read from directly, if `node` is one.
+    std::optional<uint32_t> slot_of(NodeIndex node)
+    {
+        const NodeExpr& expr = m_prog.expr(node);
+        if (expr.kind != NodeKind::term_ident)
+        {
+            return {};
+        }
+        return lookup_var(expr.name);
+    }
+
+    bool is_literal(NodeIndex node) const
+    {
+        return m_prog.expr(node).kind == NodeKind::term_int_lit;
+    }
+
+    // An operand that is neither a variable nor (on the right) a constant is
+    // computed into the next free register first.
+    uint32_t operand(NodeIndex node, uint32_t& top)
+    {
+        if (std::optional<uint32_t> slot = slot_of(node))
+        {
+            return *slot;
+        }
+        m_pending.push_back({ node, top });
+        return top++;
+    }
+
+    // Resolves both operands of `expr`, the right one as a constant if
+    // `const_rhs` allows it. A constant on the left of a commutative operator
+    // or comparison moves to the right, mirroring `op`.
+    BcOperands resolve(const NodeExpr& expr, BinOp& op, uint32_t& top, bool const_rhs)
+    {
+        NodeIndex lhs = expr.lhs;
+        NodeIndex rhs = expr.rhs;
+        bool swappable = op == BinOp::add || op == BinOp::mul || is_comparison(op);
+        if (swappable && is_literal(lhs) && !is_literal(rhs))
+        {
+            std::swap(lhs, rhs);
+            op = mirror(op);
+        }
+        m_pending.clear();
+        BcOperands operands {};
+        operands.lhs = operand(lhs, top);
+        operands.rhs_const = const_rhs && is_literal(rhs);
+        operands.rhs = operands.rhs_const ? constant(m_prog.expr(rhs).value) : operand(rhs, top);
+        reserve(top);
+        return operands;
+    }
+
+    // Queues the operands resolve() found to compute; each may use the
+    // registers above both of them.
+    void push_pending(uint32_t top)
+    {
+        for (auto [node, dst] : m_pending)
+        {
+            m_tasks.push_back({ .kind = ExprTask::Kind::value, .node = node, .dst = dst, .top = top });
+        }
+    }
+
+    void run_tasks()
+    {
+        using Kind = ExprTask::Kind;
+        while (!m_tasks.empty())
+        {
+            ExprTask task = m_tasks.back();
+            m_tasks.pop_back();
+            switch (task.kind)
+            {
+                case Kind::value:
+                    compile_value(task);
+                    break;
+                case Kind::apply:
+                    emit(value_op(task.op, task.operands.rhs_const), task.dst, task.operands.lhs, task.operands.rhs);
+                    break;
+                case Kind::branch:
+                    compile_branch(task);
+                    break;
+                case Kind::test:
+                    emit_jump(task.jump_if ? BcOp::jnz : BcOp::jz, task.label, task.dst);
+                    break;
+                case Kind::compare:
+                {
+                    BinOp op = task.jump_if ? task.op : negate(task.op);
+                    emit_jump(branch_op(op, task.operands.rhs_const), task.label, task.operands.lhs, task.operands.rhs);
+                    break;
+                }
+                case Kind::label:
+                    define_label(task.label);
+                    break;
+                case Kind::boolean:
+                {
+                    uint32_t end_label = create_label();
+                    emit(BcOp::loadk, task.dst, constant(1));
+                    emit_jump(BcOp::jmp, end_label);
+                    define_label(task.label);
+                    emit(BcOp::loadk, task.dst, constant(0));
+                    define_label(end_label);
+                    break;
+                }
+            }
+        }
+    }
+
+    void compile_value(const ExprTask& task)
+    {
+        using Kind = ExprTask::Kind;
+        const NodeExpr& expr = m_prog.expr(task.node);
+        switch (expr.kind)
+        {
+            case NodeKind::term_int_lit:
+                emit(BcOp::loadk, task.dst, constant(expr.value));
+                break;
+            case NodeKind::term_ident:
+            {
+                uint32_t slot = lookup_var(expr.name);
+                if (slot != task.dst)
+                {
+                    emit(BcOp::mov, task.dst, slot);
+                }
+                break;
+            }
+            case NodeKind::bin_expr:
+            {
+                if (is_logical(expr.op))
+                {
+                    uint32_t false_label = create_label();
+                    m_tasks.push_back({ .kind = Kind::boolean, .dst = task.dst, .label = false_label });
+                    m_tasks.push_back({ .kind = Kind::branch, .node = task.node, .top = task.top, .label = false_label, .jump_if = false });
+                    break;
+                }
+                // The operands are computed into registers above dst, so dst
+                // (possibly the variable being assigned) is written last.
+                BinOp op = expr.op;
+                uint32_t top = task.top;
+                // Comparisons as values have no constant form; branches on them do.
+                BcOperands operands = resolve(expr, op, top, !is_comparison(op));
+                m_tasks.push_back({ .kind = Kind::apply, .dst = task.dst, .op = op, .operands = operands });
+                push_pending(top);
+                break;
+            }
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+
+    void compile_branch(const ExprTask& task)
+    {
+        using Kind = ExprTask::Kind;
+        const NodeExpr& expr = m_prog.expr(task.node);
+        if (expr.kind == NodeKind::bin_expr && is_comparison(expr.op))
+        {
+            BinOp op = expr.op;
+            uint32_t top = task.top;
+            BcOperands operands = resolve(expr, op, top, true);
+            m_tasks.push_back({ .kind = Kind::compare, .label = task.label, .jump_if = task.jump_if, .op = op, .operands = operands });
+            push_pending(top);
+            return;
+        }
+        if (expr.kind == NodeKind::term_int_lit)
+        {
+            // A constant condition either always jumps or never does.
+            if ((expr.value != 0) == task.jump_if)
+            {
+                emit_jump(BcOp::jmp, task.label);
+            }
+            return;
+        }
+        if (expr.kind != NodeKind::bin_expr || !is_logical(expr.op))
+        {
+            std::optional<uint32_t> slot = slot_of(task.node);
+            uint32_t reg = slot.value_or(task.top);
+            m_tasks.push_back({ .kind = Kind::test, .dst = reg, .label = task.label, .jump_if = task.jump_if });
+            if (!slot)
+            {
+                reserve(task.top + 1);
+                m_tasks.push_back({ .kind = Kind::value, .node = task.node, .dst = reg, .top = task.top + 1 });
+            }
+            return;
+        }
+        // A false `a` settles a && b and a true one settles a || b. Jumping on that
+        // outcome is a jump on each operand; jumping on the other needs a label
+        // past `b` for when `a` alone settles it.
+        bool settles_on = expr.op == BinOp::log_or;
+        if (task.jump_if == settles_on)
+        {
+            m_tasks.push_back({ .kind = Kind::branch, .node = expr.rhs, .top = task.top, .label = task.label, .jump_if = task.jump_if });
+            m_tasks.push_back({ .kind = Kind::branch, .node = expr.lhs, .top = task.top, .label = task.label, .jump_if = task.jump_if });
+        }
+        else
+        {
+            uint32_t skip = create_label();
+            m_tasks.push_back({ .kind = Kind::label, .label = skip });
+            m_tasks.push_back({ .kind = Kind::branch, .node = expr.rhs, .top = task.top, .label = task.label, .jump_if = task.jump_if });
+            m_tasks.push_back({ .kind = Kind::branch, .node = expr.lhs, .top = task.top, .label = skip, .jump_if = settles_on });
+        }
+    }
+
+    // ---- Statements ----
+
+    // Blocks are compiled from an explicit stack of frames rather than by
+    // recursion, so nesting depth and elif chain length are bounded by memory.
+    struct Frame
+    {
+        std::span<const NodeIndex> stmts;
+        size_t next = 0;
+        NodeIndex arm = no_node;    // the if/elif/else/while this block is the body of
+        uint32_t label = 0;         // if, elif: where a false condition jumps to; while: top of the body
+        uint32_t end_label = 0;     // elif, else: end of the whole chain; while: past the loop
+    };
+
+    // A while being compiled. Its condition sits after the body, so each
+    // iteration ends in one fused compare-and-branch back to the top.
+    struct Loop
+    {
+        uint32_t cond_label;        // where `continue` goes
+        uint32_t end_label;         // where `break` goes
+    };
+
+    void compile_stmts()
+    {
+        m_frames.push_back({ .stmts = m_prog.stmts });
+        while (true)
+        {
+            Frame& frame = m_frames.back();
+            if (frame.next < frame.stmts.size())
+            {
+                compile_stmt(frame.stmts[frame.next++]);
+                continue;
+            }
+            Frame done = frame;
+            m_frames.pop_back();
+            if (m_frames.empty())
+            {
+                break;
+            }
+            // The scope's variables give their slots back.
+            m_var_count -= static_cast<uint32_t>(m_vars.scope_size());
+            m_vars.exit_scope();
+            if (done.arm != no_node)
+            {
+                close_arm(done);
+            }
+        }
+    }
+
+    void open_scope(NodeIndex scope, NodeIndex arm = no_node, uint32_t label = 0, uint32_t end_label = 0)
+    {
+        m_vars.enter_scope();
+        m_frames.push_back({ .stmts = m_prog.scope_stmts(m_prog.stmt(scope)), .arm = arm, .label = label, .end_label = end_label });
+    }
+
+    void open_pred(NodeIndex index, uint32_t end_label)
+    {
+        const NodeStmt& pred = m_prog.stmt(index);
+        switch (pred.kind)
+        {
+            case NodeKind::if_pred_elif:
+            {
+                uint32_t label = create_label();
+                compile_cond_jump(pred.expr, label, false, m_var_count);
+                open_scope(pred.scope, index, label, end_label);
+                break;
+            }
+            case NodeKind::if_pred_else:
+                open_scope(pred.scope, index, 0, end_label);
+                break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+
+    // Runs once the body of an if, elif, else or while has been compiled.
+    void close_arm(const Frame& frame)
+    {
+        const NodeStmt& arm = m_prog.stmt(frame.arm);
+        switch (arm.kind)
+        {
+            case NodeKind::stmt_if:
+            {
+                if (arm.pred == no_node)
+                {
+                    define_label(frame.label);
+                    break;
+                }
+                uint32_t end_label = create_label();
+                emit_jump(BcOp::jmp, end_label);
+                define_label(frame.label);
+                open_pred(arm.pred, end_label);
+                break;
+            }
+            case NodeKind::if_pred_elif:
+                emit_jump(BcOp::jmp, frame.end_label);
+                define_label(frame.label);
+                if (arm.pred != no_node)
+                {
+                    open_pred(arm.pred, frame.end_label);
+                }
+                else
+                {
+                    define_label(frame.end_label);
+                }
+                break;
+            case NodeKind::if_pred_else:
+                define_label(frame.end_label);
+                break;
+            case NodeKind::stmt_while:
+                define_label(m_loops.back().cond_label);
+                compile_cond_jump(arm.expr, frame.label, true, m_var_count);
+                define_label(frame.end_label);
+                m_loops.pop_back();
+                break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+
+    void compile_stmt(NodeIndex index)
+    {
+        const NodeStmt& stmt = m_prog.stmt(index);
+        switch (stmt.kind)
+        {
+            case NodeKind::stmt_exit:
+            {
+                uint32_t top = m_var_count;
+                uint32_t reg = slot_of(stmt.expr).value_or(top);
+                if (reg == top)
+                {
+                    compile_expr(stmt.expr, top, top + 1);
+                }
+                emit(BcOp::exit, reg);
+                break;
+            }
+            case NodeKind::stmt_let:
+            {
+                // The same slot the Generator gives the variable on the stack.
+                uint32_t slot = m_var_count;
+                compile_expr(stmt.expr, slot, slot + 1);
+                m_vars.declare(stmt.name, slot);
+                m_var_count++;
+                break;
+            }
+            case NodeKind::stmt_asign:
+                compile_expr(stmt.expr, lookup_var(stmt.name), m_var_count);
+                break;
+            case NodeKind::scope:
+                open_scope(index);
+                break;
+            case NodeKind::stmt_if:
+            {
+                uint32_t label = create_label();
+                compile_cond_jump(stmt.expr, label, false, m_var_count);
+                open_scope(stmt.scope, index, label);
+                break;
+            }
+            case NodeKind::stmt_while:
+            {
+                uint32_t top = create_label();
+                uint32_t cond = create_label();
+                uint32_t end = create_label();
+                emit_jump(BcOp::jmp, cond);
+                define_label(top);
+                m_loops.push_back({ .cond_label = cond, .end_label = end });
+                open_scope(stmt.scope, index, top, end);
+                break;
+            }
+            case NodeKind::stmt_break:
+                emit_jump(BcOp::jmp, m_loops.back().end_label);
+                break;
+            case NodeKind::stmt_continue:
+                emit_jump(BcOp::jmp, m_loops.back().cond_label);
+                break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+
+    uint32_t lookup_var(Symbol name)
+    {
+        const uint32_t* slot = m_vars.find(name);
+        if (!slot)
+        {
+            // check_semantics rejects these before code generation.
+            throw std::runtime_error("Unresolved identifier: " + std::string(m_prog.interner->name(name)));
+        }
+        return *slot;
+    }
+
+    const NodeProg& m_prog;
+    Bytecode m_out;
+    ScopedTable<uint32_t> m_vars;
+    uint32_t m_var_count = 0;       // variables live; also the next one's slot
+    std::unordered_map<uint64_t, uint32_t> m_constant_index;
+    std::vector<uint32_t> m_labels;     // label -> instruction index
+    std::vector<size_t> m_fixups;       // jumps whose c is still a label
+    std::vector<std::pair<NodeIndex, uint32_t>> m_pending;  // operands resolve() left to compute
+    std::vector<ExprTask> m_tasks;
+    std::vector<Frame> m_frames;
+    std::vector<Loop> m_loops;
+};
+
+const char* op_name(BcOp op)
+{
+    static constexpr const char* names[] = {
+        "loadk", "mov",
+        "add", "sub", "mul", "div",
+        "add_k", "sub_k", "mul_k", "div_k",
+        "eq", "ne", "lt", "le", "gt", "ge",
+        "jmp", "jz", "jnz",
+        "jeq", "jne", "jlt", "jle", "jgt", "jge",
+        "jeq_k", "jne_k", "jlt_k", "jle_k", "jgt_k", "jge_k",
+        "exit"
+    };
+    static_assert(std::size(names) == bc_op_count);
+    return names[static_cast<size_t>(op)];
+}
+
+void print_reg(OutputBuffer& out, uint32_t reg)
+{
+    out.append('r');
+    out.append_uint(reg);
+}
+
+} // namespace
+
+Bytecode compile_bytecode(const NodeProg& prog)
+{
+    BytecodeCompiler compiler(prog);
+    return compiler.compile();
+}
+
+void dump_bytecode(const Bytecode& program, OutputBuffer& out)
+{
+    out.append("; ");
+    out.append_uint(program.register_count);
+    out.append(" registers, ");
+    out.append_uint(program.constants.size());
+    out.append(" constants\n");
+    for (size_t i = 0; i < program.code.size(); i++)
+    {
+        const BcInstr& instr = program.code[i];
+        out.append_uint(i);
+        out.append(":\t");
+        out.append(op_name(instr.op));
+        out.append(' ');
+        switch (instr.op)
+        {
+            case BcOp::loadk:
+                print_reg(out, instr.a);
+                out.append(", ");
+                out.append_uint(program.constants[instr.b]);
+                break;
+            case BcOp::mov:
+                print_reg(out, instr.a);
+                out.append(", ");
+                print_reg(out, instr.b);
+                break;
+            case BcOp::add_k:
+            case BcOp::sub_k:
+            case BcOp::mul_k:
+            case BcOp::div_k:
+                print_reg(out, instr.a);
+                out.append(", ");
+                print_reg(out, instr.b);
+                out.append(", ");
+                out.append_uint(program.constants[instr.c]);
+                break;
+            case BcOp::jmp:
+                out.append_uint(instr.c);
+                break;
+            case BcOp::jz:
+            case BcOp::jnz:
+                print_reg(out, instr.a);
+                out.append(", ");
+                out.append_uint(instr.c);
+                break;
+            case BcOp::jeq_k:
+            case BcOp::jne_k:
+            case BcOp::jlt_k:
+            case BcOp::jle_k:
+            case BcOp::jgt_k:
+            case BcOp::jge_k:
+                print_reg(out, instr.a);
+                out.append(", ");
+                out.append_uint(program.constants[instr.b]);
+                out.append(", ");
+                out.append_uint(instr.c);
+                break;
+            case BcOp::exit:
+                print_reg(out, instr.a);
+                break;
+            default:
+                if (is_jump(instr.op))
+                {
+                    print_reg(out, instr.a);
+                    out.append(", ");
+                    print_reg(out, instr.b);
+                    out.append(", ");
+                    out.append_uint(instr.c);
+                    break;
+                }
+                print_reg(out, instr.a);
+                out.append(", ");
+                print_reg(out, instr.b);
+                out.append(", ");
+                print_reg(out, instr.c);
+                break;
+        }
+        out.append('\n');
+    }
+}
@@ -0,0 +1,87 @@
+//
+//  Bytecode.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Output.hpp"
+#include "Parser.hpp"
+
+// A register bytecode for running programs without generating native code.
+//
+// Registers are 64-bit slots in one flat frame. A variable lives in the slot
+// the -O0 Generator gives it on the stack (the number of variables live when
+// it is declared), and temporaries sit above the variables, so reading a
+// variable never takes an instruction of its own. Constants live in a pool
+// and are named by index. Jump targets are instruction indices.
+//
+// Besides the plain operations there are super-instructions for the patterns
+// that dominate real programs: an operation with a constant right operand
+// (x + 1 is one add_k) and a comparison fused with the branch on it.
+
+enum class BcOp : uint8_t
+{
+    loadk,      // r[a] = k[b]
+    mov,        // r[a] = r[b]
+    add,        // r[a] = r[b] op r[c]
+    sub,
+    mul,
+    div,
+    add_k,      // r[a] = r[b] op k[c]
+    sub_k,
+    mul_k,
+    div_k,
+    eq,         // r[a] = r[b] op r[c], unsigned, 0 or 1
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+    jmp,        // to c
+    jz,         // to c if r[a] == 0
+    jnz,        // to c if r[a] != 0
+    jeq,        // to c if r[a] op r[b]
+    jne,
+    jlt,
+    jle,
+    jgt,
+    jge,
+    jeq_k,      // to c if r[a] op k[b]
+    jne_k,
+    jlt_k,
+    jle_k,
+    jgt_k,
+    jge_k,
+    exit        // end the program with status r[a]
+};
+
+inline constexpr size_t bc_op_count = static_cast<size_t>(BcOp::exit) + 1;
+
+struct BcInstr
+{
+    BcOp op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+};
+
+struct Bytecode
+{
+    std::vector<BcInstr> code;          // entered at 0; every path ends in exit
+    std::vector<uint64_t> constants;
+    uint32_t register_count = 0;
+};
+
+// Compiles a checked program (after check_semantics, and fold_constants if
+// wanted). Like the Generator it walks the AST with explicit stacks, so
+// nesting depth is bounded by memory rather than by the call stack.
+Bytecode compile_bytecode(const NodeProg& prog);
+
+// Human-readable listing, one instruction per line.
+void dump_bytecode(const Bytecode& program, OutputBuffer& out);
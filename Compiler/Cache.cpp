@@ -0,0 +1,230 @@
+//
+//  Cache.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Output.hpp"
+#include "Source.hpp"
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view compiler_version = "newton 0.1";
+
+// MurmurHash3 x64_128; fast enough that hashing a file costs about as much as reading it.
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static void hash128(std::string_view data, uint64_t seed, uint64_t out[2])
+{
+    constexpr uint64_t c1 = 0x87c37b91114253d5ULL;
+    constexpr uint64_t c2 = 0x4cf5ad432745937fULL;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+    size_t blocks = data.size() / 16;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    
+    for (size_t i = 0; i < blocks; i++, p += 16)
+    {
+        uint64_t k1, k2;
+        std::memcpy(&k1, p, 8);
+        std::memcpy(&k2, p + 8, 8);
+        h1 ^= rotl(k1 * c1, 31) * c2;
+        h1 = (rotl(h1, 27) + h2) * 5 + 0x52dce729;
+        h2 ^= rotl(k2 * c2, 33) * c1;
+        h2 = (rotl(h2, 31) + h1) * 5 + 0x38495ab5;
+    }
+    
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    size_t tail = data.size() & 15;
+    for (size_t i = tail; i > 8; i--)
+    {
+        k2 ^= static_cast<uint64_t>(p[i - 1]) << ((i - 9) * 8);
+    }
+    for (size_t i = std::min<size_t>(tail, 8); i > 0; i--)
+    {
+        k1 ^= static_cast<uint64_t>(p[i - 1]) << ((i - 1) * 8);
+    }
+    if (tail > 8)
+    {
+        h2 ^= rotl(k2 * c2, 33) * c1;
+    }
+    if (tail > 0)
+    {
+        h1 ^= rotl(k1 * c1, 31) * c2;
+    }
+    
+    h1 ^= data.size();
+    h2 ^= data.size();
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+BuildCache::BuildCache(std::string dir, uint64_t max_bytes, std::string identity)
+    : m_dir(std::move(dir)), m_max_bytes(max_bytes), m_identity(std::move(identity)) {}
+
+bool BuildCache::open()
+{
+    std::error_code ec;
+    fs::create_directories(fs::path(m_dir) / "tmp", ec);
+    return !ec;
+}
+
+std::string BuildCache::key(std::string_view options, std::string_view source) const
+{
+    std::string header = m_identity;
+    header += '\0';
+    header += options;
+    uint64_t seed[2];
+    hash128(header, 0, seed);
+    uint64_t hash[2];
+    hash128(source, seed[0] ^ seed[1], hash);
+    
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string key(32, '0');
+    for (int i = 0; i < 32; i++)
+    {
+        key[i] = digits[(hash[i / 16] >> (60 - (i % 16) * 4)) & 15];
+    }
+    return key;
+}
+
+std::string BuildCache::entry_path(const std::string& key) const
+{
+    // Fanned out over 256 directories so none of them gets huge.
+    return m_dir + "/" + key.substr(0, 2) + "/" + key.substr(2);
+}
+
+bool BuildCache::fetch(const std::string& key, const std::string& output, bool executable)
+{
+    std::string path = entry_path(key);
+    SourceFile entry(path);
+    if (!entry.is_open() || !write_file(output, entry.view().data(), entry.size(), executable))
+    {
+        m_misses++;
+        return false;
+    }
+    // Mark as recently used. Access times are often not maintained, so use mtime.
+    utimes(path.c_str(), nullptr);
+    m_hits++;
+    return true;
+}
+
+void BuildCache::store(const std::string& key, const std::function<bool(const std::string& path)>& write)
+{
+    std::string temp = m_dir + "/tmp/" + key + "." + std::to_string(getpid()) + "." + std::to_string(m_temp_count++);
+    std::string path = entry_path(key);
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    if (ec || !write(temp) || std::rename(temp.c_str(), path.c_str()) != 0)
+    {
+        // The cache is only an optimisation; a failed store just means a later miss.
+        fs::remove(temp, ec);
+        return;
+    }
+    m_stores++;
+}
+
+void BuildCache::trim()
+{
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type used;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(m_dir, ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (it.depth() == 0 && it->path().filename() == "tmp")
+        {
+            it.disable_recursion_pending();
+            continue;
+        }
+        std::error_code entry_ec;
+        if (it->is_regular_file(entry_ec))
+        {
+            Entry entry { it->path(), it->last_write_time(entry_ec), it->file_size(entry_ec) };
+            if (!entry_ec)
+            {
+                total += entry.size;
+                entries.push_back(std::move(entry));
+            }
+        }
+    }
+    
+    if (total > m_max_bytes)
+    {
+        // Go a little below the limit so the next few stores do not each trigger a trim.
+        uint64_t target = m_max_bytes - m_max_bytes / 10;
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+        for (const Entry& entry : entries)
+        {
+            if (total <= target)
+            {
+                break;
+            }
+            if (fs::remove(entry.path, ec))
+            {
+                total -= entry.size;
+                m_evictions++;
+            }
+        }
+    }
+    m_bytes = total;
+}
+
+BuildCache::Stats BuildCache::stats() const
+{
+    return {
+        .hits = m_hits,
+        .misses = m_misses,
+        .stores = m_stores,
+        .evictions = m_evictions,
+        .bytes = m_bytes,
+    };
+}
+
+std::string compiler_identity(const char* argv0)
+{
+    std::string identity(compiler_version);
+    struct stat info;
+    if (stat("/proc/self/exe", &info) == 0 || (argv0 && stat(argv0, &info) == 0))
+    {
+        identity += " " + std::to_string(info.st_size) + " " + std::to_string(info.st_mtime);
+    }
+    return identity;
+}
@@ -0,0 +1,69 @@
+//
+//  Cache.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// On-disk store of finished outputs, keyed by a hash of the compiler, the
+// options and the source bytes. Entries are written to a temporary file and
+// renamed into place, so a reader never sees half an entry, and the file's
+// modification time doubles as its last-use time for LRU eviction. Safe to
+// share between threads and between processes.
+class BuildCache
+{
+public:
+    struct Stats
+    {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t stores = 0;
+        size_t evictions = 0;
+        uint64_t bytes = 0;     // size of the cache after the last trim()
+    };
+    
+    // `identity` is mixed into every key; see compiler_identity().
+    BuildCache(std::string dir, uint64_t max_bytes, std::string identity);
+    
+    // Creates the cache directory. False if it cannot be used.
+    bool open();
+    
+    // 128-bit key as 32 hex digits. `options` is anything that changes the output.
+    [[nodiscard]] std::string key(std::string_view options, std::string_view source) const;
+    
+    // Copies the entry for `key` to `output`. False, and counted as a miss, if there is none.
+    bool fetch(const std::string& key, const std::string& output, bool executable);
+    
+    // `write` fills the temporary path it is given; the result becomes the entry for `key`.
+    void store(const std::string& key, const std::function<bool(const std::string& path)>& write);
+    
+    // Evicts least recently used entries until the cache is within its size limit.
+    void trim();
+    
+    [[nodiscard]] Stats stats() const;
+    
+private:
+    std::string entry_path(const std::string& key) const;
+    
+    std::string m_dir;
+    uint64_t m_max_bytes;
+    std::string m_identity;
+    std::atomic<size_t> m_hits = 0;
+    std::atomic<size_t> m_misses = 0;
+    std::atomic<size_t> m_stores = 0;
+    std::atomic<size_t> m_temp_count = 0;
+    size_t m_evictions = 0;
+    uint64_t m_bytes = 0;
+};
+
+// Names this build of the compiler: the version plus the size and timestamp of
+// the running executable, so rebuilding the compiler invalidates old entries.
+std::string compiler_identity(const char* argv0);
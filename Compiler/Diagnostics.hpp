@@ -0,0 +1,19 @@
+//
+//  Diagnostics.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// An error in the program being compiled, as opposed to a bug in the compiler.
+// The message is complete ("[Parser error] ... on line N") and is reported as-is
+// by the driver, which carries on with any other files.
+struct CompileError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
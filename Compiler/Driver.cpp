@@ -0,0 +1,268 @@
+//
+//  Driver.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Driver.hpp"
+#include "Diagnostics.hpp"
+#include "Cache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <vector>
+
+#include "Tokenization.hpp"
+#include "Parser.hpp"
+#include "Generation.hpp"
+#include "IrBuilder.hpp"
+#include "IrLoops.hpp"
+#include "Bytecode.hpp"
+#include "Interpreter.hpp"
+#include "Encoder.hpp"
+#include "Elf.hpp"
+#include "Jit.hpp"
+#include "Optimization.hpp"
+#include "Peephole.hpp"
+#include "Semantic.hpp"
+#include "Source.hpp"
+#include "Output.hpp"
+#include "Instrumentation.hpp"
+
+std::string default_output(std::string_view input, EmitKind emit)
+{
+    std::string base(input.substr(0, input.size() - source_ext.size()));
+    switch (emit)
+    {
+        case EmitKind::exe: return base;
+        case EmitKind::run: return base;
+        case EmitKind::bytecode: return base + ".bc";
+        case EmitKind::interpret: return base;
+        case EmitKind::obj: return base + ".o";
+        case EmitKind::asm_: return base + ".asm";
+        case EmitKind::ir: return base + ".ir";
+    }
+    return base;
+}
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point since)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count());
+}
+
+static CompileResult failure(std::string message)
+{
+    return { .ok = false, .diagnostics = std::move(message) };
+}
+
+// Everything in CompileOptions that changes the output, for the cache key.
+static std::string options_key(const CompileOptions& options)
+{
+    return "O" + std::to_string(options.opt_level) + " emit" + std::to_string(static_cast<int>(options.emit))
+        + (options.peephole ? " peephole" : "");
+}
+
+CompileResult compile_file(const CompileJob& job, const CompileOptions& options, BuildCache* cache)
+{
+    auto compile_start = std::chrono::steady_clock::now();
+    bool run = executes(options.emit);
+    if (run || job.output.empty())
+    {
+        cache = nullptr;
+    }
+    
+    // Mapped for the whole compile: tokens refer into it rather than owning copies.
+    std::optional<SourceFile> file;
+    std::string_view source;
+    if (job.source)
+    {
+        source = *job.source;
+    }
+    else
+    {
+        PhaseScope phase("read");
+        file.emplace(job.input);
+        if (!file->is_open())
+        {
+            return failure("Could not open " + job.input);
+        }
+        source = file->view();
+    }
+    count_stat("source bytes", source.size());
+    
+    std::string key;
+    if (cache)
+    {
+        PhaseScope phase("cache lookup");
+        key = cache->key(options_key(options), source);
+        if (cache->fetch(key, job.output, options.emit == EmitKind::exe))
+        {
+            return { .ok = true, .cached = true };
+        }
+    }
+    
+    try
+    {
+        // Identifier names for every phase; the tree itself only holds Symbols.
+        Interner interner;
+        std::optional<NodeProg> prog;
+        {
+            // The tokenizer is pulled by the parser, so lexing is timed as part of parsing.
+            PhaseScope phase("parse");
+            Tokenizer tokenizer(source, interner);
+            Parser parser(tokenizer);
+            prog = parser.parse_prog();
+            count_stat("tokens", tokenizer.token_count());
+            count_stat("symbols", interner.size());
+        }
+        
+        if (!prog.has_value())
+        {
+            return failure("Invalid Program");
+        }
+        count_stat("ast nodes", prog->exprs.size() + prog->stmt_pool.size());
+        
+        {
+            PhaseScope phase("semantic");
+            check_semantics(prog.value());
+        }
+        
+        if (options.opt_level >= 1)
+        {
+            PhaseScope phase("fold constants");
+            count_stat("folded exprs", fold_constants(prog.value()));
+        }
+        
+        std::optional<OutputBuffer> text;
+        std::vector<uint8_t> bytes;
+        std::vector<Instr> code;
+        std::optional<Bytecode> bytecode;
+        if (options.emit == EmitKind::bytecode || options.emit == EmitKind::interpret)
+        {
+            PhaseScope phase("bytecode");
+            bytecode = compile_bytecode(prog.value());
+            count_stat("bytecode instructions", bytecode->code.size());
+            count_stat("bytecode registers", bytecode->register_count);
+        }
+        else if (options.emit == EmitKind::ir)
+        {
+            PhaseScope phase("ir");
+            IrFunc ir = build_ir(prog.value());
+            if (options.opt_level >= 1)
+            {
+                optimize_loops(ir);
+            }
+            verify_ir(ir);
+            text.emplace();
+            dump_ir(ir, *text);
+        }
+        else
+        {
+            {
+                PhaseScope phase("codegen");
+                Generator generator(std::move(prog.value()), options.opt_level, options.emit == EmitKind::run ? ExitConvention::ret : ExitConvention::syscall);
+                code = generator.gen_prog();
+            }
+            if (options.peephole)
+            {
+                PhaseScope phase("peephole");
+                count_stat("peephole rewrites", peephole(code));
+            }
+            count_stat("instructions", std::count_if(code.begin(), code.end(), [](const Instr& instr) { return instr.op != Op::label; }));
+            count_stat("labels", std::count_if(code.begin(), code.end(), [](const Instr& instr) { return instr.op == Op::label; }));
+        }
+        bool exe = options.emit == EmitKind::exe;
+        {
+            PhaseScope phase("emit");
+            switch (options.emit)
+            {
+                case EmitKind::ir:
+                case EmitKind::interpret:
+                    break;
+                case EmitKind::bytecode:
+                    text.emplace(bytecode->code.size() * 24 + 64);
+                    dump_bytecode(*bytecode, *text);
+                    break;
+                case EmitKind::asm_:
+                    // Roughly 20 bytes of text per instruction; the buffer grows past this if needed.
+                    text.emplace(code.size() * 20 + 64);
+                    emit_nasm(code, *text);
+                    break;
+                case EmitKind::obj:
+                    bytes = make_elf_object(encode_x86(code));
+                    break;
+                case EmitKind::exe:
+                    bytes = make_elf_executable(encode_x86(code));
+                    break;
+                case EmitKind::run:
+                    bytes = encode_x86(code);
+                    break;
+            }
+        }
+        count_stat("output bytes", text ? text->size() : bytes.size());
+        
+        if (options.emit == EmitKind::interpret)
+        {
+            CompileResult result = { .ok = true };
+            Interpreter interpreter(*bytecode);
+            result.compile_ns = elapsed_ns(compile_start);
+            PhaseScope phase("interpret");
+            auto run_start = std::chrono::steady_clock::now();
+            result.status = static_cast<uint8_t>(interpreter.run());
+            result.run_ns = elapsed_ns(run_start);
+            return result;
+        }
+        if (run)
+        {
+            CompileResult result = { .ok = true };
+            JitProgram program(bytes);
+            if (!program.is_loaded())
+            {
+                return failure("Could not map executable memory for " + job.input);
+            }
+            result.compile_ns = elapsed_ns(compile_start);
+            PhaseScope phase("run");
+            auto run_start = std::chrono::steady_clock::now();
+            result.status = static_cast<uint8_t>(program.run());
+            result.run_ns = elapsed_ns(run_start);
+            return result;
+        }
+        
+        if (job.output.empty())
+        {
+            CompileResult result = { .ok = true };
+            result.output = text ? text->str() : std::string(bytes.begin(), bytes.end());
+            return result;
+        }
+        
+        // Used for both the real output and the cache entry.
+        auto write = [&](const std::string& path) {
+            return text ? text->write_to(path) : write_file(path, bytes.data(), bytes.size(), exe);
+        };
+        {
+            PhaseScope phase("write");
+            if (!write(job.output))
+            {
+                return failure("Could not write " + job.output);
+            }
+        }
+        if (cache)
+        {
+            PhaseScope phase("cache store");
+            cache->store(key, write);
+        }
+    }
+    catch (const CompileError& error)
+    {
+        return failure(error.what());
+    }
+    catch (const std::exception& error)
+    {
+        // A compiler bug in one file should not take the rest of the build down with it.
+        return failure(std::string("[Internal error] ") + error.what());
+    }
+    
+    return { .ok = true };
+}
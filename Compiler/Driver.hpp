@@ -0,0 +1,70 @@
+//
+//  Driver.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+class BuildCache;
+
+enum class EmitKind
+{
+    exe,    // static ELF executable
+    obj,    // relocatable ELF object (-c)
+    asm_,   // NASM text (-S)
+    ir,     // SSA IR listing (--emit-ir)
+    run,    // machine code called in-process (--run); nothing is written
+    bytecode,   // register bytecode listing (--emit-bytecode)
+    interpret   // bytecode run by the interpreter (--interpret); nothing is written
+};
+
+// --run and --interpret execute the program instead of writing anything.
+inline bool executes(EmitKind emit)
+{
+    return emit == EmitKind::run || emit == EmitKind::interpret;
+}
+
+struct CompileOptions
+{
+    int opt_level = 0;
+    EmitKind emit = EmitKind::exe;
+    bool peephole = false;      // on by default from -O1; -fpeephole / -fno-peephole
+};
+
+struct CompileJob
+{
+    std::string input;
+    std::string output;                 // empty: return the output in CompileResult::output
+    std::optional<std::string> source;  // the text of `input`, if it is not to be read from disk
+};
+
+struct CompileResult
+{
+    bool ok = false;
+    bool cached = false;                // output was copied from the cache
+    std::string diagnostics {};         // the error that stopped the compile, if any
+    std::optional<uint8_t> status {};   // --run, --interpret: the exit status, as the executable would report it
+    uint64_t compile_ns = 0;            // --run, --interpret: reading the source until the program can start
+    uint64_t run_ns = 0;                // --run, --interpret: the program itself
+    std::string output {};              // the output, for a job that names no output file
+};
+
+inline constexpr std::string_view source_ext = ".newton";
+
+// foo.newton -> foo, foo.o, foo.asm, foo.ir or foo.bc, in the same directory as
+// the input. --run and --interpret write nothing, but get the executable's name.
+std::string default_output(std::string_view input, EmitKind emit);
+
+// Runs the whole pipeline for one file, or copies the output from `cache` when
+// it has seen the same source and options before. With EmitKind::run or
+// interpret the program is executed on the calling thread instead and the
+// cache is not used.
+// Keeps no state between calls, so separate jobs may run on separate threads.
+CompileResult compile_file(const CompileJob& job, const CompileOptions& options, BuildCache* cache = nullptr);
@@ -0,0 +1,145 @@
+//
+//  Elf.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Elf.hpp"
+
+#include <cstring>
+#include <string>
+
+static constexpr uint64_t load_address = 0x400000;
+
+static constexpr uint16_t et_rel = 1;
+static constexpr uint16_t et_exec = 2;
+static constexpr uint16_t em_x86_64 = 62;
+
+class ElfWriter
+{
+public:
+    std::vector<uint8_t> bytes;
+    
+    template<typename T>
+    void put(T value)
+    {
+        uint8_t raw[sizeof(T)];
+        std::memcpy(raw, &value, sizeof(T));
+        bytes.insert(bytes.end(), raw, raw + sizeof(T));
+    }
+    
+    void put_bytes(const void* data, size_t size)
+    {
+        auto begin = static_cast<const uint8_t*>(data);
+        bytes.insert(bytes.end(), begin, begin + size);
+    }
+    
+    void align(size_t alignment)
+    {
+        while (bytes.size() % alignment)
+            bytes.push_back(0);
+    }
+    
+    void header(uint16_t type, uint64_t entry, uint64_t phoff, uint16_t phnum, uint64_t shoff, uint16_t shnum, uint16_t shstrndx)
+    {
+        static const uint8_t ident[16] = { 0x7F, 'E', 'L', 'F', 2 /* 64-bit */, 1 /* LE */, 1 /* version */, 0 /* SysV */ };
+        put_bytes(ident, sizeof(ident));
+        put<uint16_t>(type);
+        put<uint16_t>(em_x86_64);
+        put<uint32_t>(1);
+        put<uint64_t>(entry);
+        put<uint64_t>(phoff);
+        put<uint64_t>(shoff);
+        put<uint32_t>(0);
+        put<uint16_t>(64);                  // ehsize
+        put<uint16_t>(phnum ? 56 : 0);      // phentsize
+        put<uint16_t>(phnum);
+        put<uint16_t>(shnum ? 64 : 0);      // shentsize
+        put<uint16_t>(shnum);
+        put<uint16_t>(shstrndx);
+    }
+    
+    void section(uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size,
+                 uint32_t link = 0, uint32_t info = 0, uint64_t align = 1, uint64_t entsize = 0)
+    {
+        put<uint32_t>(name);
+        put<uint32_t>(type);
+        put<uint64_t>(flags);
+        put<uint64_t>(0);                   // addr
+        put<uint64_t>(offset);
+        put<uint64_t>(size);
+        put<uint32_t>(link);
+        put<uint32_t>(info);
+        put<uint64_t>(align);
+        put<uint64_t>(entsize);
+    }
+};
+
+std::vector<uint8_t> make_elf_executable(const std::vector<uint8_t>& text)
+{
+    static constexpr uint64_t text_offset = 64 + 56;
+    ElfWriter elf;
+    elf.header(et_exec, load_address + text_offset, 64, 1, 0, 0, 0);
+    
+    // The segment covers the headers too, so file offset and address stay in step.
+    elf.put<uint32_t>(1);                   // PT_LOAD
+    elf.put<uint32_t>(5);                   // PF_R | PF_X
+    elf.put<uint64_t>(0);
+    elf.put<uint64_t>(load_address);
+    elf.put<uint64_t>(load_address);
+    elf.put<uint64_t>(text_offset + text.size());
+    elf.put<uint64_t>(text_offset + text.size());
+    elf.put<uint64_t>(0x1000);
+    
+    elf.put_bytes(text.data(), text.size());
+    return std::move(elf.bytes);
+}
+
+std::vector<uint8_t> make_elf_object(const std::vector<uint8_t>& text)
+{
+    // Section order: null, .text, .symtab, .strtab, .shstrtab
+    static const char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+    static const char strtab[] = "\0_start";
+    
+    ElfWriter elf;
+    elf.header(et_rel, 0, 0, 0, 0, 5, 4);
+    
+    size_t text_offset = elf.bytes.size();
+    elf.put_bytes(text.data(), text.size());
+    
+    elf.align(8);
+    size_t symtab_offset = elf.bytes.size();
+    // Null symbol, the .text section symbol, then global _start.
+    for (int i = 0; i < 24; i++)
+        elf.put<uint8_t>(0);
+    elf.put<uint32_t>(0);
+    elf.put<uint8_t>(3);                    // STB_LOCAL, STT_SECTION
+    elf.put<uint8_t>(0);
+    elf.put<uint16_t>(1);
+    elf.put<uint64_t>(0);
+    elf.put<uint64_t>(0);
+    elf.put<uint32_t>(1);                   // "_start"
+    elf.put<uint8_t>(0x10);                 // STB_GLOBAL, STT_NOTYPE
+    elf.put<uint8_t>(0);
+    elf.put<uint16_t>(1);
+    elf.put<uint64_t>(0);
+    elf.put<uint64_t>(0);
+    size_t symtab_size = elf.bytes.size() - symtab_offset;
+    
+    size_t strtab_offset = elf.bytes.size();
+    elf.put_bytes(strtab, sizeof(strtab));
+    size_t shstrtab_offset = elf.bytes.size();
+    elf.put_bytes(shstrtab, sizeof(shstrtab));
+    
+    elf.align(8);
+    uint64_t shoff = elf.bytes.size();
+    std::memcpy(elf.bytes.data() + 40, &shoff, sizeof(shoff));
+    
+    elf.section(0, 0, 0, 0, 0, 0, 0, 0);
+    elf.section(1, 1 /* PROGBITS */, 6 /* ALLOC | EXECINSTR */, text_offset, text.size(), 0, 0, 16);
+    elf.section(7, 2 /* SYMTAB */, 0, symtab_offset, symtab_size, 3, 2 /* first global */, 8, 24);
+    elf.section(15, 3 /* STRTAB */, 0, strtab_offset, sizeof(strtab));
+    elf.section(23, 3 /* STRTAB */, 0, shstrtab_offset, sizeof(shstrtab));
+    return std::move(elf.bytes);
+}
@@ -0,0 +1,21 @@
+//
+//  Elf.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Minimal ELF64 writers for x86-64 Linux. The code is position independent
+// apart from its own internal jumps, so neither needs relocations.
+
+// A static executable: one read+execute PT_LOAD segment, entered at the start
+// of `text`.
+std::vector<uint8_t> make_elf_executable(const std::vector<uint8_t>& text);
+
+// A relocatable object with `text` in .text and a global _start symbol.
+std::vector<uint8_t> make_elf_object(const std::vector<uint8_t>& text);
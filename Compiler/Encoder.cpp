@@ -0,0 +1,397 @@
+//
+//  Encoder.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Encoder.hpp"
+
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+
+static inline uint8_t reg_low(Reg reg)
+{
+    return static_cast<uint8_t>(reg) & 7;
+}
+
+static inline uint8_t reg_high(Reg reg)
+{
+    return static_cast<uint8_t>(reg) >> 3;
+}
+
+static inline bool fits_imm8(uint64_t value)
+{
+    return static_cast<int64_t>(value) == static_cast<int8_t>(value);
+}
+
+class Encoder
+{
+public:
+    void encode(const Instr& instr, bool long_jump)
+    {
+        switch (instr.op)
+        {
+            case Op::mov:
+                encode_mov(instr.dst, instr.src);
+                break;
+            case Op::push:
+                if (instr.dst.is_reg())
+                {
+                    rex(false, 0, 0, reg_high(instr.dst.reg));
+                    byte(0x50 + reg_low(instr.dst.reg));
+                }
+                else
+                {
+                    // FF /6 defaults to 64-bit operands, so no REX.W.
+                    modrm_op(false, { 0xFF }, 6, instr.dst);
+                }
+                break;
+            case Op::pop:
+                rex(false, 0, 0, reg_high(instr.dst.reg));
+                byte(0x58 + reg_low(instr.dst.reg));
+                break;
+            case Op::add:
+                encode_alu(0x01, 0x03, 0, instr.dst, instr.src);
+                break;
+            case Op::sub:
+                encode_alu(0x29, 0x2B, 5, instr.dst, instr.src);
+                break;
+            case Op::xor_:
+                encode_alu(0x31, 0x33, 6, instr.dst, instr.src);
+                break;
+            case Op::cmp:
+                encode_alu(0x39, 0x3B, 7, instr.dst, instr.src);
+                break;
+            case Op::test:
+                if (!instr.src.is_reg())
+                {
+                    throw std::runtime_error("test needs a register source");
+                }
+                modrm_op(true, { 0x85 }, static_cast<uint8_t>(instr.src.reg), instr.dst);
+                break;
+            case Op::mul:
+                modrm_op(true, { 0xF7 }, 4, instr.dst);
+                break;
+            case Op::div:
+                modrm_op(true, { 0xF7 }, 6, instr.dst);
+                break;
+            case Op::shl:
+                encode_shift(4, instr.dst, instr.src);
+                break;
+            case Op::shr:
+                encode_shift(5, instr.dst, instr.src);
+                break;
+            case Op::lea:
+                if (!instr.dst.is_reg() || !instr.src.is_mem())
+                {
+                    throw std::runtime_error("lea needs a register and a memory operand");
+                }
+                modrm_op(true, { 0x8D }, static_cast<uint8_t>(instr.dst.reg), instr.src);
+                break;
+            case Op::setcc:
+                // Without a REX prefix 4-7 would be ah, ch, dh and bh rather than spl..dil.
+                if (instr.dst.is_reg() && instr.dst.reg >= Reg::rsp && instr.dst.reg <= Reg::rdi)
+                {
+                    byte(0x40);
+                }
+                modrm_op(false, { 0x0F, static_cast<uint8_t>(0x90 + static_cast<uint8_t>(instr.cond)) }, 0, instr.dst);
+                break;
+            case Op::movzx:
+                modrm_op(true, { 0x0F, 0xB6 }, static_cast<uint8_t>(instr.dst.reg), instr.src);
+                break;
+            case Op::imul:
+                if (instr.src2.is_imm())
+                {
+                    bool short_imm = fits_imm8(instr.src2.imm);
+                    modrm_op(true, { static_cast<uint8_t>(short_imm ? 0x6B : 0x69) }, static_cast<uint8_t>(instr.dst.reg), instr.src);
+                    short_imm ? byte(static_cast<uint8_t>(instr.src2.imm)) : imm32(instr.src2.imm);
+                }
+                else
+                {
+                    modrm_op(true, { 0x0F, 0xAF }, static_cast<uint8_t>(instr.dst.reg), instr.src);
+                }
+                break;
+            case Op::jz:
+                if (long_jump)
+                {
+                    byte(0x0F);
+                    byte(0x84);
+                    fixup(instr.dst, 4);
+                }
+                else
+                {
+                    byte(0x74);
+                    fixup(instr.dst, 1);
+                }
+                break;
+            case Op::jcc:
+                if (long_jump)
+                {
+                    byte(0x0F);
+                    byte(0x80 + static_cast<uint8_t>(instr.cond));
+                    fixup(instr.dst, 4);
+                }
+                else
+                {
+                    byte(0x70 + static_cast<uint8_t>(instr.cond));
+                    fixup(instr.dst, 1);
+                }
+                break;
+            case Op::jmp:
+                if (long_jump)
+                {
+                    byte(0xE9);
+                    fixup(instr.dst, 4);
+                }
+                else
+                {
+                    byte(0xEB);
+                    fixup(instr.dst, 1);
+                }
+                break;
+            case Op::label:
+                break;
+            case Op::syscall:
+                byte(0x0F);
+                byte(0x05);
+                break;
+            case Op::ret:
+                byte(0xC3);
+                break;
+        }
+    }
+    
+    struct Fixup
+    {
+        size_t at;          // offset of the displacement field
+        uint8_t width;      // 1 or 4 bytes
+        uint32_t label;
+    };
+    
+    std::vector<uint8_t> bytes;
+    std::vector<Fixup> fixups;
+    
+private:
+    inline void byte(uint8_t value)
+    {
+        bytes.push_back(value);
+    }
+    
+    inline void imm32(uint64_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            byte(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    
+    inline void imm64(uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            byte(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    
+    inline void rex(bool w, uint8_t r, uint8_t x, uint8_t b)
+    {
+        uint8_t value = 0x40 | (w << 3) | (r << 2) | (x << 1) | b;
+        if (value != 0x40)
+        {
+            byte(value);
+        }
+    }
+    
+    // Emits [REX] opcode ModRM [SIB] [disp] for an r/m operand, with `reg`
+    // being either a register number or an opcode extension.
+    void modrm_op(bool w, std::initializer_list<uint8_t> opcode, uint8_t reg, const Operand& rm)
+    {
+        uint8_t base = rm.is_reg() || rm.is_mem() ? static_cast<uint8_t>(rm.reg) : 0;
+        bool indexed = rm.is_mem() && rm.scale != 0;
+        uint8_t index = indexed ? static_cast<uint8_t>(rm.index) : 0;
+        rex(w, reg >> 3, index >> 3, base >> 3);
+        for (uint8_t op : opcode)
+        {
+            byte(op);
+        }
+        if (rm.is_reg())
+        {
+            byte(0xC0 | ((reg & 7) << 3) | (base & 7));
+            return;
+        }
+        if (!rm.is_mem())
+        {
+            throw std::runtime_error("Expected a register or memory operand");
+        }
+        // rbp/r13 have no disp-less form, and rsp/r12 always need a SIB byte.
+        uint8_t mod;
+        if (rm.disp == 0 && (base & 7) != 5)
+            mod = 0;
+        else if (fits_imm8(static_cast<uint64_t>(static_cast<int64_t>(rm.disp))))
+            mod = 1;
+        else
+            mod = 2;
+        if (indexed)
+        {
+            // rm = 100 selects a SIB byte: scale, index, base.
+            static constexpr uint8_t scale_bits[] = { 0, 0, 1, 0, 2, 0, 0, 0, 3 };
+            byte((mod << 6) | ((reg & 7) << 3) | 4);
+            byte((scale_bits[rm.scale] << 6) | ((index & 7) << 3) | (base & 7));
+        }
+        else
+        {
+            byte((mod << 6) | ((reg & 7) << 3) | (base & 7));
+            if ((base & 7) == 4)
+            {
+                byte(0x24);
+            }
+        }
+        if (mod == 1)
+            byte(static_cast<uint8_t>(rm.disp));
+        else if (mod == 2)
+            imm32(static_cast<uint32_t>(rm.disp));
+    }
+    
+    void encode_mov(const Operand& dst, const Operand& src)
+    {
+        if (src.is_imm())
+        {
+            if (dst.is_reg() && src.imm <= UINT32_MAX)
+            {
+                // mov r32, imm32 zero-extends into the full register.
+                rex(false, 0, 0, reg_high(dst.reg));
+                byte(0xB8 + reg_low(dst.reg));
+                imm32(src.imm);
+                return;
+            }
+            if (dst.is_reg() && !fits_imm32(src.imm))
+            {
+                rex(true, 0, 0, reg_high(dst.reg));
+                byte(0xB8 + reg_low(dst.reg));
+                imm64(src.imm);
+                return;
+            }
+            if (!fits_imm32(src.imm))
+            {
+                throw std::runtime_error("64-bit immediate stored to memory");
+            }
+            modrm_op(true, { 0xC7 }, 0, dst);
+            imm32(src.imm);
+            return;
+        }
+        if (src.is_reg())
+        {
+            modrm_op(true, { 0x89 }, static_cast<uint8_t>(src.reg), dst);
+            return;
+        }
+        if (!dst.is_reg())
+        {
+            throw std::runtime_error("Memory to memory mov");
+        }
+        modrm_op(true, { 0x8B }, static_cast<uint8_t>(dst.reg), src);
+    }
+    
+    // The classic ALU group: op r/m, r | op r, r/m | 83/81 /ext with an immediate.
+    void encode_alu(uint8_t rm_reg, uint8_t reg_rm, uint8_t ext, const Operand& dst, const Operand& src)
+    {
+        if (src.is_imm())
+        {
+            if (!fits_imm32(src.imm))
+            {
+                throw std::runtime_error("Immediate does not fit in 32 bits");
+            }
+            bool short_imm = fits_imm8(src.imm);
+            modrm_op(true, { static_cast<uint8_t>(short_imm ? 0x83 : 0x81) }, ext, dst);
+            short_imm ? byte(static_cast<uint8_t>(src.imm)) : imm32(src.imm);
+        }
+        else if (src.is_reg())
+        {
+            modrm_op(true, { rm_reg }, static_cast<uint8_t>(src.reg), dst);
+        }
+        else
+        {
+            modrm_op(true, { reg_rm }, static_cast<uint8_t>(dst.reg), src);
+        }
+    }
+    
+    // C1 /ext ib shifts r/m by an immediate count, D1 /ext by exactly one.
+    void encode_shift(uint8_t ext, const Operand& dst, const Operand& count)
+    {
+        if (!count.is_imm() || count.imm > 63)
+        {
+            throw std::runtime_error("Shift count must be an immediate below 64");
+        }
+        if (count.imm == 1)
+        {
+            modrm_op(true, { 0xD1 }, ext, dst);
+            return;
+        }
+        modrm_op(true, { 0xC1 }, ext, dst);
+        byte(static_cast<uint8_t>(count.imm));
+    }
+    
+    void fixup(const Operand& target, uint8_t width)
+    {
+        fixups.push_back({ bytes.size(), width, static_cast<uint32_t>(target.imm) });
+        for (uint8_t i = 0; i < width; i++)
+        {
+            byte(0);
+        }
+    }
+};
+
+static inline bool is_jump(Op op)
+{
+    return op == Op::jz || op == Op::jcc || op == Op::jmp;
+}
+
+std::vector<uint8_t> encode_x86(const std::vector<Instr>& code)
+{
+    uint32_t label_count = 0;
+    for (const Instr& instr : code)
+    {
+        if (instr.op == Op::label)
+            label_count = std::max(label_count, static_cast<uint32_t>(instr.dst.imm) + 1);
+    }
+    
+    std::vector<bool> long_jump(code.size(), false);
+    std::vector<size_t> label_offsets(label_count, 0);
+    
+    while (true)
+    {
+        Encoder encoder;
+        std::vector<size_t> ends(code.size());
+        for (size_t i = 0; i < code.size(); i++)
+        {
+            if (code[i].op == Op::label)
+                label_offsets[code[i].dst.imm] = encoder.bytes.size();
+            encoder.encode(code[i], long_jump[i]);
+            ends[i] = encoder.bytes.size();
+        }
+        
+        // Widen any short jump whose target is out of reach and lay out again.
+        // Jumps only ever grow, so this terminates.
+        bool changed = false;
+        for (size_t i = 0; i < code.size(); i++)
+        {
+            if (!is_jump(code[i].op) || long_jump[i])
+                continue;
+            int64_t rel = static_cast<int64_t>(label_offsets[code[i].dst.imm]) - static_cast<int64_t>(ends[i]);
+            if (rel < INT8_MIN || rel > INT8_MAX)
+            {
+                long_jump[i] = true;
+                changed = true;
+            }
+        }
+        if (changed)
+            continue;
+        
+        for (const Encoder::Fixup& fixup : encoder.fixups)
+        {
+            int64_t rel = static_cast<int64_t>(label_offsets[fixup.label]) - static_cast<int64_t>(fixup.at + fixup.width);
+            for (uint8_t i = 0; i < fixup.width; i++)
+            {
+                encoder.bytes[fixup.at + i] = static_cast<uint8_t>(static_cast<uint64_t>(rel) >> (8 * i));
+            }
+        }
+        return std::move(encoder.bytes);
+    }
+}
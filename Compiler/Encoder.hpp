@@ -0,0 +1,18 @@
+//
+//  Encoder.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "X86.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Encodes the instruction list straight to x86-64 machine code. Jumps start
+// out in their 2-byte rel8 form and are widened to rel32 only when their
+// target is out of range, repeating until the layout settles.
+std::vector<uint8_t> encode_x86(const std::vector<Instr>& code);
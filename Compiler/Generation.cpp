@@ -6,266 +6,471 @@
 //
 
 #include "Generation.hpp"
+#include "IrBuilder.hpp"
+#include "IrLoops.hpp"
+#include "IrLowering.hpp"
+#include "Instrumentation.hpp"
 
-Generator::Generator(NodeProg prog)
-    : m_prog(std::move(prog)) {}
+Generator::Generator(NodeProg prog, int opt_level, ExitConvention exit)
+    : m_prog(std::move(prog)), m_opt_level(opt_level), m_exit(exit), m_vars(m_prog.symbol_count) {}
 
-void Generator::gen_term(const NodeTerm* term)
+// The condition codes of comparisons, all unsigned.
+static Cond cond_of(BinOp op)
 {
-    struct TermVisitor
+    switch (op)
     {
-        Generator& gen;
-        void operator()(const NodeTermIntLit* term_int_lit)
-        {
-            gen.m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-            gen.push("rax");
-        }
-        void operator()(const NodeTermIdent* term_ident)
+        case BinOp::eq: return Cond::e;
+        case BinOp::ne: return Cond::ne;
+        case BinOp::lt: return Cond::b;
+        case BinOp::le: return Cond::be;
+        case BinOp::gt: return Cond::a;
+        case BinOp::ge: return Cond::ae;
+        default:
+            throw std::runtime_error("Unreachable");
+    }
+}
+
+void Generator::gen_expr(NodeIndex root)
+{
+    m_tasks.push_back({ .kind = ExprTask::Kind::value, .node = root });
+    run_tasks();
+}
+
+void Generator::gen_cond_jump(NodeIndex cond, uint32_t label, bool jump_if)
+{
+    m_tasks.push_back({ .kind = ExprTask::Kind::branch, .node = cond, .label = label, .jump_if = jump_if });
+    run_tasks();
+}
+
+void Generator::run_tasks()
+{
+    while (!m_tasks.empty())
+    {
+        ExprTask task = m_tasks.back();
+        m_tasks.pop_back();
+        switch (task.kind)
         {
-            auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {return var.name == term_ident->ident.value.value();});
-            if (it == gen.m_vars.cend())
+            case ExprTask::Kind::value:
+                gen_value(task.node);
+                break;
+            case ExprTask::Kind::apply:
+                gen_bin_op(m_prog.expr(task.node).op);
+                break;
+            case ExprTask::Kind::branch:
+                gen_branch(task);
+                break;
+            case ExprTask::Kind::test:
+                pop(Reg::rax);
+                emit(Op::test, Operand::r(Reg::rax), Operand::r(Reg::rax));
+                if (task.jump_if)
+                    emit_cond(Op::jcc, Cond::ne, Operand::l(task.label));
+                else
+                    emit(Op::jz, Operand::l(task.label));
+                break;
+            case ExprTask::Kind::compare:
             {
-                std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << std::endl;
+                Cond cond = cond_of(m_prog.expr(task.node).op);
+                pop(Reg::rax);
+                pop(Reg::rbx);
+                emit(Op::cmp, Operand::r(Reg::rax), Operand::r(Reg::rbx));
+                emit_cond(Op::jcc, task.jump_if ? cond : invert(cond), Operand::l(task.label));
+                break;
+            }
+            case ExprTask::Kind::label:
+                emit(Op::label, Operand::l(task.label));
+                break;
+            case ExprTask::Kind::boolean:
+            {
+                uint32_t end_label = create_label();
+                emit(Op::mov, Operand::r(Reg::rax), Operand::i(1));
+                emit(Op::jmp, Operand::l(end_label));
+                emit(Op::label, Operand::l(task.label));
+                emit(Op::mov, Operand::r(Reg::rax), Operand::i(0));
+                emit(Op::label, Operand::l(end_label));
+                push(Operand::r(Reg::rax));
+                break;
             }
-            
-            std::stringstream offset;
-            offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-            gen.push(offset.str());
-        }
-        void operator()(const NodeTermParen* term_paren)
-        {
-            gen.gen_expr(term_paren->expr);
         }
-    };
-    
-    TermVisitor visitor { .gen = *this} ;
-    std::visit(visitor, term->var);
+    }
 }
 
-void Generator::gen_bin_expr(const NodeBinExpr* bin_expr)
+void Generator::gen_value(NodeIndex index)
 {
-    struct BinExprVisitor
+    const NodeExpr& expr = m_prog.expr(index);
+    switch (expr.kind)
     {
-        Generator& gen;
-        void operator()(const NodeBinExprAdd* add)
+        case NodeKind::term_int_lit:
+        {
+            emit(Op::mov, Operand::r(Reg::rax), Operand::i(expr.value));
+            push(Operand::r(Reg::rax));
+            break;
+        }
+        case NodeKind::term_ident:
         {
-            gen.gen_expr(add->rhs);
-            gen.gen_expr(add->lhs);
-            gen.pop("rax");
-            gen.pop("rbx");
-            gen.m_output << "    add rax, rbx\n";
-            gen.push("rax");
+            const Var& var = lookup_var(expr.name);
+            push(Operand::m(Reg::rsp, static_cast<int32_t>((m_stack_size - var.stack_loc - 1) * 8)));
+            break;
         }
-        void operator()(const NodeBinExprSub* minus)
+        case NodeKind::bin_expr:
+            if (is_logical(expr.op))
+            {
+                // Tasks run last-pushed first.
+                uint32_t false_label = create_label();
+                m_tasks.push_back({ .kind = ExprTask::Kind::boolean, .label = false_label });
+                m_tasks.push_back({ .kind = ExprTask::Kind::branch, .node = index, .label = false_label, .jump_if = false });
+                break;
+            }
+            // Right operand first, so the left one ends up on top and pops into rax.
+            m_tasks.push_back({ .kind = ExprTask::Kind::apply, .node = index });
+            m_tasks.push_back({ .kind = ExprTask::Kind::value, .node = expr.lhs });
+            m_tasks.push_back({ .kind = ExprTask::Kind::value, .node = expr.rhs });
+            break;
+        default:
+            throw std::runtime_error("Unreachable");
+    }
+}
+
+void Generator::gen_branch(const ExprTask& task)
+{
+    using Kind = ExprTask::Kind;
+    const NodeExpr& expr = m_prog.expr(task.node);
+    if (expr.kind == NodeKind::bin_expr && is_comparison(expr.op))
+    {
+        m_tasks.push_back({ .kind = Kind::compare, .node = task.node, .label = task.label, .jump_if = task.jump_if });
+        m_tasks.push_back({ .kind = Kind::value, .node = expr.lhs });
+        m_tasks.push_back({ .kind = Kind::value, .node = expr.rhs });
+        return;
+    }
+    if (expr.kind != NodeKind::bin_expr || !is_logical(expr.op))
+    {
+        m_tasks.push_back({ .kind = Kind::test, .label = task.label, .jump_if = task.jump_if });
+        m_tasks.push_back({ .kind = Kind::value, .node = task.node });
+        return;
+    }
+    // A false `a` settles a && b and a true one settles a || b. Jumping on that
+    // outcome is a jump on each operand; jumping on the other needs a label
+    // past `b` for when `a` alone settles it.
+    bool settles_on = expr.op == BinOp::log_or;
+    if (task.jump_if == settles_on)
+    {
+        m_tasks.push_back({ .kind = Kind::branch, .node = expr.rhs, .label = task.label, .jump_if = task.jump_if });
+        m_tasks.push_back({ .kind = Kind::branch, .node = expr.lhs, .label = task.label, .jump_if = task.jump_if });
+    }
+    else
+    {
+        uint32_t skip = create_label();
+        m_tasks.push_back({ .kind = Kind::label, .label = skip });
+        m_tasks.push_back({ .kind = Kind::branch, .node = expr.rhs, .label = task.label, .jump_if = task.jump_if });
+        m_tasks.push_back({ .kind = Kind::branch, .node = expr.lhs, .label = skip, .jump_if = settles_on });
+    }
+}
+
+void Generator::gen_bin_op(BinOp op)
+{
+    pop(Reg::rax);
+    pop(Reg::rbx);
+    switch (op)
+    {
+        case BinOp::add:
+            emit(Op::add, Operand::r(Reg::rax), Operand::r(Reg::rbx));
+            break;
+        case BinOp::sub:
+            emit(Op::sub, Operand::r(Reg::rax), Operand::r(Reg::rbx));
+            break;
+        case BinOp::mul:
+            emit(Op::mul, Operand::r(Reg::rbx));
+            break;
+        case BinOp::div:
+            // div takes rdx:rax, and rdx may hold the high half of an earlier mul.
+            emit(Op::xor_, Operand::r(Reg::rdx), Operand::r(Reg::rdx));
+            emit(Op::div, Operand::r(Reg::rbx));
+            break;
+        case BinOp::eq:
+        case BinOp::ne:
+        case BinOp::lt:
+        case BinOp::le:
+        case BinOp::gt:
+        case BinOp::ge:
+            emit(Op::cmp, Operand::r(Reg::rax), Operand::r(Reg::rbx));
+            emit_cond(Op::setcc, cond_of(op), Operand::r(Reg::rax));
+            emit(Op::movzx, Operand::r(Reg::rax), Operand::r(Reg::rax));
+            break;
+        case BinOp::log_and:
+        case BinOp::log_or:
+            throw std::runtime_error("Unreachable");
+    }
+    push(Operand::r(Reg::rax));
+}
+
+void Generator::gen_stmts()
+{
+    m_frames.push_back({ .stmts = m_prog.stmts });
+    while (true)
+    {
+        Frame& frame = m_frames.back();
+        if (frame.next < frame.stmts.size())
         {
-            gen.gen_expr(minus->rhs);
-            gen.gen_expr(minus->lhs);
-            gen.pop("rax");
-            gen.pop("rbx");
-            gen.m_output << "    sub rax, rbx\n";
-            gen.push("rax");
+            gen_stmt(frame.stmts[frame.next++]);
+            continue;
         }
-        void operator()(const NodeBinExprMulti* multi)
+        Frame done = frame;
+        m_frames.pop_back();
+        if (m_frames.empty())
         {
-            gen.gen_expr(multi->rhs);
-            gen.gen_expr(multi->lhs);
-            gen.pop("rax");
-            gen.pop("rbx");
-            gen.m_output << "    mul rbx\n";
-            gen.push("rax");
+            break;
         }
-        void operator()(const NodeBinExprDiv* fslash)
+        end_scope();
+        if (done.arm != no_node)
         {
-            gen.gen_expr(fslash->rhs);
-            gen.gen_expr(fslash->lhs);
-            gen.pop("rax");
-            gen.pop("rbx");
-            gen.m_output << "    div rbx\n";
-            gen.push("rax");
+            close_arm(done);
         }
-    };
-    
-    BinExprVisitor visitor { .gen = *this} ;
-    std::visit(visitor, bin_expr->var);
+    }
 }
 
-void Generator::gen_expr(const NodeExpr* expr)
+void Generator::open_scope(NodeIndex scope, NodeIndex arm, uint32_t label, uint32_t end_label)
 {
-    struct ExprVisitor
+    begin_scope();
+    m_frames.push_back({ .stmts = m_prog.scope_stmts(m_prog.stmt(scope)), .arm = arm, .label = label, .end_label = end_label });
+}
+
+void Generator::open_pred(NodeIndex index, uint32_t end_label)
+{
+    const NodeStmt& pred = m_prog.stmt(index);
+    switch (pred.kind)
     {
-        Generator& gen;
-        void operator()(const NodeTerm* term)
+        case NodeKind::if_pred_elif:
         {
-            gen.gen_term(term);
+            uint32_t label = create_label();
+            gen_cond_jump(pred.expr, label);
+            open_scope(pred.scope, index, label, end_label);
+            break;
         }
-        void operator()(const NodeBinExpr* bin_expr)
+        case NodeKind::if_pred_else:
+            open_scope(pred.scope, index, 0, end_label);
+            break;
+        default:
+            throw std::runtime_error("Unreachable");
+    }
+}
+
+// Runs once the body of an if, elif, else or while has been generated.
+void Generator::close_arm(const Frame& frame)
+{
+    const NodeStmt& arm = m_prog.stmt(frame.arm);
+    switch (arm.kind)
+    {
+        case NodeKind::stmt_if:
         {
-            gen.gen_bin_expr(bin_expr);
+            if (arm.pred == no_node)
+            {
+                emit(Op::label, Operand::l(frame.label));
+                break;
+            }
+            uint32_t end_label = create_label();
+            emit(Op::jmp, Operand::l(end_label));
+            emit(Op::label, Operand::l(frame.label));
+            open_pred(arm.pred, end_label);
+            break;
         }
-        
-    };
-    
-    ExprVisitor visitor { .gen = *this} ;
-    std::visit(visitor, expr->var);
+        case NodeKind::if_pred_elif:
+            emit(Op::jmp, Operand::l(frame.end_label));
+            emit(Op::label, Operand::l(frame.label));
+            if (arm.pred != no_node)
+            {
+                open_pred(arm.pred, frame.end_label);
+            }
+            else
+            {
+                emit(Op::label, Operand::l(frame.end_label));
+            }
+            break;
+        case NodeKind::if_pred_else:
+            emit(Op::label, Operand::l(frame.end_label));
+            break;
+        case NodeKind::stmt_while:
+            emit(Op::label, Operand::l(m_loops.back().cond_label));
+            gen_cond_jump(arm.expr, frame.label, true);
+            emit(Op::label, Operand::l(frame.end_label));
+            m_loops.pop_back();
+            break;
+        default:
+            throw std::runtime_error("Unreachable");
+    }
 }
 
-void Generator::gen_scope(const NodeScope* scope)
+// break and continue leave every scope opened inside the loop body, so their
+// variables are dropped before the jump.
+void Generator::jump_out(const Loop& loop, uint32_t label)
 {
-    begin_scope();
-    for (const NodeStmt* stmt : scope->stmts)
+    size_t pop_count = m_stack_size - loop.stack_size;
+    if (pop_count > 0)
     {
-        gen_stmt(stmt);
+        emit(Op::add, Operand::r(Reg::rsp), Operand::i(pop_count * 8));
     }
-    end_scope();
+    emit(Op::jmp, Operand::l(label));
 }
 
-void Generator::gen_if_pred(const NodeIfPred* pred, const std::string& end_label)
+void Generator::gen_stmt(NodeIndex index)
 {
-    struct PredVisitor
+    const NodeStmt& stmt = m_prog.stmt(index);
+    switch (stmt.kind)
     {
-        Generator& gen;
-        const std::string& end_label;
-        void operator()(const NodeIfPredElif* elif)
+        case NodeKind::stmt_exit:
         {
-            gen.gen_expr(elif->expr);
-            gen.pop("rax");
-            std::string label = gen.create_label();
-            gen.m_output << "    test rax, rax\n";
-            gen.m_output << "    jz " << label << "\n";
-            gen.gen_scope(elif->scope);
-            gen.m_output << "    jmp " << end_label << "\n";
-            if (elif->pred.has_value())
+            gen_expr(stmt.expr);
+            if (m_exit == ExitConvention::ret)
             {
-                gen.m_output << label << ":\n";
-                gen.gen_if_pred(elif->pred.value(), end_label);
+                pop(Reg::rax);
+                append_return(m_code, m_stack_size * 8);
+                break;
             }
+            emit(Op::mov, Operand::r(Reg::rax), Operand::i(60));
+            pop(Reg::rdi);
+            emit(Op::syscall);
+            break;
         }
-        
-        void operator()(const NodeIfPredElse* else_)
+        case NodeKind::stmt_let:
+        {
+            // The value pushed by the initializer becomes the variable's slot.
+            size_t stack_loc = m_stack_size;
+            gen_expr(stmt.expr);
+            m_vars.declare(stmt.name, { .stack_loc = stack_loc });
+            break;
+        }
+        case NodeKind::scope:
+            open_scope(index);
+            break;
+        case NodeKind::stmt_if:
+        {
+            uint32_t label = create_label();
+            gen_cond_jump(stmt.expr, label);
+            open_scope(stmt.scope, index, label);
+            break;
+        }
+        case NodeKind::stmt_while:
         {
-            gen.gen_scope(else_->scope);
+            uint32_t top = create_label();
+            uint32_t cond = create_label();
+            uint32_t end = create_label();
+            emit(Op::jmp, Operand::l(cond));
+            emit(Op::label, Operand::l(top));
+            m_loops.push_back({ .cond_label = cond, .end_label = end, .stack_size = m_stack_size });
+            open_scope(stmt.scope, index, top, end);
+            break;
         }
-    };
-    
-    PredVisitor visitor { .gen = *this, .end_label = end_label };
-    std::visit(visitor, pred->var);
+        case NodeKind::stmt_break:
+            jump_out(m_loops.back(), m_loops.back().end_label);
+            break;
+        case NodeKind::stmt_continue:
+            jump_out(m_loops.back(), m_loops.back().cond_label);
+            break;
+        case NodeKind::stmt_asign:
+        {
+            const Var& var = lookup_var(stmt.name);
+            gen_expr(stmt.expr);
+            pop(Reg::rax);
+            emit(Op::mov, Operand::m(Reg::rsp, static_cast<int32_t>((m_stack_size - var.stack_loc - 1) * 8)), Operand::r(Reg::rax));
+            break;
+        }
+        default:
+            throw std::runtime_error("Unreachable");
+    }
 }
 
-void Generator::gen_stmt(const NodeStmt* stmt)
+std::vector<Instr> Generator::gen_prog() //x86 linux
 {
-    struct StmtVisitor
+    if (m_opt_level >= 1)
     {
-        Generator& gen;
-        void operator()(const NodeStmtExit* stmt_exit)
+        IrFunc ir;
         {
-            gen.gen_expr(stmt_exit->expr);
-            gen.m_output  << "    mov rax, 60\n";
-            gen.pop("rdi");
-            gen.m_output << "    syscall\n";
+            PhaseScope phase("ir build");
+            ir = build_ir(m_prog);
+            count_stat("ir values", ir.values.size());
+            count_stat("ir blocks", ir.blocks.size());
         }
-        
-        void operator()(const NodeStmtLet* stmt_let)
         {
-            auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {return var.name == stmt_let->ident.value.value();});
-            if (it != gen.m_vars.cend())
-            {
-                std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << std::endl;
-            }
-            gen.m_vars.push_back( {.name = stmt_let->ident.value.value(),  .stack_loc = gen.m_stack_size } );
-            gen.gen_expr(stmt_let->expr);
-        }
-        
-        void operator()(const NodeScope* scope)
-        {
-            gen.gen_scope(scope);
+            PhaseScope phase("ir loops");
+            count_stat("loop optimizations", optimize_loops(ir));
         }
-        
-        void operator()(const NodeStmtIf* stmt_if)
         {
-            gen.gen_expr(stmt_if->expr);
-            gen.pop("rax");
-            std::string label = gen.create_label();
-            gen.m_output << "    test rax, rax\n";
-            gen.m_output << "    jz " << label << "\n";
-            gen.gen_scope(stmt_if->scope);
-            gen. m_output << "    jmp " << label << "\n";
-            if (stmt_if->pred.has_value())
-            {
-                std::string end_label = gen.create_label();
-                gen.m_output << "    jmp " << end_label << "\n";
-                gen.gen_if_pred(stmt_if->pred.value(), end_label);
-                gen.m_output << end_label << ": \n";
-            }
-            else
-            {
-                gen.m_output << label << ";\n";
-            }
+            PhaseScope phase("ir verify");
+            verify_ir(ir);
         }
-        void operator()(const NodeStmtAsign* stmt_asign)
+        VCode vcode;
         {
-            auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {return var.name == stmt_asign->ident.value.value();});
-            if (it == gen.m_vars.end())
-            {
-                std::cerr << "Undeclared identififer: " << stmt_asign->ident.value.value() << std::endl;
-            }
-            gen.gen_expr(stmt_asign->expr);
-            gen.pop("rax");
-            gen.m_output << "    mov [rsp" << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
+            PhaseScope phase("ir lower");
+            vcode = lower_ir(std::move(ir));
+            count_stat("vregs", vcode.vreg_count);
         }
-    };
-    
-    StmtVisitor visitor { .gen = *this };
-    std::visit(visitor, stmt->var);
+        PhaseScope phase("regalloc");
+        m_code = allocate_registers(vcode, m_exit);
+    }
+    else if (m_exit == ExitConvention::ret)
+    {
+        append_entry(m_code);
+        gen_stmts();
+        
+        emit(Op::mov, Operand::r(Reg::rax), Operand::i(0));
+        append_return(m_code, m_stack_size * 8);
+    }
+    else
+    {
+        gen_stmts();
+        
+        emit(Op::mov, Operand::r(Reg::rax), Operand::i(60));
+        emit(Op::mov, Operand::r(Reg::rdi), Operand::i(0));
+        emit(Op::syscall);
+    }
+    return std::move(m_code);
 }
 
-std::string Generator::gen_prog() //x86 linux
+void Generator::emit(Op op, Operand dst, Operand src)
 {
-    m_output << "global _start\n_start:\n";
-    
-    for (const NodeStmt* stmt : m_prog.stmts)
-    {
-        gen_stmt(stmt);
-    }
-    
-    m_output << "    mov rax, 60\n";
-    m_output << "    mov rdi, 0\n";
-    m_output << "    syscall";
-    return m_output.str();
-    
+    m_code.push_back({ op, dst, src });
 }
 
-void Generator::push(const std::string& reg)
+void Generator::emit_cond(Op op, Cond cond, Operand dst)
 {
-    m_output << "    push " << reg << "\n";
+    m_code.push_back({ .op = op, .dst = dst, .cond = cond });
+}
+
+void Generator::push(const Operand& operand)
+{
+    emit(Op::push, operand);
     m_stack_size++;
 }
 
-void Generator::pop(const std::string& reg)
+void Generator::pop(Reg reg)
 {
-    m_output << "    pop " << reg << "\n";
+    emit(Op::pop, Operand::r(reg));
     m_stack_size--;
 }
 
 void Generator::begin_scope()
 {
-    m_scopes.push_back(m_vars.size());
+    m_vars.enter_scope();
 }
 
 void Generator::end_scope()
 {
-    size_t pop_count = m_vars.size() - m_scopes.back();
-    m_output << "    add rsp, " << pop_count * 8 << "\n";
+    size_t pop_count = m_vars.scope_size();
+    emit(Op::add, Operand::r(Reg::rsp), Operand::i(pop_count * 8));
     m_stack_size -= pop_count;
-    for (int i = 0; i < pop_count; i++)
-    {
-        m_vars.pop_back();
-    }
-    m_scopes.pop_back();
+    m_vars.exit_scope();
+}
+
+uint32_t Generator::create_label()
+{
+    return m_label_count++;
 }
 
-std::string Generator::create_label()
+const Generator::Var& Generator::lookup_var(Symbol name)
 {
-    std::stringstream ss;
-    ss << "label" << m_label_count++;
-    return ss.str();
+    const Var* var = m_vars.find(name);
+    if (!var)
+    {
+        // check_semantics rejects these before code generation.
+        throw std::runtime_error("Unresolved identifier: " + std::string(m_prog.interner->name(name)));
+    }
+    return *var;
 }
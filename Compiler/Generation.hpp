@@ -6,41 +6,101 @@
 //
 
 #include "Parser.hpp"
+#include "SymbolTable.hpp"
+#include "X86.hpp"
 
 #pragma once
 
 class Generator
 {
 public:
-    Generator(NodeProg prog);
-    
-    void gen_bin_expr(const NodeBinExpr* bin_expr);
-    void gen_term(const NodeTerm* term);
-    void gen_expr(const NodeExpr* expr);
-    void gen_scope(const NodeScope* scope);
-    void gen_if_pred(const NodeIfPred* pred, const std::string& end_label);
-    void gen_stmt(const NodeStmt* stmt);
-    std::string gen_prog();
+    // opt_level 0 is the stack machine: every value goes through push/pop.
+    // opt_level 1 goes through the SSA IR and the register allocator.
+    // `exit` picks whether the program ends with a system call or a return.
+    Generator(NodeProg prog, int opt_level = 0, ExitConvention exit = ExitConvention::syscall);
+    
+    void gen_expr(NodeIndex expr);
+    std::vector<Instr> gen_prog();
 private:
+    void emit(Op op, Operand dst = {}, Operand src = {});
+    void emit_cond(Op op, Cond cond, Operand dst);
+    void push(const Operand& operand);
+    void pop(Reg reg);
+    
+    // Expressions are generated from an explicit stack of tasks rather than by
+    // recursion. && and || put control flow in the middle of an expression,
+    // and conditions jump straight on a comparison without making a value.
+    struct ExprTask
+    {
+        enum class Kind : uint8_t
+        {
+            value,      // push the value of `node`
+            apply,      // replace the top two values with `node`'s operator applied to them
+            branch,     // jump to `label` if `node` is true, or false when !jump_if
+            test,       // pop a value and jump to `label` if it is non-zero, or zero when !jump_if
+            compare,    // pop two values and jump to `label` if `node`'s comparison holds (or not)
+            label,      // define `label`
+            boolean     // push 1, or 0 when entered at `label`
+        };
+        Kind kind;
+        NodeIndex node = no_node;
+        uint32_t label = 0;
+        bool jump_if = false;
+    };
+    
+    void run_tasks();
+    void gen_value(NodeIndex expr);
+    void gen_branch(const ExprTask& task);
+    void gen_bin_op(BinOp op);
+    void gen_stmt(NodeIndex stmt);
+    void gen_cond_jump(NodeIndex cond, uint32_t label, bool jump_if = false);
+    
+    // Blocks are generated from an explicit stack of frames rather than by
+    // recursion, so nesting depth and elif chain length are bounded by memory.
+    struct Frame
+    {
+        std::span<const NodeIndex> stmts;
+        size_t next = 0;
+        NodeIndex arm = no_node;    // the if/elif/else/while this block is the body of
+        uint32_t label = 0;         // if, elif: where a false condition jumps to; while: top of the body
+        uint32_t end_label = 0;     // elif, else: end of the whole chain; while: past the loop
+    };
+    
+    // A while being generated. Its condition sits after the body, so each
+    // iteration ends in one conditional jump back to the top.
+    struct Loop
+    {
+        uint32_t cond_label;        // where `continue` goes
+        uint32_t end_label;         // where `break` goes
+        size_t stack_size;          // stack depth outside the body's scopes
+    };
     
-    void push(const std::string& reg);
-    void pop(const std::string& reg);
+    void gen_stmts();
+    void open_scope(NodeIndex scope, NodeIndex arm = no_node, uint32_t label = 0, uint32_t end_label = 0);
+    void open_pred(NodeIndex pred, uint32_t end_label);
+    void close_arm(const Frame& frame);
+    void jump_out(const Loop& loop, uint32_t label);
     
     void begin_scope();
     void end_scope();
     
-    std::string create_label();
+    uint32_t create_label();
     
     struct Var
     {
-        std::string name;
         size_t stack_loc;
     };
     
+    const Var& lookup_var(Symbol name);
+    
     const NodeProg m_prog;
-    std::stringstream m_output;
+    const int m_opt_level;
+    const ExitConvention m_exit;
+    std::vector<Instr> m_code;
     size_t m_stack_size = 0;
-    std::vector<Var> m_vars {};
-    std::vector<size_t> m_scopes {};
-    int m_label_count = 0;
+    ScopedTable<Var> m_vars;
+    uint32_t m_label_count = 0;
+    std::vector<Frame> m_frames;
+    std::vector<Loop> m_loops;
+    std::vector<ExprTask> m_tasks;
 };
@@ -0,0 +1,378 @@
+//
+//  Instrumentation.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Instrumentation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <sys/resource.h>
+#include <time.h>
+
+// ---- Allocation counting ----
+//
+// Replacing the global operator new lets every phase report how often it
+// allocated and how much, whatever container it went through. The counters
+// are plain thread-locals, so the cost is an increment per allocation.
+
+static thread_local uint64_t t_alloc_count = 0;
+static thread_local uint64_t t_alloc_bytes = 0;
+
+static void* counted_alloc(size_t size)
+{
+    t_alloc_count++;
+    t_alloc_bytes += size;
+    if (void* ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size)
+{
+    return counted_alloc(size);
+}
+
+void* operator new[](size_t size)
+{
+    return counted_alloc(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    t_alloc_count++;
+    t_alloc_bytes += size;
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// ---- Clocks ----
+
+static const std::chrono::steady_clock::time_point process_start = std::chrono::steady_clock::now();
+
+static uint64_t wall_now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - process_start).count());
+}
+
+static uint64_t thread_cpu_now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static uint64_t peak_rss()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);          // bytes
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;   // KiB
+#endif
+}
+
+// ---- Collection ----
+
+static thread_local CompileStats* t_stats = nullptr;
+static thread_local uint32_t t_depth = 0;
+
+void CompileStats::add_counter(const char* name, uint64_t value)
+{
+    for (auto& [counter, total] : counters)
+    {
+        if (std::string_view(counter) == name)
+        {
+            total += value;
+            return;
+        }
+    }
+    counters.emplace_back(name, value);
+}
+
+CollectStats::CollectStats(CompileStats& stats)
+    : m_previous(t_stats)
+{
+    t_stats = &stats;
+}
+
+CollectStats::~CollectStats()
+{
+    t_stats = m_previous;
+}
+
+PhaseScope::PhaseScope(const char* name)
+    : m_stats(t_stats)
+{
+    if (!m_stats)
+    {
+        return;
+    }
+    m_index = m_stats->phases.size();
+    m_stats->phases.push_back({ .name = name, .depth = t_depth++, .start_ns = 0 });
+    // Read last, so the bookkeeping above is not charged to the phase.
+    m_allocs_start = t_alloc_count;
+    m_bytes_start = t_alloc_bytes;
+    m_cpu_start = thread_cpu_now();
+    m_stats->phases[m_index].start_ns = wall_now();
+}
+
+PhaseScope::~PhaseScope()
+{
+    if (!m_stats)
+    {
+        return;
+    }
+    PhaseRecord& phase = m_stats->phases[m_index];
+    phase.wall_ns = wall_now() - phase.start_ns;
+    phase.cpu_ns = thread_cpu_now() - m_cpu_start;
+    phase.allocs = t_alloc_count - m_allocs_start;
+    phase.alloc_bytes = t_alloc_bytes - m_bytes_start;
+    phase.peak_rss = peak_rss();
+    t_depth--;
+}
+
+void count_stat(const char* name, uint64_t value)
+{
+    if (t_stats)
+    {
+        t_stats->add_counter(name, value);
+    }
+}
+
+// ---- Reports ----
+
+namespace {
+
+// One row of the summary: a phase name at a nesting depth, summed over files.
+struct PhaseTotal
+{
+    std::string_view name;
+    uint32_t depth;
+    uint64_t wall_ns = 0;
+    uint64_t cpu_ns = 0;
+    uint64_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+    uint64_t peak_rss = 0;
+};
+
+std::vector<PhaseTotal> sum_phases(const std::vector<CompileStats>& stats)
+{
+    std::vector<PhaseTotal> totals;
+    for (const CompileStats& file : stats)
+    {
+        for (const PhaseRecord& phase : file.phases)
+        {
+            PhaseTotal* total = nullptr;
+            for (PhaseTotal& existing : totals)
+            {
+                if (existing.name == phase.name && existing.depth == phase.depth)
+                {
+                    total = &existing;
+                    break;
+                }
+            }
+            if (!total)
+            {
+                totals.push_back({ .name = phase.name, .depth = phase.depth });
+                total = &totals.back();
+            }
+            total->wall_ns += phase.wall_ns;
+            total->cpu_ns += phase.cpu_ns;
+            total->allocs += phase.allocs;
+            total->alloc_bytes += phase.alloc_bytes;
+            total->peak_rss = std::max(total->peak_rss, phase.peak_rss);
+        }
+    }
+    return totals;
+}
+
+void append_ms(OutputBuffer& out, uint64_t ns)
+{
+    // Three decimals without going through floating-point formatting.
+    out.append_uint(ns / 1000000);
+    out.append('.');
+    uint64_t frac = ns / 1000 % 1000;
+    out.append(static_cast<char>('0' + frac / 100));
+    out.append(static_cast<char>('0' + frac / 10 % 10));
+    out.append(static_cast<char>('0' + frac % 10));
+}
+
+void append_json_string(OutputBuffer& out, std::string_view text)
+{
+    out.append('"');
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out.append('\\');
+            out.append(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            static constexpr char hex[] = "0123456789abcdef";
+            out.append("\\u00");
+            out.append(hex[c >> 4]);
+            out.append(hex[c & 15]);
+        }
+        else
+        {
+            out.append(c);
+        }
+    }
+    out.append('"');
+}
+
+}
+
+void print_time_report(const std::vector<CompileStats>& stats, std::ostream& out)
+{
+    std::vector<PhaseTotal> totals = sum_phases(stats);
+    uint64_t wall_total = 0;
+    uint64_t cpu_total = 0;
+    for (const PhaseTotal& total : totals)
+    {
+        if (total.depth == 0)
+        {
+            wall_total += total.wall_ns;
+            cpu_total += total.cpu_ns;
+        }
+    }
+    
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-22s %10s %10s %6s %10s %12s %12s\n", "Phase", "Wall ms", "CPU ms", "Wall%", "Allocs", "Alloc KiB", "Peak RSS KiB");
+    out << "Time report (" << stats.size() << (stats.size() == 1 ? " file)\n" : " files)\n") << line;
+    for (const PhaseTotal& total : totals)
+    {
+        std::string name = std::string(total.depth * 2, ' ') + std::string(total.name);
+        std::snprintf(line, sizeof(line), "%-22s %10.3f %10.3f %5.1f%% %10llu %12.1f %12llu\n",
+                      name.c_str(), total.wall_ns / 1e6, total.cpu_ns / 1e6,
+                      wall_total ? 100.0 * total.wall_ns / wall_total : 0.0,
+                      static_cast<unsigned long long>(total.allocs), total.alloc_bytes / 1024.0,
+                      static_cast<unsigned long long>(total.peak_rss / 1024));
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "%-22s %10.3f %10.3f\n", "Total", wall_total / 1e6, cpu_total / 1e6);
+    out << line;
+    
+    CompileStats merged;
+    for (const CompileStats& file : stats)
+    {
+        for (const auto& [name, value] : file.counters)
+        {
+            merged.add_counter(name, value);
+        }
+    }
+    for (const auto& [name, value] : merged.counters)
+    {
+        std::snprintf(line, sizeof(line), "  %-20s %12llu\n", name, static_cast<unsigned long long>(value));
+        out << line;
+    }
+}
+
+void write_stats_json(const std::vector<CompileStats>& stats, OutputBuffer& out)
+{
+    out.append("{\n  \"files\": [");
+    for (size_t f = 0; f < stats.size(); f++)
+    {
+        const CompileStats& file = stats[f];
+        out.append(f == 0 ? "\n    {\"input\": " : ",\n    {\"input\": ");
+        append_json_string(out, file.input);
+        out.append(", \"worker\": ");
+        out.append_uint(file.worker);
+        out.append(",\n     \"phases\": [");
+        for (size_t i = 0; i < file.phases.size(); i++)
+        {
+            const PhaseRecord& phase = file.phases[i];
+            out.append(i == 0 ? "\n      {\"name\": " : ",\n      {\"name\": ");
+            append_json_string(out, phase.name);
+            out.append(", \"depth\": ");
+            out.append_uint(phase.depth);
+            out.append(", \"start_ms\": ");
+            append_ms(out, phase.start_ns);
+            out.append(", \"wall_ms\": ");
+            append_ms(out, phase.wall_ns);
+            out.append(", \"cpu_ms\": ");
+            append_ms(out, phase.cpu_ns);
+            out.append(", \"allocs\": ");
+            out.append_uint(phase.allocs);
+            out.append(", \"alloc_bytes\": ");
+            out.append_uint(phase.alloc_bytes);
+            out.append(", \"peak_rss_bytes\": ");
+            out.append_uint(phase.peak_rss);
+            out.append('}');
+        }
+        out.append("],\n     \"counters\": {");
+        for (size_t i = 0; i < file.counters.size(); i++)
+        {
+            out.append(i == 0 ? "" : ", ");
+            append_json_string(out, file.counters[i].first);
+            out.append(": ");
+            out.append_uint(file.counters[i].second);
+        }
+        out.append("}}");
+    }
+    out.append("\n  ]\n}\n");
+}
+
+void write_chrome_trace(const std::vector<CompileStats>& stats, OutputBuffer& out)
+{
+    out.append("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool first = true;
+    for (const CompileStats& file : stats)
+    {
+        for (const PhaseRecord& phase : file.phases)
+        {
+            // Complete ("X") events; timestamps are in microseconds.
+            out.append(first ? "\n" : ",\n");
+            first = false;
+            out.append("{\"name\": ");
+            append_json_string(out, phase.name);
+            out.append(", \"cat\": \"compile\", \"ph\": \"X\", \"pid\": 1, \"tid\": ");
+            out.append_uint(file.worker);
+            out.append(", \"ts\": ");
+            out.append_uint(phase.start_ns / 1000);
+            out.append(", \"dur\": ");
+            out.append_uint(std::max<uint64_t>(phase.wall_ns / 1000, 1));
+            out.append(", \"args\": {\"file\": ");
+            append_json_string(out, file.input);
+            out.append(", \"allocs\": ");
+            out.append_uint(phase.allocs);
+            out.append("}}");
+        }
+    }
+    out.append("\n]}\n");
+}
@@ -0,0 +1,88 @@
+//
+//  Instrumentation.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Output.hpp"
+
+// Per-phase measurements for -ftime-report, --stats-json and --trace.
+//
+// A CollectStats on the stack routes every PhaseScope and count_stat() on the
+// same thread into one CompileStats; with none installed they cost a single
+// thread-local load. Allocation counts come from the global operator new, so
+// they cover every container in the compiler, not just one arena.
+
+struct PhaseRecord
+{
+    const char* name;
+    uint32_t depth;             // nesting level, 0 for top-level phases
+    uint64_t start_ns;          // since the process started
+    uint64_t wall_ns = 0;
+    uint64_t cpu_ns = 0;        // this thread only
+    uint64_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+    uint64_t peak_rss = 0;      // bytes, whole process, at the end of the phase
+};
+
+struct CompileStats
+{
+    std::string input;
+    unsigned worker = 0;        // which pool thread ran the compile
+    std::vector<PhaseRecord> phases;    // in start order
+    std::vector<std::pair<const char*, uint64_t>> counters;
+    
+    void add_counter(const char* name, uint64_t value);
+};
+
+class CollectStats
+{
+public:
+    CollectStats(CompileStats& stats);
+    ~CollectStats();
+    
+    inline CollectStats(const CollectStats& other) = delete;
+    inline CollectStats operator = (const CollectStats& other) = delete;
+    
+private:
+    CompileStats* m_previous;
+};
+
+// Times the enclosing block as one phase, nested inside any phase already open.
+class PhaseScope
+{
+public:
+    PhaseScope(const char* name);
+    ~PhaseScope();
+    
+    inline PhaseScope(const PhaseScope& other) = delete;
+    inline PhaseScope operator = (const PhaseScope& other) = delete;
+    
+private:
+    CompileStats* m_stats;
+    size_t m_index = 0;
+    uint64_t m_cpu_start = 0;
+    uint64_t m_allocs_start = 0;
+    uint64_t m_bytes_start = 0;
+};
+
+// Adds to a named counter (tokens, instructions, ...) of the current compile.
+void count_stat(const char* name, uint64_t value);
+
+// -ftime-report: phases and counters summed over all files.
+void print_time_report(const std::vector<CompileStats>& stats, std::ostream& out);
+
+// Every file's phases and counters as one JSON document.
+void write_stats_json(const std::vector<CompileStats>& stats, OutputBuffer& out);
+
+// Chrome trace-event format (chrome://tracing, Perfetto), one track per worker thread.
+void write_chrome_trace(const std::vector<CompileStats>& stats, OutputBuffer& out);
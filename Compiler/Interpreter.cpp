@@ -0,0 +1,127 @@
+//
+//  Interpreter.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Interpreter.hpp"
+#include "Diagnostics.hpp"
+
+#include <iterator>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INTERPRETER_THREADED 1
+#endif
+
+Interpreter::Interpreter(const Bytecode& program)
+    : m_constants(program.constants), m_register_count(program.register_count)
+{
+    const void* const* handlers = nullptr;
+    execute(nullptr, nullptr, nullptr, &handlers);
+    m_code.reserve(program.code.size());
+    for (const BcInstr& instr : program.code)
+    {
+        const void* handler = handlers ? handlers[static_cast<size_t>(instr.op)] : nullptr;
+        m_code.push_back({ handler, instr.op, instr.a, instr.b, instr.c });
+    }
+}
+
+uint64_t Interpreter::run() const
+{
+    std::vector<uint64_t> regs(m_register_count);
+    return execute(m_code.data(), regs.data(), m_constants.data(), nullptr);
+}
+
+[[noreturn]] static void division_by_zero()
+{
+    throw CompileError("[Runtime error] Division by zero");
+}
+
+uint64_t Interpreter::execute(const Threaded* code, uint64_t* r, const uint64_t* k, const void* const** handlers)
+{
+#ifdef INTERPRETER_THREADED
+    // In BcOp order.
+    static const void* const table[] = {
+        &&op_loadk, &&op_mov,
+        &&op_add, &&op_sub, &&op_mul, &&op_div,
+        &&op_add_k, &&op_sub_k, &&op_mul_k, &&op_div_k,
+        &&op_eq, &&op_ne, &&op_lt, &&op_le, &&op_gt, &&op_ge,
+        &&op_jmp, &&op_jz, &&op_jnz,
+        &&op_jeq, &&op_jne, &&op_jlt, &&op_jle, &&op_jgt, &&op_jge,
+        &&op_jeq_k, &&op_jne_k, &&op_jlt_k, &&op_jle_k, &&op_jgt_k, &&op_jge_k,
+        &&op_exit
+    };
+    static_assert(std::size(table) == bc_op_count);
+    if (handlers)
+    {
+        *handlers = table;
+        return 0;
+    }
+#define CASE(name) op_##name:
+#define NEXT() goto *pc->handler
+#else
+    if (handlers)
+    {
+        *handlers = nullptr;
+        return 0;
+    }
+#define CASE(name) case BcOp::name:
+#define NEXT() continue
+#endif
+
+// Every handler ends by moving pc and going on to the next one.
+#define BINARY(name, expr) CASE(name) { uint64_t lhs = r[pc->b]; uint64_t rhs = r[pc->c]; r[pc->a] = (expr); pc++; NEXT(); }
+#define BINARY_K(name, expr) CASE(name) { uint64_t lhs = r[pc->b]; uint64_t rhs = k[pc->c]; r[pc->a] = (expr); pc++; NEXT(); }
+#define BRANCH(name, cond) CASE(name) { uint64_t lhs = r[pc->a]; uint64_t rhs = r[pc->b]; pc = (cond) ? code + pc->c : pc + 1; NEXT(); }
+#define BRANCH_K(name, cond) CASE(name) { uint64_t lhs = r[pc->a]; uint64_t rhs = k[pc->b]; pc = (cond) ? code + pc->c : pc + 1; NEXT(); }
+
+    const Threaded* pc = code;
+#ifdef INTERPRETER_THREADED
+    NEXT();
+#else
+    for (;;) switch (pc->op) {
+#endif
+    CASE(loadk) { r[pc->a] = k[pc->b]; pc++; NEXT(); }
+    CASE(mov) { r[pc->a] = r[pc->b]; pc++; NEXT(); }
+    BINARY(add, lhs + rhs)
+    BINARY(sub, lhs - rhs)
+    BINARY(mul, lhs * rhs)
+    BINARY(div, rhs ? lhs / rhs : (division_by_zero(), 0))
+    BINARY_K(add_k, lhs + rhs)
+    BINARY_K(sub_k, lhs - rhs)
+    BINARY_K(mul_k, lhs * rhs)
+    BINARY_K(div_k, rhs ? lhs / rhs : (division_by_zero(), 0))
+    BINARY(eq, lhs == rhs)
+    BINARY(ne, lhs != rhs)
+    BINARY(lt, lhs < rhs)
+    BINARY(le, lhs <= rhs)
+    BINARY(gt, lhs > rhs)
+    BINARY(ge, lhs >= rhs)
+    CASE(jmp) { pc = code + pc->c; NEXT(); }
+    CASE(jz) { pc = r[pc->a] == 0 ? code + pc->c : pc + 1; NEXT(); }
+    CASE(jnz) { pc = r[pc->a] != 0 ? code + pc->c : pc + 1; NEXT(); }
+    BRANCH(jeq, lhs == rhs)
+    BRANCH(jne, lhs != rhs)
+    BRANCH(jlt, lhs < rhs)
+    BRANCH(jle, lhs <= rhs)
+    BRANCH(jgt, lhs > rhs)
+    BRANCH(jge, lhs >= rhs)
+    BRANCH_K(jeq_k, lhs == rhs)
+    BRANCH_K(jne_k, lhs != rhs)
+    BRANCH_K(jlt_k, lhs < rhs)
+    BRANCH_K(jle_k, lhs <= rhs)
+    BRANCH_K(jgt_k, lhs > rhs)
+    BRANCH_K(jge_k, lhs >= rhs)
+    CASE(exit) { return r[pc->a]; }
+#ifndef INTERPRETER_THREADED
+    }
+#endif
+
+#undef BRANCH_K
+#undef BRANCH
+#undef BINARY_K
+#undef BINARY
+#undef NEXT
+#undef CASE
+}
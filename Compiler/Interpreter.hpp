@@ -0,0 +1,48 @@
+//
+//  Interpreter.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Bytecode.hpp"
+
+// Runs Bytecode without generating native code. With GCC or Clang the code is
+// direct-threaded: each instruction carries the address of its handler, and
+// every handler ends in its own computed goto to the next one, so there is no
+// central dispatch branch for the predictor to share. Other compilers get a
+// switch over the same handlers.
+class Interpreter
+{
+public:
+    // Threads the code once; run() may then be called any number of times.
+    Interpreter(const Bytecode& program);
+    
+    // Runs the program from the start with every register zero and returns
+    // what it passed to exit() (0 if it reached the end). Division by zero
+    // throws a CompileError, as --run reports it.
+    uint64_t run() const;
+    
+private:
+    struct Threaded
+    {
+        const void* handler;    // null without computed goto
+        BcOp op;
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+    };
+    
+    // The interpreter loop. With `handlers` set it only stores the handler
+    // table there: label addresses cannot leave the function any other way.
+    static uint64_t execute(const Threaded* code, uint64_t* regs, const uint64_t* constants, const void* const** handlers);
+    
+    std::vector<Threaded> m_code;
+    std::vector<uint64_t> m_constants;
+    uint32_t m_register_count;
+};
@@ -0,0 +1,477 @@
+//
+//  Ir.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Ir.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+std::vector<IrBlockId> ir_successors(const IrBlock& block)
+{
+    switch (block.term.kind)
+    {
+        case IrTermKind::jmp:
+            return { block.term.target };
+        case IrTermKind::br:
+            return { block.term.target, block.term.other };
+        case IrTermKind::none:
+        case IrTermKind::exit:
+            break;
+    }
+    return {};
+}
+
+std::vector<IrBlockId> ir_reverse_postorder(const IrFunc& func)
+{
+    std::vector<IrBlockId> order;
+    std::vector<bool> visited(func.blocks.size(), false);
+    // (block, successors still to visit), walked iteratively so deep nesting cannot overflow.
+    std::vector<std::pair<IrBlockId, std::vector<IrBlockId>>> stack;
+    
+    auto visit = [&](IrBlockId block) {
+        visited[block] = true;
+        // Visited last-to-first, so the first successor ends up placed right after the block.
+        std::vector<IrBlockId> succs = ir_successors(func.blocks[block]);
+        stack.emplace_back(block, std::move(succs));
+    };
+    
+    if (!func.blocks.empty())
+    {
+        visit(0);
+    }
+    while (!stack.empty())
+    {
+        auto& [block, succs] = stack.back();
+        if (succs.empty())
+        {
+            order.push_back(block);
+            stack.pop_back();
+            continue;
+        }
+        IrBlockId next = succs.back();
+        succs.pop_back();
+        if (!visited[next])
+        {
+            visit(next);
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+DomTree::DomTree(const IrFunc& func)
+    : m_rpo(ir_reverse_postorder(func))
+{
+    size_t count = func.blocks.size();
+    if (m_rpo.size() != count)
+    {
+        throw std::runtime_error("Dominators of a function with unreachable blocks");
+    }
+    m_rpo_index.assign(count, 0);
+    for (uint32_t i = 0; i < m_rpo.size(); i++)
+    {
+        m_rpo_index[m_rpo[i]] = i;
+    }
+    // Intersecting the latest predecessors first keeps the walks short when
+    // a join has many (an elif chain): the finger climbs one arm at a time
+    // instead of every arm being walked up from the bottom of the chain.
+    std::vector<std::vector<IrBlockId>> preds(count);
+    for (IrBlockId b = 0; b < count; b++)
+    {
+        preds[b] = func.blocks[b].preds;
+        std::sort(preds[b].begin(), preds[b].end(), [&](IrBlockId x, IrBlockId y) { return m_rpo_index[x] > m_rpo_index[y]; });
+    }
+    m_idom.assign(count, no_block);
+    m_idom[0] = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 1; i < m_rpo.size(); i++)
+        {
+            IrBlockId b = m_rpo[i];
+            IrBlockId idom = no_block;
+            for (IrBlockId pred : preds[b])
+            {
+                if (m_idom[pred] == no_block)
+                {
+                    continue;
+                }
+                idom = idom == no_block ? pred : intersect(pred, idom);
+            }
+            if (idom != m_idom[b])
+            {
+                m_idom[b] = idom;
+                changed = true;
+            }
+        }
+    }
+    number_tree();
+}
+
+IrBlockId DomTree::intersect(IrBlockId a, IrBlockId b) const
+{
+    while (a != b)
+    {
+        while (m_rpo_index[a] > m_rpo_index[b])
+        {
+            a = m_idom[a];
+        }
+        while (m_rpo_index[b] > m_rpo_index[a])
+        {
+            b = m_idom[b];
+        }
+    }
+    return a;
+}
+
+// With an explicit stack, so a deep tree cannot overflow the call stack.
+void DomTree::number_tree()
+{
+    size_t count = m_idom.size();
+    std::vector<uint32_t> child_start(count + 1, 0);
+    for (IrBlockId b = 1; b < count; b++)
+    {
+        child_start[m_idom[b] + 1]++;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        child_start[i + 1] += child_start[i];
+    }
+    std::vector<IrBlockId> children(count > 0 ? count - 1 : 0);
+    std::vector<uint32_t> fill(child_start.begin(), child_start.end() - 1);
+    for (IrBlockId b = 1; b < count; b++)
+    {
+        children[fill[m_idom[b]]++] = b;
+    }
+    
+    m_pre.assign(count, 0);
+    m_post.assign(count, 0);
+    uint32_t pre = 0;
+    uint32_t post = 0;
+    std::vector<std::pair<IrBlockId, uint32_t>> stack { { 0, child_start[0] } };
+    m_pre[0] = pre++;
+    while (!stack.empty())
+    {
+        auto& [block, next] = stack.back();
+        if (next < child_start[block + 1])
+        {
+            IrBlockId child = children[next++];
+            m_pre[child] = pre++;
+            stack.push_back({ child, child_start[child] });
+            continue;
+        }
+        m_post[block] = post++;
+        stack.pop_back();
+    }
+}
+
+static const char* op_name(IrOp op)
+{
+    switch (op)
+    {
+        case IrOp::const_: return "const";
+        case IrOp::add: return "add";
+        case IrOp::sub: return "sub";
+        case IrOp::mul: return "mul";
+        case IrOp::div: return "div";
+        case IrOp::eq: return "eq";
+        case IrOp::ne: return "ne";
+        case IrOp::lt: return "lt";
+        case IrOp::le: return "le";
+        case IrOp::gt: return "gt";
+        case IrOp::ge: return "ge";
+        case IrOp::phi: return "phi";
+    }
+    return "?";
+}
+
+static void print_value(OutputBuffer& out, IrValue value)
+{
+    out.append('v');
+    out.append_uint(value);
+}
+
+static void print_block(OutputBuffer& out, IrBlockId block)
+{
+    out.append('b');
+    out.append_uint(block);
+}
+
+void dump_ir(const IrFunc& func, OutputBuffer& out)
+{
+    for (IrBlockId b = 0; b < func.blocks.size(); b++)
+    {
+        const IrBlock& block = func.blocks[b];
+        print_block(out, b);
+        out.append(':');
+        if (!block.preds.empty())
+        {
+            out.append("    ; preds ");
+            for (size_t i = 0; i < block.preds.size(); i++)
+            {
+                if (i > 0)
+                {
+                    out.append(", ");
+                }
+                print_block(out, block.preds[i]);
+            }
+        }
+        out.append('\n');
+        
+        for (IrValue phi : block.phis)
+        {
+            out.append("    ");
+            print_value(out, phi);
+            out.append(" = phi");
+            std::span<const IrValue> args = func.phi_operands(func.value(phi));
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                out.append(i == 0 ? " [" : ", [");
+                print_block(out, i < block.preds.size() ? block.preds[i] : no_block);
+                out.append(' ');
+                print_value(out, args[i]);
+                out.append(']');
+            }
+            out.append('\n');
+        }
+        for (IrValue value : block.instrs)
+        {
+            const IrInstr& instr = func.value(value);
+            out.append("    ");
+            print_value(out, value);
+            out.append(" = ");
+            out.append(op_name(instr.op));
+            out.append(' ');
+            if (instr.op == IrOp::const_)
+            {
+                out.append_uint(instr.imm);
+            }
+            else
+            {
+                print_value(out, instr.lhs);
+                out.append(", ");
+                print_value(out, instr.rhs);
+            }
+            out.append('\n');
+        }
+        
+        const IrTerm& term = block.term;
+        switch (term.kind)
+        {
+            case IrTermKind::none:
+                out.append("    <no terminator>\n");
+                break;
+            case IrTermKind::jmp:
+                out.append("    jmp ");
+                print_block(out, term.target);
+                out.append('\n');
+                break;
+            case IrTermKind::br:
+                out.append("    br ");
+                print_value(out, term.value);
+                out.append(", ");
+                print_block(out, term.target);
+                out.append(", ");
+                print_block(out, term.other);
+                out.append('\n');
+                break;
+            case IrTermKind::exit:
+                out.append("    exit ");
+                print_value(out, term.value);
+                out.append('\n');
+                break;
+        }
+    }
+}
+
+namespace {
+
+class Verifier
+{
+public:
+    Verifier(const IrFunc& func)
+        : m_func(func) {}
+    
+    void verify()
+    {
+        if (m_func.blocks.empty())
+        {
+            fail("function has no blocks");
+        }
+        if (!m_func.blocks[0].preds.empty())
+        {
+            fail("entry block has predecessors");
+        }
+        check_edges();
+        check_placement();
+        if (ir_reverse_postorder(m_func).size() != m_func.blocks.size())
+        {
+            fail("function has unreachable blocks");
+        }
+        m_dom.emplace(m_func);
+        for (IrBlockId b = 0; b < m_func.blocks.size(); b++)
+        {
+            check_uses(b);
+        }
+    }
+    
+private:
+    [[noreturn]] void fail(const std::string& msg)
+    {
+        throw std::runtime_error("[IR error] " + msg);
+    }
+    
+    static std::string block_name(IrBlockId block)
+    {
+        return "b" + std::to_string(block);
+    }
+    
+    static std::string value_name(IrValue value)
+    {
+        return "v" + std::to_string(value);
+    }
+    
+    // Every terminator is complete and every block's predecessor list matches its incoming edges.
+    void check_edges()
+    {
+        size_t count = m_func.blocks.size();
+        std::vector<std::vector<IrBlockId>> incoming(count);
+        for (IrBlockId b = 0; b < count; b++)
+        {
+            const IrTerm& term = m_func.blocks[b].term;
+            if (term.kind == IrTermKind::none)
+            {
+                fail(block_name(b) + " has no terminator");
+            }
+            if ((term.kind == IrTermKind::br || term.kind == IrTermKind::exit) && term.value >= m_func.values.size())
+            {
+                fail(block_name(b) + " terminator uses an undefined value");
+            }
+            for (IrBlockId succ : ir_successors(m_func.blocks[b]))
+            {
+                if (succ >= count)
+                {
+                    fail(block_name(b) + " branches to a missing block");
+                }
+                if (succ == 0)
+                {
+                    fail(block_name(b) + " branches to the entry block");
+                }
+                incoming[succ].push_back(b);
+            }
+        }
+        for (IrBlockId b = 0; b < count; b++)
+        {
+            std::vector<IrBlockId> preds = m_func.blocks[b].preds;
+            std::sort(preds.begin(), preds.end());
+            std::sort(incoming[b].begin(), incoming[b].end());
+            if (preds != incoming[b])
+            {
+                fail(block_name(b) + " predecessor list does not match its incoming edges");
+            }
+        }
+    }
+    
+    // Every value is defined once, in the block that claims it, with phis first.
+    void check_placement()
+    {
+        m_def_block.assign(m_func.values.size(), no_block);
+        m_def_pos.assign(m_func.values.size(), 0);
+        for (IrBlockId b = 0; b < m_func.blocks.size(); b++)
+        {
+            const IrBlock& block = m_func.blocks[b];
+            uint32_t pos = 0;
+            auto place = [&](IrValue value, bool phi) {
+                if (value >= m_func.values.size())
+                {
+                    fail(block_name(b) + " lists a missing value");
+                }
+                const IrInstr& instr = m_func.value(value);
+                if ((instr.op == IrOp::phi) != phi)
+                {
+                    fail(value_name(value) + (phi ? " is not a phi but is listed with them" : " is a phi listed after ordinary instructions"));
+                }
+                if (instr.block != b || m_def_block[value] != no_block)
+                {
+                    fail(value_name(value) + " is defined more than once or in the wrong block");
+                }
+                m_def_block[value] = b;
+                m_def_pos[value] = pos++;
+            };
+            for (IrValue phi : block.phis)
+            {
+                place(phi, true);
+                const IrInstr& instr = m_func.value(phi);
+                if (instr.rhs != block.preds.size() || instr.lhs + instr.rhs > m_func.phi_args.size())
+                {
+                    fail(value_name(phi) + " does not have one operand per predecessor");
+                }
+            }
+            for (IrValue value : block.instrs)
+            {
+                place(value, false);
+            }
+        }
+    }
+    
+    // `value` must be available at position `pos` of `block`; pos == UINT32_MAX means its end.
+    void check_available(IrValue value, IrBlockId block, uint32_t pos, IrValue user)
+    {
+        auto who = [&] { return user == no_value ? "terminator of " + block_name(block) : value_name(user); };
+        if (value >= m_func.values.size() || m_def_block[value] == no_block)
+        {
+            fail(who() + " uses undefined value " + value_name(value));
+        }
+        IrBlockId def = m_def_block[value];
+        if (def == block ? m_def_pos[value] >= pos : !m_dom->dominates(def, block))
+        {
+            fail(who() + " uses " + value_name(value) + ", which does not dominate it");
+        }
+    }
+    
+    void check_uses(IrBlockId b)
+    {
+        const IrBlock& block = m_func.blocks[b];
+        for (IrValue phi : block.phis)
+        {
+            std::span<const IrValue> args = m_func.phi_operands(m_func.value(phi));
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                check_available(args[i], block.preds[i], UINT32_MAX, phi);
+            }
+        }
+        for (IrValue value : block.instrs)
+        {
+            const IrInstr& instr = m_func.value(value);
+            if (instr.op != IrOp::const_)
+            {
+                check_available(instr.lhs, b, m_def_pos[value], value);
+                check_available(instr.rhs, b, m_def_pos[value], value);
+            }
+        }
+        if (block.term.kind == IrTermKind::br || block.term.kind == IrTermKind::exit)
+        {
+            check_available(block.term.value, b, UINT32_MAX, no_value);
+        }
+    }
+    
+    const IrFunc& m_func;
+    std::vector<IrBlockId> m_def_block;
+    std::vector<uint32_t> m_def_pos;
+    std::optional<DomTree> m_dom;
+};
+
+}
+
+void verify_ir(const IrFunc& func)
+{
+    Verifier(func).verify();
+}
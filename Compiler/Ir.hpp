@@ -0,0 +1,135 @@
+//
+//  Ir.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Output.hpp"
+
+// SSA intermediate representation. A program is a graph of basic blocks; each
+// value is defined by exactly one instruction and named by that instruction's
+// index in IrFunc::values. Joins merge values with phi instructions, whose
+// operands line up one-to-one with the block's predecessors.
+
+using IrValue = uint32_t;
+using IrBlockId = uint32_t;
+
+static constexpr uint32_t no_value = UINT32_MAX;
+static constexpr uint32_t no_block = UINT32_MAX;
+
+enum class IrOp : uint8_t
+{
+    const_,     // imm
+    add,        // lhs + rhs, all arithmetic is on unsigned 64-bit values
+    sub,
+    mul,
+    div,
+    eq,         // lhs == rhs: 1 or 0
+    ne,
+    lt,         // unsigned, like all comparisons
+    le,
+    gt,
+    ge,
+    phi         // one operand per predecessor, stored in IrFunc::phi_args
+};
+
+inline bool is_comparison(IrOp op)
+{
+    return op >= IrOp::eq && op <= IrOp::ge;
+}
+
+struct IrInstr
+{
+    IrOp op;
+    IrBlockId block;
+    IrValue lhs = no_value;     // binary ops; phi: first index into IrFunc::phi_args
+    IrValue rhs = no_value;     // binary ops; phi: operand count
+    uint64_t imm = 0;           // const_
+};
+
+enum class IrTermKind : uint8_t
+{
+    none,   // block still being built
+    jmp,    // goto target
+    br,     // if value != 0 goto target else goto other
+    exit    // exit with status value
+};
+
+struct IrTerm
+{
+    IrTermKind kind = IrTermKind::none;
+    IrValue value = no_value;
+    IrBlockId target = no_block;
+    IrBlockId other = no_block;
+};
+
+struct IrBlock
+{
+    std::vector<IrValue> phis;      // always first, conceptually executed in parallel
+    std::vector<IrValue> instrs;
+    std::vector<IrBlockId> preds;
+    IrTerm term;
+};
+
+struct IrFunc
+{
+    std::vector<IrInstr> values;
+    std::vector<IrValue> phi_args;
+    std::vector<IrBlock> blocks;    // block 0 is the entry
+    
+    inline const IrInstr& value(IrValue index) const { return values[index]; }
+    
+    inline std::span<const IrValue> phi_operands(const IrInstr& phi) const
+    {
+        return { phi_args.data() + phi.lhs, phi.rhs };
+    }
+};
+
+// Successors of a block in branch order: target first, then other.
+std::vector<IrBlockId> ir_successors(const IrBlock& block);
+
+// Blocks reachable from the entry in reverse postorder. For a br, the target
+// side follows its block directly, so it can be laid out as the fall-through.
+std::vector<IrBlockId> ir_reverse_postorder(const IrFunc& func);
+
+// Dominator tree of a function whose blocks are all reachable, by Cooper,
+// Harvey and Kennedy's iterative algorithm. The tree is numbered in pre- and
+// post-order, so dominates() is two comparisons rather than a walk up it.
+class DomTree
+{
+public:
+    DomTree(const IrFunc& func);
+    
+    inline bool dominates(IrBlockId a, IrBlockId b) const
+    {
+        return m_pre[a] <= m_pre[b] && m_post[b] <= m_post[a];
+    }
+    
+    inline IrBlockId idom(IrBlockId block) const { return m_idom[block]; }
+    inline const std::vector<IrBlockId>& reverse_postorder() const { return m_rpo; }
+    inline uint32_t rpo_index(IrBlockId block) const { return m_rpo_index[block]; }
+    
+private:
+    IrBlockId intersect(IrBlockId a, IrBlockId b) const;
+    void number_tree();
+    
+    std::vector<IrBlockId> m_rpo;
+    std::vector<uint32_t> m_rpo_index;
+    std::vector<IrBlockId> m_idom;
+    std::vector<uint32_t> m_pre;
+    std::vector<uint32_t> m_post;
+};
+
+// Human-readable listing, one instruction per line.
+void dump_ir(const IrFunc& func, OutputBuffer& out);
+
+// Checks the structural and SSA invariants, including that every definition
+// dominates its uses. Throws std::runtime_error describing the first violation.
+void verify_ir(const IrFunc& func);
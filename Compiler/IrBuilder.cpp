@@ -0,0 +1,974 @@
+//
+//  IrBuilder.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "IrBuilder.hpp"
+#include "SymbolTable.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+// Source variables, numbered by declaration, so shadowed names stay distinct.
+using VarId = uint32_t;
+
+class IrBuilder
+{
+public:
+    IrBuilder(const NodeProg& prog)
+        : m_prog(prog), m_vars(prog.symbol_count) {}
+    
+    IrFunc build()
+    {
+        index_assignments();
+        m_block = new_block();
+        seal(m_block);
+        lower_stmts();
+        if (m_block != no_block)
+        {
+            set_term({ .kind = IrTermKind::exit, .value = emit_const(0) });
+        }
+        remove_trivial_phis();
+        remove_dead_blocks();
+        return std::move(m_func);
+    }
+    
+private:
+    // ---- Blocks ----
+    
+    IrBlockId new_block()
+    {
+        m_func.blocks.emplace_back();
+        m_sealed.push_back(false);
+        m_incomplete.emplace_back();
+        m_heads.push_back({});
+        return static_cast<IrBlockId>(m_func.blocks.size() - 1);
+    }
+    
+    // A block that several edges reach within one construct, dominated by
+    // `head`. Only variables that `construct` assigns can differ between its
+    // predecessors; with no construct (inside a condition) none can.
+    IrBlockId new_block_in(IrBlockId head, NodeIndex construct = no_node)
+    {
+        IrBlockId block = new_block();
+        m_heads[block] = { .head = head, .construct = construct };
+        return block;
+    }
+    
+    // Ends the current block; code that follows is unreachable until a new block is entered.
+    void set_term(const IrTerm& term)
+    {
+        m_func.blocks[m_block].term = term;
+        for (IrBlockId succ : ir_successors(m_func.blocks[m_block]))
+        {
+            m_func.blocks[succ].preds.push_back(m_block);
+        }
+        m_block = no_block;
+    }
+    
+    // Declares that every predecessor of `block` is known, completing its pending phis.
+    void seal(IrBlockId block)
+    {
+        std::vector<std::pair<VarId, IrValue>> pending = std::move(m_incomplete[block]);
+        m_sealed[block] = true;
+        for (auto [var, phi] : pending)
+        {
+            add_phi_operands(var, phi);
+        }
+    }
+    
+    // ---- Values ----
+    
+    IrValue add_value(const IrInstr& instr)
+    {
+        m_func.values.push_back(instr);
+        return static_cast<IrValue>(m_func.values.size() - 1);
+    }
+    
+    IrValue emit(IrOp op, IrValue lhs, IrValue rhs)
+    {
+        IrValue value = add_value({ .op = op, .block = m_block, .lhs = lhs, .rhs = rhs });
+        m_func.blocks[m_block].instrs.push_back(value);
+        return value;
+    }
+    
+    IrValue emit_const(uint64_t imm)
+    {
+        IrValue value = add_value({ .op = IrOp::const_, .block = m_block, .imm = imm });
+        m_func.blocks[m_block].instrs.push_back(value);
+        return value;
+    }
+    
+    IrValue new_phi(IrBlockId block)
+    {
+        IrValue phi = add_value({ .op = IrOp::phi, .block = block, .lhs = 0, .rhs = 0 });
+        m_func.blocks[block].phis.push_back(phi);
+        return phi;
+    }
+    
+    // ---- SSA construction ----
+    
+    // Numbers statements in preorder and lists where each Symbol is assigned,
+    // so whether a construct assigns a variable is one binary search over its
+    // span of the numbering, and what it assigns is one run of m_assign_order.
+    void index_assignments()
+    {
+        m_pre.resize(m_prog.stmt_pool.size());
+        m_post.resize(m_prog.stmt_pool.size());
+        m_assigns.resize(m_prog.symbol_count);
+        uint32_t order = 0;
+        std::vector<std::pair<NodeIndex, bool>> stack;  // (statement, whether its span is closing)
+        auto push_all = [&](std::span<const NodeIndex> stmts) {
+            for (size_t i = stmts.size(); i-- > 0;)
+            {
+                stack.push_back({ stmts[i], false });
+            }
+        };
+        push_all(m_prog.stmts);
+        while (!stack.empty())
+        {
+            auto [index, closing] = stack.back();
+            stack.pop_back();
+            if (closing)
+            {
+                m_post[index] = order;
+                continue;
+            }
+            m_pre[index] = order++;
+            const NodeStmt& stmt = m_prog.stmt(index);
+            switch (stmt.kind)
+            {
+                case NodeKind::stmt_asign:
+                    m_assigns[stmt.name].push_back(m_pre[index]);
+                    m_assign_order.push_back({ m_pre[index], stmt.name });
+                    break;
+                case NodeKind::scope:
+                    stack.push_back({ index, true });
+                    push_all(m_prog.scope_stmts(stmt));
+                    break;
+                case NodeKind::stmt_if:
+                case NodeKind::if_pred_elif:
+                case NodeKind::if_pred_else:
+                case NodeKind::stmt_while:
+                    // An if's span covers its elif and else arms too.
+                    stack.push_back({ index, true });
+                    if (stmt.kind != NodeKind::if_pred_else && stmt.pred != no_node)
+                    {
+                        stack.push_back({ stmt.pred, false });
+                    }
+                    stack.push_back({ stmt.scope, false });
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    
+    bool assigns(NodeIndex construct, VarId var) const
+    {
+        const std::vector<uint32_t>& at = m_assigns[m_var_names[var]];
+        auto it = std::lower_bound(at.begin(), at.end(), m_pre[construct]);
+        return it != at.end() && *it < m_post[construct];
+    }
+    
+    // Calls fn(var) for each assignment in `node`, with the variable its name
+    // has in the enclosing scope. A name that a nested declaration shadows
+    // still gives the outer variable, which only costs a lookup.
+    template<typename Fn>
+    void for_each_assigned(NodeIndex node, Fn&& fn)
+    {
+        auto before = [](const std::pair<uint32_t, Symbol>& entry, uint32_t order) { return entry.first < order; };
+        auto it = std::lower_bound(m_assign_order.begin(), m_assign_order.end(), m_pre[node], before);
+        for (; it != m_assign_order.end() && it->first < m_post[node]; ++it)
+        {
+            if (const VarId* var = m_vars.find(it->second))
+            {
+                fn(*var);
+            }
+        }
+    }
+    
+    // A construct is about to start in the current block: its head. What it
+    // assigns is recorded there, so lookups from inside stop at the head
+    // rather than searching back through everything before it.
+    void record_head(NodeIndex construct)
+    {
+        for_each_assigned(construct, [&](VarId var) {
+            if (m_current[var] != no_value)
+            {
+                write_var(var, m_block, m_current[var]);
+            }
+        });
+    }
+    
+    // Control has moved to a block where what `node` assigns may differ from
+    // the values last seen: an arm's end to the next arm, or into a join or
+    // loop header, which gets its phis for exactly those variables here.
+    void refresh_assigned(NodeIndex node)
+    {
+        for_each_assigned(node, [&](VarId var) {
+            m_current[var] = m_block != no_block ? read_var(var, m_block) : no_value;
+        });
+    }
+    
+    // The value of `var` where lowering is. Every other variable keeps its
+    // value across a construct, so this is a lookup only after unreachable code.
+    IrValue read_current(VarId var)
+    {
+        if (m_current[var] == no_value)
+        {
+            m_current[var] = read_var(var, m_block);
+        }
+        return m_current[var];
+    }
+    
+    void assign(VarId var, IrValue value)
+    {
+        write_var(var, m_block, value);
+        m_current[var] = value;
+    }
+    
+    static inline uint64_t def_key(VarId var, IrBlockId block)
+    {
+        return (static_cast<uint64_t>(block) << 32) | var;
+    }
+    
+    void write_var(VarId var, IrBlockId block, IrValue value)
+    {
+        m_defs[def_key(var, block)] = value;
+    }
+    
+    // Braun et al.'s lookup, without recursion: single-predecessor chains are
+    // walked in a loop, and a phi whose operands are still being read waits on
+    // m_phi_frames, so long elif chains and deep nesting cannot exhaust the stack.
+    IrValue read_var(VarId var, IrBlockId block)
+    {
+        IrValue value = read_var_local(var, block);
+        return value != no_value ? value : complete_phis(var);
+    }
+    
+    // Looks `var` up from `block` back to the first block that defines it, has
+    // unknown predecessors, or joins several. A join of a construct that does
+    // not assign `var` is passed over to the block heading the construct;
+    // any other join gets a phi that is pushed on m_phi_frames for its
+    // operands to be read, and then no_value is returned.
+    IrValue read_var_local(VarId var, IrBlockId block)
+    {
+        m_chain.clear();
+        IrValue value;
+        bool pending = false;
+        while (true)
+        {
+            auto it = m_defs.find(def_key(var, block));
+            if (it != m_defs.end())
+            {
+                value = it->second;
+                break;
+            }
+            const BlockHead& head = m_heads[block];
+            if (head.head != no_block && (head.construct == no_node || !assigns(head.construct, var)))
+            {
+                m_chain.push_back(block);
+                block = head.head;
+                continue;
+            }
+            const std::vector<IrBlockId>& preds = m_func.blocks[block].preds;
+            if (!m_sealed[block])
+            {
+                value = new_phi(block);
+                m_incomplete[block].emplace_back(var, value);
+                write_var(var, block, value);
+                break;
+            }
+            if (preds.size() == 1)
+            {
+                m_chain.push_back(block);
+                block = preds[0];
+                continue;
+            }
+            if (preds.empty())
+            {
+                // check_semantics guarantees a declaration dominates every use.
+                throw std::runtime_error("Variable read before its declaration");
+            }
+            // Recorded before its operands are read so a cycle through this block finds the phi.
+            value = new_phi(block);
+            write_var(var, block, value);
+            m_phi_frames.push_back({ .phi = value, .args_base = m_phi_reads.size() });
+            pending = true;
+            break;
+        }
+        for (IrBlockId b : m_chain)
+        {
+            write_var(var, b, value);
+        }
+        return pending ? no_value : value;
+    }
+    
+    void add_phi_operands(VarId var, IrValue phi)
+    {
+        m_phi_frames.push_back({ .phi = phi, .args_base = m_phi_reads.size() });
+        complete_phis(var);
+    }
+    
+    // Reads the operands of the phis on m_phi_frames, innermost first, until
+    // the outermost is complete; returns that phi.
+    IrValue complete_phis(VarId var)
+    {
+        IrValue value = no_value;   // the operand just read for the top frame
+        while (true)
+        {
+            PhiFrame& frame = m_phi_frames.back();
+            if (value != no_value)
+            {
+                m_phi_reads.push_back(value);
+            }
+            const std::vector<IrBlockId>& preds = m_func.blocks[m_func.value(frame.phi).block].preds;
+            size_t read = m_phi_reads.size() - frame.args_base;
+            if (read < preds.size())
+            {
+                // May push a frame of its own, which is then completed first.
+                value = read_var_local(var, preds[read]);
+                continue;
+            }
+            // Operands of one phi are stored contiguously, after any phis completed inside.
+            IrInstr& instr = m_func.values[frame.phi];
+            instr.lhs = static_cast<uint32_t>(m_func.phi_args.size());
+            instr.rhs = static_cast<uint32_t>(preds.size());
+            m_func.phi_args.insert(m_func.phi_args.end(), m_phi_reads.begin() + frame.args_base, m_phi_reads.end());
+            m_phi_reads.resize(frame.args_base);
+            value = frame.phi;
+            m_phi_frames.pop_back();
+            if (m_phi_frames.empty())
+            {
+                return value;
+            }
+        }
+    }
+    
+    // A phi whose operands are all the same value (or the phi itself) is just
+    // that value. Replacing one can make others trivial, so run to a fixpoint.
+    void remove_trivial_phis()
+    {
+        std::vector<IrValue> replace(m_func.values.size());
+        for (IrValue v = 0; v < replace.size(); v++)
+        {
+            replace[v] = v;
+        }
+        auto resolve = [&](IrValue v) {
+            while (replace[v] != v)
+            {
+                replace[v] = replace[replace[v]];
+                v = replace[v];
+            }
+            return v;
+        };
+        
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (IrBlock& block : m_func.blocks)
+            {
+                for (IrValue phi : block.phis)
+                {
+                    if (resolve(phi) != phi)
+                    {
+                        continue;
+                    }
+                    IrValue same = no_value;
+                    bool trivial = true;
+                    for (IrValue arg : m_func.phi_operands(m_func.value(phi)))
+                    {
+                        arg = resolve(arg);
+                        if (arg == phi || arg == same)
+                        {
+                            continue;
+                        }
+                        if (same != no_value)
+                        {
+                            trivial = false;
+                            break;
+                        }
+                        same = arg;
+                    }
+                    if (trivial && same != no_value)
+                    {
+                        replace[phi] = same;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        
+        for (IrInstr& instr : m_func.values)
+        {
+            if (instr.op != IrOp::const_ && instr.op != IrOp::phi)
+            {
+                instr.lhs = resolve(instr.lhs);
+                instr.rhs = resolve(instr.rhs);
+            }
+        }
+        for (IrValue& arg : m_func.phi_args)
+        {
+            arg = resolve(arg);
+        }
+        for (IrBlock& block : m_func.blocks)
+        {
+            std::erase_if(block.phis, [&](IrValue phi) { return resolve(phi) != phi; });
+            if (block.term.value != no_value)
+            {
+                block.term.value = resolve(block.term.value);
+            }
+        }
+    }
+    
+    // Joins that no branch reaches (every arm ended in exit) are left empty; drop them.
+    void remove_dead_blocks()
+    {
+        std::vector<IrBlockId> remap(m_func.blocks.size(), no_block);
+        std::vector<IrBlock> live;
+        for (IrBlockId b = 0; b < m_func.blocks.size(); b++)
+        {
+            if (b == 0 || !m_func.blocks[b].preds.empty())
+            {
+                remap[b] = static_cast<IrBlockId>(live.size());
+                live.push_back(std::move(m_func.blocks[b]));
+            }
+        }
+        for (IrBlock& block : live)
+        {
+            for (IrBlockId& pred : block.preds)
+            {
+                pred = remap[pred];
+            }
+            if (block.term.target != no_block)
+            {
+                block.term.target = remap[block.term.target];
+            }
+            if (block.term.other != no_block)
+            {
+                block.term.other = remap[block.term.other];
+            }
+            for (IrValue phi : block.phis)
+            {
+                m_func.values[phi].block = remap[m_func.values[phi].block];
+            }
+            for (IrValue value : block.instrs)
+            {
+                m_func.values[value].block = remap[m_func.values[value].block];
+            }
+        }
+        m_func.blocks = std::move(live);
+    }
+    
+    // ---- Lowering ----
+    
+    VarId lookup_var(Symbol name)
+    {
+        const VarId* var = m_vars.find(name);
+        if (!var)
+        {
+            // check_semantics rejects these before lowering.
+            throw std::runtime_error("Unresolved identifier: " + std::string(m_prog.interner->name(name)));
+        }
+        return *var;
+    }
+    
+    // Expressions are lowered from an explicit stack of tasks rather than by
+    // recursion, since && and || put control flow in the middle of one.
+    struct ExprTask
+    {
+        enum class Kind : uint8_t
+        {
+            value,          // push the value of `node` on m_operands
+            apply,          // replace the top two operands with `node`'s operator applied to them
+            cond,           // branch to `target` if `node` is true, else to `other`
+            branch,         // pop a value and branch on it to `target` or `other`
+            enter,          // seal `target`, whose one predecessor is in place, and continue there
+            short_circuit,  // pop the left operand of && or || and skip the right one if it settles the result
+            join            // pop the right operand and merge it with the skipped path in a phi
+        };
+        Kind kind;
+        NodeIndex node = no_node;
+        IrBlockId target = no_block;
+        IrBlockId other = no_block;
+    };
+    
+    IrValue lower_expr(NodeIndex root)
+    {
+        m_operands.clear();
+        m_tasks.push_back({ .kind = ExprTask::Kind::value, .node = root });
+        run_tasks();
+        return m_operands.back();
+    }
+    
+    // Branches to `target` if `root` is true and to `other` if not. Both may
+    // gain several predecessors, so sealing them is left to the caller.
+    void lower_cond(NodeIndex root, IrBlockId target, IrBlockId other)
+    {
+        m_operands.clear();
+        m_tasks.push_back({ .kind = ExprTask::Kind::cond, .node = root, .target = target, .other = other });
+        run_tasks();
+    }
+    
+    void run_tasks()
+    {
+        using Kind = ExprTask::Kind;
+        while (!m_tasks.empty())
+        {
+            ExprTask task = m_tasks.back();
+            m_tasks.pop_back();
+            switch (task.kind)
+            {
+                case Kind::value:
+                    lower_value(task.node);
+                    break;
+                case Kind::apply:
+                {
+                    static constexpr IrOp ops[] = {
+                        IrOp::add, IrOp::sub, IrOp::mul, IrOp::div,
+                        IrOp::eq, IrOp::ne, IrOp::lt, IrOp::le, IrOp::gt, IrOp::ge
+                    };
+                    IrValue rhs = pop_operand();
+                    m_operands.back() = emit(ops[static_cast<size_t>(m_prog.expr(task.node).op)], m_operands.back(), rhs);
+                    break;
+                }
+                case Kind::cond:
+                    lower_cond_task(task);
+                    break;
+                case Kind::branch:
+                    set_term({ .kind = IrTermKind::br, .value = pop_operand(), .target = task.target, .other = task.other });
+                    break;
+                case Kind::enter:
+                    seal(task.target);
+                    m_block = task.target;
+                    break;
+                case Kind::short_circuit:
+                {
+                    // The value of the whole expression if the left operand settles it.
+                    bool is_or = m_prog.expr(task.node).op == BinOp::log_or;
+                    IrValue settled = emit_const(is_or ? 1 : 0);
+                    IrBlockId rhs_block = new_block();
+                    IrBlockId join = new_block_in(m_block);
+                    IrValue lhs = pop_operand();
+                    if (is_or)
+                        set_term({ .kind = IrTermKind::br, .value = lhs, .target = join, .other = rhs_block });
+                    else
+                        set_term({ .kind = IrTermKind::br, .value = lhs, .target = rhs_block, .other = join });
+                    seal(rhs_block);
+                    m_block = rhs_block;
+                    m_joins.push_back({ join, settled });
+                    break;
+                }
+                case Kind::join:
+                {
+                    auto [join, settled] = m_joins.back();
+                    m_joins.pop_back();
+                    IrValue rhs = pop_operand();
+                    if (!is_comparison(m_func.value(rhs).op))
+                    {
+                        rhs = emit(IrOp::ne, rhs, emit_const(0));
+                    }
+                    set_term({ .kind = IrTermKind::jmp, .target = join });
+                    seal(join);
+                    m_block = join;
+                    // Operands in the order of join's predecessors: the short-circuit edge came first.
+                    IrValue phi = new_phi(join);
+                    m_func.values[phi].lhs = static_cast<uint32_t>(m_func.phi_args.size());
+                    m_func.values[phi].rhs = 2;
+                    m_func.phi_args.push_back(settled);
+                    m_func.phi_args.push_back(rhs);
+                    m_operands.push_back(phi);
+                    break;
+                }
+            }
+        }
+    }
+    
+    IrValue pop_operand()
+    {
+        IrValue value = m_operands.back();
+        m_operands.pop_back();
+        return value;
+    }
+    
+    void lower_value(NodeIndex index)
+    {
+        using Kind = ExprTask::Kind;
+        const NodeExpr& expr = m_prog.expr(index);
+        switch (expr.kind)
+        {
+            case NodeKind::term_int_lit:
+                m_operands.push_back(emit_const(expr.value));
+                break;
+            case NodeKind::term_ident:
+                m_operands.push_back(read_current(lookup_var(expr.name)));
+                break;
+            case NodeKind::bin_expr:
+                // Tasks run last-pushed first, so the left operand comes first.
+                if (is_logical(expr.op))
+                {
+                    m_tasks.push_back({ .kind = Kind::join, .node = index });
+                    m_tasks.push_back({ .kind = Kind::value, .node = expr.rhs });
+                    m_tasks.push_back({ .kind = Kind::short_circuit, .node = index });
+                    m_tasks.push_back({ .kind = Kind::value, .node = expr.lhs });
+                    break;
+                }
+                m_tasks.push_back({ .kind = Kind::apply, .node = index });
+                m_tasks.push_back({ .kind = Kind::value, .node = expr.rhs });
+                m_tasks.push_back({ .kind = Kind::value, .node = expr.lhs });
+                break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+    
+    // && and || in a condition branch on each operand in turn rather than
+    // making a value: the right operand is only reached through `mid`.
+    void lower_cond_task(const ExprTask& task)
+    {
+        using Kind = ExprTask::Kind;
+        const NodeExpr& expr = m_prog.expr(task.node);
+        if (expr.kind != NodeKind::bin_expr || !is_logical(expr.op))
+        {
+            m_tasks.push_back({ .kind = Kind::branch, .target = task.target, .other = task.other });
+            m_tasks.push_back({ .kind = Kind::value, .node = task.node });
+            return;
+        }
+        IrBlockId mid = new_block_in(m_block);
+        m_tasks.push_back({ .kind = Kind::cond, .node = expr.rhs, .target = task.target, .other = task.other });
+        m_tasks.push_back({ .kind = Kind::enter, .target = mid });
+        if (expr.op == BinOp::log_and)
+            m_tasks.push_back({ .kind = Kind::cond, .node = expr.lhs, .target = mid, .other = task.other });
+        else
+            m_tasks.push_back({ .kind = Kind::cond, .node = expr.lhs, .target = task.target, .other = mid });
+    }
+    
+    // Statements of one open block; `arm` is the if/elif/else/while it is the body of.
+    struct Frame
+    {
+        std::span<const NodeIndex> stmts;
+        size_t next = 0;
+        NodeIndex arm = no_node;
+        IrBlockId join = no_block;      // where every arm of the chain ends up; while: past the loop
+        IrBlockId other = no_block;     // if, elif: where a false condition goes; while: the latch
+    };
+    
+    // A while being lowered. The loop is rotated: a guard before it tests the
+    // condition once, and the latch at the bottom tests it again for every
+    // iteration after the first, so each one ends in a single branch.
+    //
+    //     guard:   br cond, preheader, exit
+    //     preheader: jmp body          (loop-invariant code goes here)
+    //     body:    ...                 (header of the loop)
+    //     latch:   br cond, body, exit (continue jumps here)
+    //     exit:                        (break jumps here)
+    struct Loop
+    {
+        IrBlockId body;
+        IrBlockId latch;
+        IrBlockId exit;
+    };
+    
+    // Blocks are lowered from an explicit stack of frames, so nesting depth and
+    // elif chain length are bounded by memory rather than by the call stack.
+    void lower_stmts()
+    {
+        m_frames.push_back({ .stmts = m_prog.stmts });
+        while (true)
+        {
+            Frame& frame = m_frames.back();
+            if (frame.next < frame.stmts.size())
+            {
+                lower_stmt(frame.stmts[frame.next++]);
+                continue;
+            }
+            Frame done = frame;
+            m_frames.pop_back();
+            if (m_frames.empty())
+            {
+                break;
+            }
+            m_vars.exit_scope();
+            if (done.arm != no_node)
+            {
+                close_arm(done);
+            }
+        }
+    }
+    
+    void open_scope(NodeIndex scope, NodeIndex arm = no_node, IrBlockId join = no_block, IrBlockId other = no_block)
+    {
+        m_vars.enter_scope();
+        m_frames.push_back({ .stmts = m_prog.scope_stmts(m_prog.stmt(scope)), .arm = arm, .join = join, .other = other });
+    }
+    
+    // Branches on the arm's condition: the true side runs its scope and then
+    // jumps to `join`, the false side becomes current once the scope is done.
+    void open_branch(NodeIndex arm, IrBlockId join)
+    {
+        const NodeStmt& stmt = m_prog.stmt(arm);
+        IrBlockId then_block = new_block_in(m_block);
+        IrBlockId else_block = new_block_in(m_block);
+        lower_cond(stmt.expr, then_block, else_block);
+        seal(then_block);
+        seal(else_block);
+        
+        m_block = then_block;
+        open_scope(stmt.scope, arm, join, else_block);
+    }
+    
+    void open_pred(NodeIndex index, IrBlockId join)
+    {
+        const NodeStmt& pred = m_prog.stmt(index);
+        switch (pred.kind)
+        {
+            case NodeKind::if_pred_elif:
+                open_branch(index, join);
+                break;
+            case NodeKind::if_pred_else:
+                open_scope(pred.scope, index, join);
+                break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+    
+    // The value of a condition that is a constant or compares two, in which
+    // case the comparison becomes its result.
+    std::optional<bool> known_condition(IrValue cond)
+    {
+        IrInstr& instr = m_func.values[cond];
+        if (is_comparison(instr.op) && m_func.value(instr.lhs).op == IrOp::const_ && m_func.value(instr.rhs).op == IrOp::const_)
+        {
+            uint64_t lhs = m_func.value(instr.lhs).imm;
+            uint64_t rhs = m_func.value(instr.rhs).imm;
+            bool result = false;
+            switch (instr.op)
+            {
+                case IrOp::eq: result = lhs == rhs; break;
+                case IrOp::ne: result = lhs != rhs; break;
+                case IrOp::lt: result = lhs < rhs; break;
+                case IrOp::le: result = lhs <= rhs; break;
+                case IrOp::gt: result = lhs > rhs; break;
+                case IrOp::ge: result = lhs >= rhs; break;
+                default: break;
+            }
+            instr = { .op = IrOp::const_, .block = instr.block, .imm = result };
+        }
+        if (instr.op == IrOp::const_)
+        {
+            return instr.imm != 0;
+        }
+        return {};
+    }
+    
+    // Like lower_cond, but a condition known up front (a constant that
+    // folding left behind, or two compared) becomes a plain jump, so
+    // `while (1)` has no test at all and a loop over constant bounds no guard.
+    void branch_on(NodeIndex cond, IrBlockId target, IrBlockId other)
+    {
+        const NodeExpr& expr = m_prog.expr(cond);
+        if (expr.kind == NodeKind::bin_expr && is_logical(expr.op))
+        {
+            lower_cond(cond, target, other);
+            return;
+        }
+        IrValue value = lower_expr(cond);
+        if (std::optional<bool> known = known_condition(value))
+        {
+            set_term({ .kind = IrTermKind::jmp, .target = *known ? target : other });
+            return;
+        }
+        set_term({ .kind = IrTermKind::br, .value = value, .target = target, .other = other });
+    }
+    
+    // Continues in `block`, or in unreachable code if nothing branches to it.
+    void enter(IrBlockId block)
+    {
+        seal(block);
+        m_block = m_func.blocks[block].preds.empty() ? no_block : block;
+    }
+    
+    void open_loop(NodeIndex index)
+    {
+        const NodeStmt& stmt = m_prog.stmt(index);
+        record_head(index);
+        IrBlockId guard = m_block;
+        IrBlockId preheader = new_block_in(guard);
+        Loop loop {
+            .body = new_block_in(guard, index),
+            .latch = new_block_in(guard, index),
+            .exit = new_block_in(guard, index)
+        };
+        branch_on(stmt.expr, preheader, loop.exit);
+        enter(preheader);
+        if (m_block != no_block)
+        {
+            set_term({ .kind = IrTermKind::jmp, .target = loop.body });
+        }
+        // The body stays unsealed until the latch has branched back to it.
+        m_block = m_func.blocks[loop.body].preds.empty() ? no_block : loop.body;
+        m_loops.push_back(loop);
+        refresh_assigned(index);
+        open_scope(stmt.scope, index, loop.exit, loop.latch);
+    }
+    
+    // Runs once the body of a while has been lowered.
+    void close_loop(const Frame& frame)
+    {
+        Loop loop = m_loops.back();
+        m_loops.pop_back();
+        if (m_block != no_block)
+        {
+            set_term({ .kind = IrTermKind::jmp, .target = loop.latch });
+        }
+        enter(loop.latch);
+        refresh_assigned(frame.arm);
+        if (m_block != no_block)
+        {
+            branch_on(m_prog.stmt(frame.arm).expr, loop.body, loop.exit);
+        }
+        seal(loop.body);
+        enter(loop.exit);
+        refresh_assigned(frame.arm);
+    }
+    
+    // Runs once the scope of an if, elif, else or while has been lowered.
+    void close_arm(const Frame& frame)
+    {
+        const NodeStmt& arm = m_prog.stmt(frame.arm);
+        if (arm.kind == NodeKind::stmt_while)
+        {
+            close_loop(frame);
+            return;
+        }
+        if (arm.kind != NodeKind::if_pred_else)
+        {
+            if (m_block != no_block)
+            {
+                set_term({ .kind = IrTermKind::jmp, .target = frame.join });
+            }
+            m_block = frame.other;
+            refresh_assigned(arm.scope);
+            if (arm.pred != no_node)
+            {
+                open_pred(arm.pred, frame.join);
+                return;
+            }
+        }
+        if (m_block != no_block)
+        {
+            set_term({ .kind = IrTermKind::jmp, .target = frame.join });
+        }
+        seal(frame.join);
+        m_block = m_func.blocks[frame.join].preds.empty() ? no_block : frame.join;
+        refresh_assigned(m_heads[frame.join].construct);
+    }
+    
+    void lower_stmt(NodeIndex index)
+    {
+        if (m_block == no_block)
+        {
+            return;
+        }
+        const NodeStmt& stmt = m_prog.stmt(index);
+        switch (stmt.kind)
+        {
+            case NodeKind::stmt_exit:
+                set_term({ .kind = IrTermKind::exit, .value = lower_expr(stmt.expr) });
+                break;
+            case NodeKind::stmt_let:
+            {
+                IrValue value = lower_expr(stmt.expr);
+                VarId var = m_var_count++;
+                m_vars.declare(stmt.name, var);
+                m_var_names.push_back(stmt.name);
+                m_current.push_back(no_value);
+                assign(var, value);
+                break;
+            }
+            case NodeKind::stmt_asign:
+            {
+                VarId var = lookup_var(stmt.name);
+                assign(var, lower_expr(stmt.expr));
+                break;
+            }
+            case NodeKind::scope:
+                open_scope(index);
+                break;
+            case NodeKind::stmt_if:
+                record_head(index);
+                open_branch(index, new_block_in(m_block, index));
+                break;
+            case NodeKind::stmt_while:
+                open_loop(index);
+                break;
+            case NodeKind::stmt_break:
+                set_term({ .kind = IrTermKind::jmp, .target = m_loops.back().exit });
+                break;
+            case NodeKind::stmt_continue:
+                set_term({ .kind = IrTermKind::jmp, .target = m_loops.back().latch });
+                break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+    
+    const NodeProg& m_prog;
+    IrFunc m_func;
+    IrBlockId m_block = no_block;       // block being filled, or no_block in unreachable code
+    ScopedTable<VarId> m_vars;
+    VarId m_var_count = 0;
+    std::unordered_map<uint64_t, IrValue> m_defs;   // (block, var) -> current value
+    std::vector<bool> m_sealed;
+    std::vector<std::vector<std::pair<VarId, IrValue>>> m_incomplete;
+    std::vector<Symbol> m_var_names;    // VarId -> its name, for assigns()
+    std::vector<IrValue> m_current;     // VarId -> its value where lowering is, or no_value
+    
+    // Where every statement falls in a preorder numbering: a scope, if chain
+    // or while spans [m_pre, m_post). m_assigns lists, per Symbol, the numbers of
+    // the statements assigning it, in order.
+    std::vector<uint32_t> m_pre;
+    std::vector<uint32_t> m_post;
+    std::vector<std::vector<uint32_t>> m_assigns;
+    std::vector<std::pair<uint32_t, Symbol>> m_assign_order;   // every assignment, in preorder
+    
+    struct BlockHead
+    {
+        IrBlockId head = no_block;
+        NodeIndex construct = no_node;
+    };
+    std::vector<BlockHead> m_heads;     // per block; see new_block_in
+    
+    // A phi whose operands are being read: they collect in m_phi_reads from args_base.
+    struct PhiFrame
+    {
+        IrValue phi;
+        size_t args_base;
+    };
+    std::vector<PhiFrame> m_phi_frames;
+    std::vector<IrValue> m_phi_reads;
+    std::vector<IrBlockId> m_chain;     // blocks read_var_local passed through
+    
+    std::vector<Frame> m_frames;
+    std::vector<Loop> m_loops;
+    
+    std::vector<ExprTask> m_tasks;
+    std::vector<IrValue> m_operands;    // value stack of the tasks
+    std::vector<std::pair<IrBlockId, IrValue>> m_joins;    // (join, value if skipped) of open && and ||
+};
+
+}
+
+IrFunc build_ir(const NodeProg& prog)
+{
+    return IrBuilder(prog).build();
+}
@@ -0,0 +1,21 @@
+//
+//  IrBuilder.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "Ir.hpp"
+#include "Parser.hpp"
+
+// Lowers a checked program (see check_semantics) to SSA form. Variables are
+// renamed on the fly with the algorithm of Braun et al., "Simple and Efficient
+// Construction of Static Single Assignment Form": phis are only placed where
+// a variable actually has different values on different incoming edges.
+// A join or loop header only considers the variables its if chain or loop
+// assigns; every other one keeps the value it had before the construct, so
+// a variable costs nothing across the code that leaves it alone.
+// Statements after an exit are unreachable and are dropped.
+IrFunc build_ir(const NodeProg& prog);
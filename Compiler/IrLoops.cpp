@@ -0,0 +1,427 @@
+//
+//  IrLoops.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "IrLoops.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+IrLoops::IrLoops(const IrFunc& func, const DomTree& dom)
+    : m_innermost(func.blocks.size(), no_loop)
+{
+    // (header, block branching back to it), grouped by header.
+    std::vector<std::pair<IrBlockId, IrBlockId>> back_edges;
+    for (IrBlockId b = 0; b < func.blocks.size(); b++)
+    {
+        for (IrBlockId succ : ir_successors(func.blocks[b]))
+        {
+            if (dom.dominates(succ, b))
+            {
+                back_edges.emplace_back(succ, b);
+            }
+        }
+    }
+    std::stable_sort(back_edges.begin(), back_edges.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    // Each body is found by walking predecessors back from its latches; the
+    // header is marked first, so the walk stops there.
+    std::vector<uint32_t> mark(func.blocks.size(), no_loop);
+    std::vector<IrBlockId> work;
+    for (size_t i = 0; i < back_edges.size();)
+    {
+        uint32_t index = static_cast<uint32_t>(m_loops.size());
+        IrBlockId header = back_edges[i].first;
+        Loop loop { .header = header, .preheader = no_block, .parent = no_loop, .blocks = { header } };
+        mark[header] = index;
+        for (; i < back_edges.size() && back_edges[i].first == header; i++)
+        {
+            IrBlockId latch = back_edges[i].second;
+            if (mark[latch] != index)
+            {
+                mark[latch] = index;
+                loop.blocks.push_back(latch);
+                work.push_back(latch);
+            }
+        }
+        while (!work.empty())
+        {
+            IrBlockId block = work.back();
+            work.pop_back();
+            for (IrBlockId pred : func.blocks[block].preds)
+            {
+                if (mark[pred] != index)
+                {
+                    mark[pred] = index;
+                    loop.blocks.push_back(pred);
+                    work.push_back(pred);
+                }
+            }
+        }
+        std::sort(loop.blocks.begin() + 1, loop.blocks.end(), [&](IrBlockId a, IrBlockId b) { return dom.rpo_index(a) < dom.rpo_index(b); });
+
+        IrBlockId outside = no_block;
+        size_t outside_count = 0;
+        for (IrBlockId pred : func.blocks[header].preds)
+        {
+            if (mark[pred] != index)
+            {
+                outside = pred;
+                outside_count++;
+            }
+        }
+        if (outside_count == 1 && func.blocks[outside].term.kind == IrTermKind::jmp)
+        {
+            loop.preheader = outside;
+        }
+        m_loops.push_back(std::move(loop));
+    }
+
+    // A loop nested in another has fewer blocks, so sorting by size puts
+    // inner loops first. Each block then belongs to the first loop that
+    // reaches it, and a loop's parent is the next one to take its blocks.
+    std::stable_sort(m_loops.begin(), m_loops.end(), [](const Loop& a, const Loop& b) { return a.blocks.size() < b.blocks.size(); });
+    for (uint32_t index = 0; index < m_loops.size(); index++)
+    {
+        for (IrBlockId block : m_loops[index].blocks)
+        {
+            uint32_t inner = m_innermost[block];
+            if (inner == no_loop)
+            {
+                m_innermost[block] = index;
+                continue;
+            }
+            while (m_loops[inner].parent != no_loop)
+            {
+                inner = m_loops[inner].parent;
+            }
+            if (inner != index)
+            {
+                m_loops[inner].parent = index;
+            }
+        }
+    }
+}
+
+bool IrLoops::contains(uint32_t loop, IrBlockId block) const
+{
+    // Enclosing loops always come later in m_loops.
+    uint32_t inner = m_innermost[block];
+    while (inner < loop)
+    {
+        inner = m_loops[inner].parent;
+    }
+    return inner == loop;
+}
+
+bool IrLoops::same_iteration(IrBlockId def, IrBlockId use) const
+{
+    uint32_t loop = m_innermost[use];
+    return loop == no_loop || contains(loop, def);
+}
+
+namespace {
+
+class LoopOptimizer
+{
+public:
+    LoopOptimizer(IrFunc& func)
+        : m_func(func), m_dom(func), m_loops(func, m_dom) {}
+
+    size_t run()
+    {
+        for (uint32_t index = 0; index < m_loops.loops().size(); index++)
+        {
+            if (m_loops.loops()[index].preheader == no_block)
+            {
+                continue;
+            }
+            hoist(index);
+            reduce(index);
+        }
+        replace_uses();
+        return m_changed;
+    }
+
+private:
+    inline bool invariant(uint32_t loop, IrValue value) const
+    {
+        return !m_loops.contains(loop, m_func.value(value).block);
+    }
+
+    // Whether `value` computes the same thing on every iteration and is safe
+    // to run even when the loop body would not have: division only by a
+    // non-zero constant, since a division by zero traps.
+    bool hoistable(uint32_t loop, IrValue value) const
+    {
+        const IrInstr& instr = m_func.value(value);
+        switch (instr.op)
+        {
+            case IrOp::const_:
+                return true;
+            case IrOp::phi:
+                return false;
+            case IrOp::div:
+            {
+                const IrInstr& divisor = m_func.value(instr.rhs);
+                if (divisor.op != IrOp::const_ || divisor.imm == 0)
+                    return false;
+                break;
+            }
+            case IrOp::eq:
+            case IrOp::ne:
+            case IrOp::lt:
+            case IrOp::le:
+            case IrOp::gt:
+            case IrOp::ge:
+                // Left where it is, a comparison its own block branches on fuses into the jump.
+                if (m_func.blocks[instr.block].term.value == value)
+                    return false;
+                break;
+            case IrOp::add:
+            case IrOp::sub:
+            case IrOp::mul:
+                break;
+        }
+        return invariant(loop, instr.lhs) && invariant(loop, instr.rhs);
+    }
+
+    // Blocks are visited in reverse postorder and instructions in order, so
+    // operands are hoisted before their users and can take them along.
+    void hoist(uint32_t index)
+    {
+        const IrLoops::Loop& loop = m_loops.loops()[index];
+        IrBlock& preheader = m_func.blocks[loop.preheader];
+        for (IrBlockId b : loop.blocks)
+        {
+            std::erase_if(m_func.blocks[b].instrs, [&](IrValue value) {
+                if (!hoistable(index, value))
+                {
+                    return false;
+                }
+                preheader.instrs.push_back(value);
+                m_func.values[value].block = loop.preheader;
+                m_changed += m_func.value(value).op != IrOp::const_;
+                return true;
+            });
+        }
+    }
+
+    // A header phi that every back edge feeds `next` = phi + step or phi - step.
+    struct Induction
+    {
+        IrValue phi;
+        IrValue init;
+        IrValue next;
+        IrValue step = no_value;
+        IrOp op;
+    };
+
+    std::optional<Induction> induction(uint32_t index, IrValue phi, size_t entry) const
+    {
+        std::span<const IrValue> args = m_func.phi_operands(m_func.value(phi));
+        IrValue next = no_value;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            if (i == entry)
+                continue;
+            if (next != no_value && args[i] != next)
+                return {};
+            next = args[i];
+        }
+        const IrInstr& instr = m_func.value(next);
+        if (!m_loops.contains(index, instr.block))
+        {
+            return {};
+        }
+        Induction iv { .phi = phi, .init = args[entry], .next = next, .op = instr.op };
+        if ((instr.op == IrOp::add || instr.op == IrOp::sub) && instr.lhs == phi && invariant(index, instr.rhs))
+        {
+            iv.step = instr.rhs;
+        }
+        else if (instr.op == IrOp::add && instr.rhs == phi && invariant(index, instr.lhs))
+        {
+            iv.step = instr.lhs;
+        }
+        else
+        {
+            return {};
+        }
+        return iv;
+    }
+
+    // Multiplying by these is a single shift or lea, as cheap as the add
+    // that would replace it.
+    bool cheap_factor(IrValue factor) const
+    {
+        const IrInstr& instr = m_func.value(factor);
+        if (instr.op != IrOp::const_)
+        {
+            return false;
+        }
+        return std::has_single_bit(instr.imm) || instr.imm == 3 || instr.imm == 5 || instr.imm == 9;
+    }
+
+    // i * k for an induction variable i and invariant k becomes a variable of
+    // its own that starts at init * k and steps by step * k, both computed
+    // in the preheader. A product of i's next value is the new variable's
+    // next value.
+    void reduce(uint32_t index)
+    {
+        const IrLoops::Loop& loop = m_loops.loops()[index];
+        const IrBlock& header = m_func.blocks[loop.header];
+        size_t entry = std::find(header.preds.begin(), header.preds.end(), loop.preheader) - header.preds.begin();
+
+        std::vector<Induction> ivs;
+        std::unordered_map<IrValue, size_t> iv_of;     // phi or next value -> index in ivs
+        for (IrValue phi : header.phis)
+        {
+            if (std::optional<Induction> iv = induction(index, phi, entry))
+            {
+                iv_of[iv->phi] = ivs.size();
+                iv_of[iv->next] = ivs.size();
+                ivs.push_back(iv.value());
+            }
+        }
+        if (ivs.empty())
+        {
+            return;
+        }
+
+        // (multiplication, its induction variable operand, the factor)
+        std::vector<std::tuple<IrValue, IrValue, IrValue>> products;
+        for (IrBlockId b : loop.blocks)
+        {
+            for (IrValue value : m_func.blocks[b].instrs)
+            {
+                const IrInstr& instr = m_func.value(value);
+                if (instr.op != IrOp::mul)
+                    continue;
+                if (iv_of.contains(instr.lhs) && invariant(index, instr.rhs) && !cheap_factor(instr.rhs))
+                    products.emplace_back(value, instr.lhs, instr.rhs);
+                else if (iv_of.contains(instr.rhs) && invariant(index, instr.lhs) && !cheap_factor(instr.lhs))
+                    products.emplace_back(value, instr.rhs, instr.lhs);
+            }
+        }
+
+        // One new variable per (induction variable, factor), shared by every product of the two.
+        std::unordered_map<uint64_t, std::pair<IrValue, IrValue>> reduced;    // -> (phi, next)
+        for (auto [product, operand, factor] : products)
+        {
+            const Induction& iv = ivs[iv_of[operand]];
+            uint64_t key = (static_cast<uint64_t>(iv.phi) << 32) | factor;
+            auto it = reduced.find(key);
+            if (it == reduced.end())
+            {
+                it = reduced.emplace(key, make_induction(loop, entry, iv, factor)).first;
+            }
+            m_replace[product] = operand == iv.phi ? it->second.first : it->second.second;
+            erase(product);
+            m_changed++;
+        }
+    }
+
+    std::pair<IrValue, IrValue> make_induction(const IrLoops::Loop& loop, size_t entry, const Induction& iv, IrValue factor)
+    {
+        IrValue init = append(loop.preheader, IrOp::mul, iv.init, factor);
+        IrValue step = append(loop.preheader, IrOp::mul, iv.step, factor);
+
+        size_t pred_count = m_func.blocks[loop.header].preds.size();
+        IrValue phi = add_value({ .op = IrOp::phi, .block = loop.header, .lhs = static_cast<uint32_t>(m_func.phi_args.size()), .rhs = static_cast<uint32_t>(pred_count) });
+        m_func.blocks[loop.header].phis.push_back(phi);
+
+        // Right after the old variable's step, which is available on every back edge.
+        IrBlockId block = m_func.value(iv.next).block;
+        IrValue next = add_value({ .op = iv.op, .block = block, .lhs = phi, .rhs = step });
+        std::vector<IrValue>& instrs = m_func.blocks[block].instrs;
+        instrs.insert(std::find(instrs.begin(), instrs.end(), iv.next) + 1, next);
+
+        for (size_t i = 0; i < pred_count; i++)
+        {
+            m_func.phi_args.push_back(i == entry ? init : next);
+        }
+        return { phi, next };
+    }
+
+    IrValue add_value(const IrInstr& instr)
+    {
+        m_func.values.push_back(instr);
+        return static_cast<IrValue>(m_func.values.size() - 1);
+    }
+
+    // Appends lhs op rhs to `block`, folded when both are constants.
+    IrValue append(IrBlockId block, IrOp op, IrValue lhs, IrValue rhs)
+    {
+        const IrInstr& a = m_func.value(lhs);
+        const IrInstr& b = m_func.value(rhs);
+        IrValue value = a.op == IrOp::const_ && b.op == IrOp::const_
+            ? add_value({ .op = IrOp::const_, .block = block, .imm = a.imm * b.imm })
+            : add_value({ .op = op, .block = block, .lhs = lhs, .rhs = rhs });
+        m_func.blocks[block].instrs.push_back(value);
+        return value;
+    }
+
+    // Takes `value` out of its block. It stays in IrFunc::values as a
+    // constant, so nothing counts it as a use of its old operands.
+    void erase(IrValue value)
+    {
+        IrInstr& instr = m_func.values[value];
+        std::erase(m_func.blocks[instr.block].instrs, value);
+        instr = { .op = IrOp::const_, .block = instr.block };
+    }
+
+    void replace_uses()
+    {
+        if (m_replace.empty())
+        {
+            return;
+        }
+        auto resolve = [&](IrValue& value) {
+            auto it = m_replace.find(value);
+            if (it != m_replace.end())
+            {
+                value = it->second;
+            }
+        };
+        for (IrInstr& instr : m_func.values)
+        {
+            if (instr.op != IrOp::const_ && instr.op != IrOp::phi)
+            {
+                resolve(instr.lhs);
+                resolve(instr.rhs);
+            }
+        }
+        for (IrValue& arg : m_func.phi_args)
+        {
+            resolve(arg);
+        }
+        for (IrBlock& block : m_func.blocks)
+        {
+            if (block.term.value != no_value)
+            {
+                resolve(block.term.value);
+            }
+        }
+    }
+
+    IrFunc& m_func;
+    DomTree m_dom;
+    IrLoops m_loops;
+    std::unordered_map<IrValue, IrValue> m_replace;    // reduced product -> the variable replacing it
+    size_t m_changed = 0;
+};
+
+}
+
+size_t optimize_loops(IrFunc& func)
+{
+    return LoopOptimizer(func).run();
+}
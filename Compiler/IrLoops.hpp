@@ -0,0 +1,52 @@
+//
+//  IrLoops.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "Ir.hpp"
+
+// Natural loops of a function: for every block that some later block branches
+// back to (its header dominates the branch), the blocks that can reach the
+// branch without passing the header. Loops with the same header are one loop.
+class IrLoops
+{
+public:
+    static constexpr uint32_t no_loop = UINT32_MAX;
+
+    struct Loop
+    {
+        IrBlockId header;
+        IrBlockId preheader;            // only predecessor from outside, ending in a jmp to the header; or no_block
+        uint32_t parent;                // innermost enclosing loop, or no_loop
+        std::vector<IrBlockId> blocks;  // header first, then the rest in reverse postorder
+    };
+
+    IrLoops(const IrFunc& func, const DomTree& dom);
+
+    // Innermost first: a loop always comes before every loop that encloses it.
+    inline const std::vector<Loop>& loops() const { return m_loops; }
+
+    // The innermost loop around `block`, or no_loop.
+    inline uint32_t innermost(IrBlockId block) const { return m_innermost[block]; }
+
+    bool contains(uint32_t loop, IrBlockId block) const;
+
+    // True if every loop around `use` also contains `def`, so a value defined
+    // in `def` is computed afresh before each time `use` runs.
+    bool same_iteration(IrBlockId def, IrBlockId use) const;
+
+private:
+    std::vector<Loop> m_loops;
+    std::vector<uint32_t> m_innermost;
+};
+
+// Hoists loop-invariant instructions into the preheader and strength-reduces
+// multiplications of an induction variable (a header phi that every
+// iteration steps by the same invariant amount) into a second induction
+// variable stepped by the product. Returns the number of instructions hoisted
+// or reduced.
+size_t optimize_loops(IrFunc& func);
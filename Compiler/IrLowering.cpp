@@ -0,0 +1,759 @@
+//
+//  IrLowering.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "IrLowering.hpp"
+#include "IrLoops.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+// lea computes x + x * scale, so it multiplies by 3, 5 and 9.
+inline uint64_t lea_scale(uint64_t factor)
+{
+    return factor == 3 || factor == 5 || factor == 9 ? factor - 1 : 0;
+}
+
+// floor(n / d) as (high half of (n >> pre_shift) * multiplier) >> post_shift
+// for every 64-bit n, or through the add sequence when the multiplier needs
+// a 65th bit.
+struct DivMagic
+{
+    uint64_t multiplier;
+    uint8_t pre_shift;
+    uint8_t post_shift;
+    bool add;
+};
+
+// For d that is not a power of two and at most 2^63. With m = ceil(2^(64+s) / d)
+// and e = m * d - 2^(64+s), the multiply-high and shift is exact for every n
+// below 2^bits as long as e * 2^bits <= 2^(64+s). If no m fits in 64 bits, an
+// even divisor can shift the dividend right first, leaving fewer bits to cover.
+DivMagic div_magic(uint64_t d)
+{
+    using u128 = unsigned __int128;
+    int trailing = std::countr_zero(d);
+    for (int pre_shift : { 0, trailing })
+    {
+        uint64_t divisor = d >> pre_shift;
+        int bits = 64 - pre_shift;
+        int log2_ceil = 64 - std::countl_zero(divisor - 1);
+        for (int s = 0; s <= log2_ceil; s++)
+        {
+            u128 power = u128(1) << (64 + s);
+            u128 m = (power + divisor - 1) / divisor;
+            if (m >> 64 != 0)
+            {
+                break;
+            }
+            u128 e = m * divisor - power;
+            if (e << bits <= power)
+            {
+                return { static_cast<uint64_t>(m), static_cast<uint8_t>(pre_shift), static_cast<uint8_t>(s), false };
+            }
+        }
+    }
+    // s = ceil(log2(d)) always works, with a multiplier between 2^64 and 2^65.
+    int s = 64 - std::countl_zero(d - 1);
+    u128 m = ((u128(1) << (64 + s)) + d - 1) / d;
+    return { static_cast<uint64_t>(m), 0, static_cast<uint8_t>(s), true };
+}
+
+class IrLowering
+{
+public:
+    IrLowering(IrFunc func)
+        : m_func(std::move(func)) {}
+    
+    VCode lower()
+    {
+        m_split_start = m_func.blocks.size();
+        split_critical_edges();
+        count_uses();
+        m_vregs.assign(m_func.values.size(), no_value);
+        
+        std::vector<IrBlockId> layout = lay_out();
+        m_skipped.assign(m_func.blocks.size(), false);
+        // Only blocks entered by a jump need a label; the rest are fallen into.
+        std::vector<bool> labelled(m_func.blocks.size(), false);
+        for (size_t i = 0; i < layout.size(); i++)
+        {
+            IrBlockId next = i + 1 < layout.size() ? layout[i + 1] : no_block;
+            const IrTerm& term = m_func.blocks[layout[i]].term;
+            if (term.kind == IrTermKind::br && (term.target == next || term.other != next))
+            {
+                labelled[term.other] = true;
+            }
+            if ((term.kind == IrTermKind::jmp || term.kind == IrTermKind::br) && term.target != next)
+            {
+                labelled[term.target] = true;
+            }
+        }
+        
+        for (size_t i = 0; i < layout.size(); i++)
+        {
+            IrBlockId block = layout[i];
+            if (m_skipped[block])
+            {
+                continue;
+            }
+            if (labelled[block])
+            {
+                m_code.instrs.push_back({ VOp::label, VOperand::l(block) });
+            }
+            lower_block(block, i + 1 < layout.size() ? layout[i + 1] : no_block,
+                        i + 2 < layout.size() ? layout[i + 2] : no_block);
+        }
+        return std::move(m_code);
+    }
+    
+private:
+    // Reverse postorder. The loops are found here too, when there are any.
+    std::vector<IrBlockId> lay_out()
+    {
+        std::vector<IrBlockId> order = ir_reverse_postorder(m_func);
+        std::vector<uint32_t> position(m_func.blocks.size(), 0);
+        for (uint32_t i = 0; i < order.size(); i++)
+        {
+            position[order[i]] = i;
+        }
+        for (IrBlockId b : order)
+        {
+            for (IrBlockId succ : ir_successors(m_func.blocks[b]))
+            {
+                if (position[succ] <= position[b] && !m_loops)
+                {
+                    m_loops.emplace(m_func, DomTree(m_func));
+                }
+            }
+        }
+        if (m_loops)
+        {
+            m_position = std::move(position);
+            find_loop_exits();
+        }
+        return order;
+    }
+    
+    // Blocks that use a value outside the innermost loop it is defined in;
+    // a phi operand is used at the end of its predecessor.
+    void find_loop_exits()
+    {
+        auto use = [&](IrValue value, IrBlockId user) {
+            uint32_t loop = m_loops->innermost(m_func.value(value).block);
+            if (loop != IrLoops::no_loop && !m_loops->contains(loop, user))
+            {
+                m_outside_uses[value].push_back(user);
+            }
+        };
+        for (IrBlockId b = 0; b < m_func.blocks.size(); b++)
+        {
+            const IrBlock& block = m_func.blocks[b];
+            for (IrValue phi : block.phis)
+            {
+                std::span<const IrValue> args = m_func.phi_operands(m_func.value(phi));
+                for (size_t i = 0; i < args.size(); i++)
+                {
+                    use(args[i], block.preds[i]);
+                }
+            }
+            for (IrValue value : block.instrs)
+            {
+                const IrInstr& instr = m_func.value(value);
+                if (instr.op != IrOp::const_)
+                {
+                    use(instr.lhs, b);
+                    use(instr.rhs, b);
+                }
+            }
+            if (block.term.kind == IrTermKind::br || block.term.kind == IrTermKind::exit)
+            {
+                use(block.term.value, b);
+            }
+        }
+    }
+    
+    // A branch straight to a join would leave nowhere to put the join's phi
+    // copies, so such edges get an empty block of their own.
+    void split_critical_edges()
+    {
+        // Where each branch appears in its joins' predecessor lists, found in
+        // one pass so a join with thousands of arms is not searched per arm.
+        std::vector<std::vector<std::pair<IrBlockId, uint32_t>>> slots(m_func.blocks.size());
+        for (IrBlockId succ = 0; succ < m_func.blocks.size(); succ++)
+        {
+            const std::vector<IrBlockId>& preds = m_func.blocks[succ].preds;
+            for (uint32_t i = 0; preds.size() >= 2 && i < preds.size(); i++)
+            {
+                if (m_func.blocks[preds[i]].term.kind == IrTermKind::br)
+                {
+                    slots[preds[i]].emplace_back(succ, i);
+                }
+            }
+        }
+        
+        size_t count = m_func.blocks.size();
+        for (IrBlockId b = 0; b < count; b++)
+        {
+            if (m_func.blocks[b].term.kind != IrTermKind::br)
+            {
+                continue;
+            }
+            for (IrBlockId IrTerm::* side : { &IrTerm::target, &IrTerm::other })
+            {
+                IrBlockId succ = m_func.blocks[b].term.*side;
+                if (m_func.blocks[succ].preds.size() < 2)
+                {
+                    continue;
+                }
+                IrBlockId edge = static_cast<IrBlockId>(m_func.blocks.size());
+                IrBlock split;
+                split.preds.push_back(b);
+                split.term = { .kind = IrTermKind::jmp, .target = succ };
+                m_func.blocks.push_back(std::move(split));
+                m_func.blocks[b].term.*side = edge;
+                // Same position in the list, so the phi operands still line up.
+                auto slot = std::find_if(slots[b].begin(), slots[b].end(), [&](const auto& s) { return s.first == succ; });
+                m_func.blocks[succ].preds[slot->second] = edge;
+                slots[b].erase(slot);
+            }
+        }
+        
+        // After splitting every edge into a join comes from a jump.
+        m_edge.assign(m_func.blocks.size(), 0);
+        for (const IrBlock& block : m_func.blocks)
+        {
+            for (uint32_t i = 0; i < block.preds.size(); i++)
+            {
+                m_edge[block.preds[i]] = i;
+            }
+        }
+    }
+    
+    void count_uses()
+    {
+        m_uses.assign(m_func.values.size(), 0);
+        for (const IrInstr& instr : m_func.values)
+        {
+            if (instr.op != IrOp::const_ && instr.op != IrOp::phi)
+            {
+                m_uses[instr.lhs]++;
+                m_uses[instr.rhs]++;
+            }
+        }
+        for (IrValue arg : m_func.phi_args)
+        {
+            m_uses[arg]++;
+        }
+        for (const IrBlock& block : m_func.blocks)
+        {
+            if (block.term.value != no_value)
+            {
+                m_uses[block.term.value]++;
+            }
+        }
+    }
+    
+    VReg vreg(IrValue value)
+    {
+        if (m_vregs[value] == no_value)
+        {
+            m_vregs[value] = m_code.new_vreg();
+            set_owner(m_vregs[value], value);
+        }
+        return m_vregs[value];
+    }
+    
+    void take_over(IrValue value, IrValue from)
+    {
+        m_vregs[value] = vreg(from);
+        set_owner(m_vregs[value], value);
+    }
+    
+    void set_owner(VReg reg, IrValue value)
+    {
+        if (m_owner.size() <= reg)
+        {
+            m_owner.resize(reg + 1, no_value);
+        }
+        m_owner[reg] = value;
+    }
+    
+    // Constants are folded into their users as immediates.
+    VOperand operand(IrValue value)
+    {
+        const IrInstr& instr = m_func.value(value);
+        return instr.op == IrOp::const_ ? VOperand::i(instr.imm) : VOperand::v(vreg(value));
+    }
+    
+    void lower_instr(IrValue value)
+    {
+        const IrInstr& instr = m_func.value(value);
+        if (instr.op == IrOp::const_)
+        {
+            return;
+        }
+        if (is_comparison(instr.op))
+        {
+            // One that only a branch uses is left for the branch to fuse with its jump.
+            if (!feeds_branch(value))
+            {
+                Cond cond = lower_compare(value);
+                m_code.instrs.push_back({ .op = VOp::setcc, .dst = VOperand::v(vreg(value)), .cond = cond });
+            }
+            return;
+        }
+        
+        IrValue lhs = instr.lhs;
+        IrValue rhs = instr.rhs;
+        bool commutes = instr.op == IrOp::add || instr.op == IrOp::mul;
+        if (commutes && !reusable(lhs, value) && reusable(rhs, value))
+        {
+            std::swap(lhs, rhs);
+        }
+        if (instr.op == IrOp::mul && is_const(lhs) && !is_const(rhs))
+        {
+            std::swap(lhs, rhs);
+        }
+        if ((instr.op == IrOp::mul || instr.op == IrOp::div) && is_const(rhs)
+            && lower_by_constant(value, instr.op, lhs, m_func.value(rhs).imm))
+        {
+            return;
+        }
+        
+        // Two-address form overwrites the left operand, which is free to do
+        // when this is its only use; otherwise work on a copy.
+        if (reusable(lhs, value) && lhs != rhs)
+        {
+            take_over(value, lhs);
+        }
+        else
+        {
+            m_code.instrs.push_back({ VOp::mov, VOperand::v(vreg(value)), operand(lhs) });
+        }
+        
+        VOperand src = operand(rhs);
+        if (instr.op == IrOp::div && src.is_imm())
+        {
+            VReg divisor = m_code.new_vreg();
+            m_code.instrs.push_back({ VOp::mov, VOperand::v(divisor), src });
+            src = VOperand::v(divisor);
+        }
+        
+        VOp op;
+        switch (instr.op)
+        {
+            case IrOp::add: op = VOp::add; break;
+            case IrOp::sub: op = VOp::sub; break;
+            case IrOp::mul: op = VOp::mul; break;
+            case IrOp::div: op = VOp::div; break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+        m_code.instrs.push_back({ op, VOperand::v(vreg(value)), src });
+    }
+    
+    inline bool is_const(IrValue value) const
+    {
+        return m_func.value(value).op == IrOp::const_;
+    }
+    
+    // Whether `user` may take over the register of `value`: this is its only
+    // use, and not inside a loop that `value` is computed outside of, which
+    // would read it again on the next iteration.
+    inline bool reusable(IrValue value, IrValue user) const
+    {
+        return !is_const(value) && m_uses[value] == 1
+            && (!m_loops || m_loops->same_iteration(m_func.value(value).block, m_func.value(user).block));
+    }
+    
+    // Starts `value` off as a copy of `from`, or in the register of `from`
+    // itself when this is its only use.
+    VOperand copy_of(IrValue value, IrValue from)
+    {
+        if (reusable(from, value))
+        {
+            take_over(value, from);
+        }
+        else
+        {
+            m_code.instrs.push_back({ VOp::mov, VOperand::v(vreg(value)), operand(from) });
+        }
+        return VOperand::v(vreg(value));
+    }
+    
+    // True if `value` is a comparison used only as the condition of its own block's branch.
+    bool feeds_branch(IrValue value) const
+    {
+        const IrInstr& instr = m_func.value(value);
+        const IrTerm& term = m_func.blocks[instr.block].term;
+        return is_comparison(instr.op) && m_uses[value] == 1 && term.kind == IrTermKind::br && term.value == value;
+    }
+    
+    // Emits the cmp of a comparison and returns the condition under which it
+    // holds. cmp cannot take an immediate on the left, so a constant there
+    // swaps sides.
+    Cond lower_compare(IrValue value)
+    {
+        const IrInstr& instr = m_func.value(value);
+        IrValue lhs = instr.lhs;
+        IrValue rhs = instr.rhs;
+        bool swapped = is_const(lhs) && !is_const(rhs);
+        if (swapped)
+        {
+            std::swap(lhs, rhs);
+        }
+        m_code.instrs.push_back({ VOp::cmp, operand(lhs), operand(rhs) });
+        switch (instr.op)
+        {
+            case IrOp::eq: return Cond::e;
+            case IrOp::ne: return Cond::ne;
+            case IrOp::lt: return swapped ? Cond::a : Cond::b;
+            case IrOp::le: return swapped ? Cond::ae : Cond::be;
+            case IrOp::gt: return swapped ? Cond::b : Cond::a;
+            case IrOp::ge: return swapped ? Cond::be : Cond::ae;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+    
+    // Multiplication and division by a constant, where a short sequence beats
+    // the general instruction: shifts and lea for multipliers, a shift for a
+    // power of two divisor, a multiply by the reciprocal for other divisors
+    // and a compare for those above 2^63. False leaves it to the general case.
+    bool lower_by_constant(IrValue value, IrOp op, IrValue lhs, uint64_t c)
+    {
+        std::vector<VInstr>& out = m_code.instrs;
+        VOperand n = operand(lhs);
+        int shift = std::countr_zero(c);
+        if (op == IrOp::mul)
+        {
+            if (c == 0)
+            {
+                out.push_back({ VOp::mov, VOperand::v(vreg(value)), VOperand::i(0) });
+                return true;
+            }
+            uint64_t odd = c >> shift;
+            if (odd == 1)
+            {
+                VOperand dst = copy_of(value, lhs);
+                if (shift > 0)
+                    out.push_back({ VOp::shl, dst, VOperand::i(shift) });
+                return true;
+            }
+            if (lea_scale(odd) != 0)
+            {
+                VOperand dst = copy_of(value, lhs);
+                out.push_back({ VOp::lea, dst, VOperand::i(lea_scale(odd)) });
+                if (shift > 0)
+                    out.push_back({ VOp::shl, dst, VOperand::i(shift) });
+                return true;
+            }
+            // Past here a sequence is as slow as imul unless the constant is odd.
+            if (shift > 0)
+            {
+                return false;
+            }
+            for (uint64_t factor : { 3, 5, 9 })
+            {
+                if (c % factor == 0 && lea_scale(c / factor) != 0)
+                {
+                    VOperand dst = copy_of(value, lhs);
+                    out.push_back({ VOp::lea, dst, VOperand::i(lea_scale(factor)) });
+                    out.push_back({ VOp::lea, dst, VOperand::i(lea_scale(c / factor)) });
+                    return true;
+                }
+            }
+            // 2^k + 1 and 2^k - 1 read the operand again after the shift, so it
+            // always goes to a register of its own.
+            bool plus = std::has_single_bit(c - 1);
+            if (plus || std::has_single_bit(c + 1))
+            {
+                VOperand dst = VOperand::v(vreg(value));
+                out.push_back({ VOp::mov, dst, n });
+                out.push_back({ VOp::shl, dst, VOperand::i(std::countr_zero(plus ? c - 1 : c + 1)) });
+                out.push_back({ plus ? VOp::add : VOp::sub, dst, n });
+                return true;
+            }
+            return false;
+        }
+        
+        if (c == 0)
+        {
+            return false;
+        }
+        if (std::has_single_bit(c))
+        {
+            VOperand dst = copy_of(value, lhs);
+            if (shift > 0)
+                out.push_back({ VOp::shr, dst, VOperand::i(shift) });
+            return true;
+        }
+        // A quotient by anything larger is 0 or 1: whether n reaches c at all.
+        if (c > (uint64_t(1) << 63))
+        {
+            if (is_const(lhs))
+            {
+                return false;
+            }
+            out.push_back({ VOp::cmp, n, VOperand::i(c) });
+            out.push_back({ .op = VOp::setcc, .dst = VOperand::v(vreg(value)), .cond = Cond::ae });
+            return true;
+        }
+        DivMagic magic = div_magic(c);
+        if (!magic.add)
+        {
+            VOperand dst = copy_of(value, lhs);
+            if (magic.pre_shift > 0)
+                out.push_back({ VOp::shr, dst, VOperand::i(magic.pre_shift) });
+            out.push_back({ VOp::mulhi, dst, VOperand::i(magic.multiplier) });
+            if (magic.post_shift > 0)
+                out.push_back({ VOp::shr, dst, VOperand::i(magic.post_shift) });
+            return true;
+        }
+        // The multiplier needs 65 bits: q = (((n - t) >> 1) + t) >> (s - 1)
+        // with t the high half of n times its low 64 bits.
+        VOperand t = VOperand::v(m_code.new_vreg());
+        out.push_back({ VOp::mov, t, n });
+        out.push_back({ VOp::mulhi, t, VOperand::i(magic.multiplier) });
+        VOperand dst = copy_of(value, lhs);
+        out.push_back({ VOp::sub, dst, t });
+        out.push_back({ VOp::shr, dst, VOperand::i(1) });
+        out.push_back({ VOp::add, dst, t });
+        out.push_back({ VOp::shr, dst, VOperand::i(magic.post_shift - 1) });
+        return true;
+    }
+    
+    // Copies for the phis of `succ` along the edge from `block`. The copies are
+    // meant to happen at once, which matters around a loop, where one phi may
+    // read another: a copy is only made once no other pending copy still
+    // reads its destination, and if every copy left is waiting on another
+    // (a cycle) one destination is saved in a temporary first.
+    void lower_phi_copies(IrBlockId block, IrBlockId succ)
+    {
+        const IrBlock& target = m_func.blocks[succ];
+        if (target.phis.empty())
+        {
+            return;
+        }
+        size_t edge = m_edge[block];
+        
+        // Both members only to keep their storage; every count is back at zero when done.
+        std::vector<std::pair<VReg, VOperand>>& copies = m_copies;
+        std::vector<uint32_t>& readers = m_readers;
+        for (IrValue phi : target.phis)
+        {
+            VReg dst = vreg(phi);
+            VOperand src = operand(m_func.phi_operands(m_func.value(phi))[edge]);
+            if (src.is_vreg() && src.vreg() == dst)
+            {
+                continue;
+            }
+            copies.emplace_back(dst, src);
+            if (src.is_vreg())
+            {
+                if (readers.size() <= src.vreg())
+                {
+                    readers.resize(m_code.vreg_count, 0);
+                }
+                readers[src.vreg()]++;
+            }
+        }
+        
+        auto blocked = [&](VReg dst) {
+            return dst < readers.size() && readers[dst] > 0;
+        };
+        while (!copies.empty())
+        {
+            size_t left = copies.size();
+            std::erase_if(copies, [&](const std::pair<VReg, VOperand>& copy) {
+                if (blocked(copy.first))
+                {
+                    return false;
+                }
+                m_code.instrs.push_back({ VOp::mov, VOperand::v(copy.first), copy.second });
+                if (copy.second.is_vreg())
+                {
+                    readers[copy.second.vreg()]--;
+                }
+                return true;
+            });
+            if (copies.size() < left)
+            {
+                continue;
+            }
+            VReg saved = copies.front().first;
+            VReg temp = m_code.new_vreg();
+            m_code.instrs.push_back({ VOp::mov, VOperand::v(temp), VOperand::v(saved) });
+            for (auto& [dst, src] : copies)
+            {
+                if (src.is_vreg() && src.vreg() == saved)
+                {
+                    src = VOperand::v(temp);
+                }
+            }
+            readers.resize(m_code.vreg_count, 0);
+            readers[temp] = readers[saved];
+            readers[saved] = 0;
+        }
+    }
+    
+    // Whether a branch taking `term.target` back around a loop can make the
+    // copies for the loop header's phis before it branches, so the next
+    // iteration is one conditional jump away. The copies then also run when
+    // the loop is left through `term.other`, which is only right if nothing
+    // from there on reads a register they overwrite: not the value holding
+    // it last, nor the branch itself when it tests a plain value. Leaving by
+    // a break skips the copies, so uses before the exit block do not count.
+    bool copies_before_branch(IrBlockId b, const IrTerm& term)
+    {
+        if (!m_loops || term.target < m_split_start)
+        {
+            return false;
+        }
+        IrBlockId header = m_func.blocks[term.target].term.target;
+        uint32_t loop = m_loops->innermost(header);
+        if (loop == IrLoops::no_loop || m_loops->loops()[loop].header != header || !m_loops->contains(loop, b))
+        {
+            return false;
+        }
+        IrBlockId exit = term.other >= m_split_start ? m_func.blocks[term.other].term.target : term.other;
+        auto read_after_exit = [&](IrValue value) {
+            auto it = m_outside_uses.find(value);
+            if (it == m_outside_uses.end())
+            {
+                return false;
+            }
+            return std::any_of(it->second.begin(), it->second.end(), [&](IrBlockId user) {
+                return !m_loops->contains(loop, user) && (user == term.other || m_position[user] >= m_position[exit]);
+            });
+        };
+        
+        size_t back_edge = m_edge[term.target];
+        VOperand tested = feeds_branch(term.value) ? VOperand::i(0) : operand(term.value);
+        for (IrValue phi : m_func.blocks[header].phis)
+        {
+            VReg dst = vreg(phi);
+            VOperand src = operand(m_func.phi_operands(m_func.value(phi))[back_edge]);
+            if (src.is_vreg() && src.vreg() == dst)
+            {
+                continue;
+            }
+            if (read_after_exit(m_owner[dst]) || (tested.is_vreg() && tested.vreg() == dst))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    void lower_block(IrBlockId b, IrBlockId next, IrBlockId after_next)
+    {
+        const IrBlock& block = m_func.blocks[b];
+        for (IrValue value : block.instrs)
+        {
+            lower_instr(value);
+        }
+        
+        const IrTerm& term = block.term;
+        switch (term.kind)
+        {
+            case IrTermKind::jmp:
+                lower_phi_copies(b, term.target);
+                if (term.target != next)
+                {
+                    m_code.instrs.push_back({ VOp::jmp, VOperand::l(term.target) });
+                }
+                break;
+            case IrTermKind::br:
+                // Successors of a branch have a single predecessor after splitting, so no phis.
+                if (term.target == next && copies_before_branch(b, term))
+                {
+                    // Comparisons and tests set the flags and moves leave them be.
+                    IrBlockId header = m_func.blocks[term.target].term.target;
+                    if (feeds_branch(term.value))
+                    {
+                        Cond cond = lower_compare(term.value);
+                        lower_phi_copies(term.target, header);
+                        m_code.instrs.push_back({ .op = VOp::jcc, .dst = VOperand::l(header), .cond = cond });
+                    }
+                    else
+                    {
+                        VOperand value = operand(term.value);
+                        lower_phi_copies(term.target, header);
+                        m_code.instrs.push_back({ VOp::jnz, value, VOperand::l(header) });
+                    }
+                    m_skipped[term.target] = true;
+                    if (term.other != after_next)
+                    {
+                        m_code.instrs.push_back({ VOp::jmp, VOperand::l(term.other) });
+                    }
+                    break;
+                }
+                if (term.target != next && term.other == next)
+                {
+                    // Jump on the condition itself and fall through when it fails, as at the bottom of a loop.
+                    if (feeds_branch(term.value))
+                    {
+                        Cond cond = lower_compare(term.value);
+                        m_code.instrs.push_back({ .op = VOp::jcc, .dst = VOperand::l(term.target), .cond = cond });
+                    }
+                    else
+                    {
+                        m_code.instrs.push_back({ VOp::jnz, operand(term.value), VOperand::l(term.target) });
+                    }
+                    break;
+                }
+                if (feeds_branch(term.value))
+                {
+                    Cond cond = lower_compare(term.value);
+                    m_code.instrs.push_back({ .op = VOp::jcc, .dst = VOperand::l(term.other), .cond = invert(cond) });
+                }
+                else
+                {
+                    m_code.instrs.push_back({ VOp::jz, operand(term.value), VOperand::l(term.other) });
+                }
+                if (term.target != next)
+                {
+                    m_code.instrs.push_back({ VOp::jmp, VOperand::l(term.target) });
+                }
+                break;
+            case IrTermKind::exit:
+                m_code.instrs.push_back({ VOp::exit, operand(term.value) });
+                break;
+            case IrTermKind::none:
+                throw std::runtime_error("Block without terminator");
+        }
+    }
+    
+    IrFunc m_func;
+    VCode m_code;
+    std::vector<VReg> m_vregs;      // per value, no_value until first needed
+    std::vector<uint32_t> m_uses;
+    std::vector<uint32_t> m_edge;   // per block ending in a jump, its index in the target's preds
+    std::optional<IrLoops> m_loops; // these two only when the function has loops
+    std::vector<std::pair<VReg, VOperand>> m_copies;    // see lower_phi_copies()
+    std::vector<uint32_t> m_readers;
+    std::vector<uint32_t> m_position;   // per block, in reverse postorder
+    std::unordered_map<IrValue, std::vector<IrBlockId>> m_outside_uses;  // see find_loop_exits()
+    std::vector<IrValue> m_owner;   // per vreg, the value that took it last
+    std::vector<bool> m_skipped;    // blocks whose copies were made before the branch into them
+    size_t m_split_start = 0;       // blocks from here on were split off critical edges
+};
+
+}
+
+VCode lower_ir(IrFunc func)
+{
+    return IrLowering(std::move(func)).lower();
+}
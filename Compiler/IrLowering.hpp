@@ -0,0 +1,21 @@
+//
+//  IrLowering.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "Ir.hpp"
+#include "RegAlloc.hpp"
+
+// Takes a verified function out of SSA form and into two-address code for
+// allocate_registers(). Blocks are laid out in reverse postorder so that
+// every branch jumps forward except those closing a loop, which jump back to
+// its header. Phis become copies at the end of each predecessor, after
+// critical edges have been split so such a copy never runs on a path that
+// does not lead to the phi; the one exception is the branch at the bottom of
+// a loop, which makes the copies for the next iteration before it jumps back
+// when leaving the loop does not read what they overwrite.
+VCode lower_ir(IrFunc func);
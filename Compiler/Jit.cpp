@@ -0,0 +1,259 @@
+//
+//  Jit.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Jit.hpp"
+#include "Diagnostics.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#include <csetjmp>
+#include <csignal>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_SUPPORTED 1
+#endif
+
+#ifdef JIT_SUPPORTED
+
+namespace
+{
+
+constexpr int fault_signals[] = { SIGFPE, SIGSEGV, SIGBUS };
+
+// A fault at most this far below the thread's stack counts as running off its
+// end; -O1 frames are allocated in one step, so the first touch can land well
+// past the guard page.
+constexpr uintptr_t overflow_window = 64 << 20;
+
+// Set while this thread is inside generated code, so a fault there unwinds
+// back into run() instead of taking the whole compiler down.
+thread_local sigjmp_buf* t_fault_target = nullptr;
+
+// What the fault was, for run() to report once it has unwound.
+thread_local bool t_fault_overflow = false;
+
+// ThreadFaultState::stack_low(), copied where the handler can read it without
+// touching a thread_local that is constructed on first use.
+thread_local uintptr_t t_stack_low = 0;
+
+// Our handlers are only installed while some thread is inside run(); the
+// ones they replaced are put back when the last one leaves, and get every
+// fault that is not from generated code in the meantime.
+std::mutex g_handlers_mutex;
+size_t g_handler_users = 0;
+struct sigaction g_previous[std::size(fault_signals)];
+
+// Per thread: the lowest address of its stack, and a small alternate stack,
+// since a stack overflow leaves no stack to run the handler on.
+class ThreadFaultState
+{
+public:
+    ThreadFaultState()
+    {
+        m_stack_low = find_stack_low();
+        stack_t current = {};
+        if (sigaltstack(nullptr, &current) != 0 || !(current.ss_flags & SS_DISABLE))
+        {
+            // Keep one the host has already set up.
+            return;
+        }
+        m_alt_stack.resize(64 * 1024);
+        stack_t stack = {};
+        stack.ss_sp = m_alt_stack.data();
+        stack.ss_size = m_alt_stack.size();
+        m_registered = sigaltstack(&stack, nullptr) == 0;
+    }
+    
+    // The alternate stack must be unregistered before its memory goes.
+    ~ThreadFaultState()
+    {
+        if (m_registered)
+        {
+            stack_t stack = {};
+            stack.ss_flags = SS_DISABLE;
+            sigaltstack(&stack, nullptr);
+        }
+    }
+    
+    ThreadFaultState(const ThreadFaultState& other) = delete;
+    
+    ThreadFaultState operator = (const ThreadFaultState& other) = delete;
+    
+    [[nodiscard]] inline uintptr_t stack_low() const { return m_stack_low; }
+    
+private:
+    // 0 where the platform cannot tell.
+    static uintptr_t find_stack_low()
+    {
+#if defined(__linux__)
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        {
+            return 0;
+        }
+        void* addr = nullptr;
+        size_t size = 0;
+        int error = pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        return error == 0 ? reinterpret_cast<uintptr_t>(addr) : 0;
+#elif defined(__APPLE__)
+        return reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(pthread_self())) - pthread_get_stacksize_np(pthread_self());
+#else
+        return 0;
+#endif
+    }
+    
+    uintptr_t m_stack_low = 0;
+    std::vector<char> m_alt_stack;
+    bool m_registered = false;
+};
+
+ThreadFaultState& thread_fault_state()
+{
+    static thread_local ThreadFaultState state;
+    return state;
+}
+
+// Hands a fault that is not ours to whatever handled it before.
+void forward_fault(int signal, siginfo_t* info, void* context)
+{
+    size_t index = std::find(std::begin(fault_signals), std::end(fault_signals), signal) - std::begin(fault_signals);
+    const struct sigaction& previous = g_previous[index];
+    if (previous.sa_flags & SA_SIGINFO)
+    {
+        previous.sa_sigaction(signal, info, context);
+    }
+    else if (previous.sa_handler == SIG_DFL)
+    {
+        // A fault in the compiler itself: crash as usual.
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+    }
+    else if (previous.sa_handler != SIG_IGN)
+    {
+        previous.sa_handler(signal);
+    }
+}
+
+void on_fault(int signal, siginfo_t* info, void* context)
+{
+    if (t_fault_target == nullptr)
+    {
+        forward_fault(signal, info, context);
+        return;
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    t_fault_overflow = signal != SIGFPE && t_stack_low != 0
+                    && addr < t_stack_low && addr + overflow_window >= t_stack_low;
+    siglongjmp(*t_fault_target, signal);
+}
+
+void install_fault_handlers()
+{
+    std::lock_guard lock(g_handlers_mutex);
+    if (g_handler_users++ > 0)
+    {
+        return;
+    }
+    struct sigaction action = {};
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < std::size(fault_signals); i++)
+    {
+        sigaction(fault_signals[i], &action, &g_previous[i]);
+    }
+}
+
+void restore_fault_handlers()
+{
+    std::lock_guard lock(g_handlers_mutex);
+    if (--g_handler_users > 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < std::size(fault_signals); i++)
+    {
+        sigaction(fault_signals[i], &g_previous[i], nullptr);
+    }
+}
+
+} // namespace
+
+#endif
+
+JitProgram::JitProgram(const std::vector<uint8_t>& code)
+{
+#ifdef JIT_SUPPORTED
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (std::max<size_t>(code.size(), 1) + page - 1) / page * page;
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        return;
+    }
+    std::memcpy(addr, code.data(), code.size());
+    if (mprotect(addr, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(addr, size);
+        return;
+    }
+    m_code = addr;
+    m_size = size;
+#else
+    (void)code;
+#endif
+}
+
+JitProgram::~JitProgram()
+{
+#ifdef JIT_SUPPORTED
+    if (m_code)
+    {
+        munmap(m_code, m_size);
+    }
+#endif
+}
+
+uint64_t JitProgram::run() const
+{
+#ifdef JIT_SUPPORTED
+    t_stack_low = thread_fault_state().stack_low();
+    install_fault_handlers();
+    auto entry = reinterpret_cast<uint64_t (*)()>(m_code);
+    sigjmp_buf target;
+    // Saves the signal mask, so the faulting signal is unblocked again after the jump.
+    int fault = sigsetjmp(target, 1);
+    if (fault != 0)
+    {
+        t_fault_target = nullptr;
+        restore_fault_handlers();
+        if (fault == SIGFPE)
+        {
+            throw CompileError("[Runtime error] Division by zero");
+        }
+        if (t_fault_overflow)
+        {
+            throw CompileError("[Runtime error] Stack overflow");
+        }
+        throw CompileError("[Runtime error] Invalid memory access");
+    }
+    t_fault_target = &target;
+    uint64_t status = entry();
+    t_fault_target = nullptr;
+    restore_fault_handlers();
+    return status;
+#else
+    throw CompileError("[Runtime error] --run is not supported on this platform");
+#endif
+}
@@ -0,0 +1,42 @@
+//
+//  Jit.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Machine code mapped into this process as a function, for --run. The code
+// must be generated with ExitConvention::ret so that it returns the exit
+// status instead of ending the process. The pages are writable only while the
+// code is copied in and executable only after.
+class JitProgram
+{
+public:
+    JitProgram(const std::vector<uint8_t>& code);
+    
+    inline JitProgram(const JitProgram& other) = delete;
+    
+    inline JitProgram operator = (const JitProgram& other) = delete;
+    
+    ~JitProgram();
+    
+    // False where the platform cannot map executable memory, or the mapping failed.
+    [[nodiscard]] inline bool is_loaded() const { return m_code != nullptr; }
+    
+    // Calls the program and returns what it passed to exit(). A division by
+    // zero, stack overflow or other fault in the program throws a CompileError
+    // rather than killing the compiler, so other programs in the batch still
+    // run. The fault handlers are only installed for the duration of the call;
+    // faults elsewhere go to whatever handlers were there before.
+    uint64_t run() const;
+    
+private:
+    void* m_code = nullptr;
+    size_t m_size = 0;
+};
@@ -0,0 +1,196 @@
+//
+//  Optimization.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Optimization.hpp"
+
+#include <utility>
+#include <vector>
+
+static inline bool is_const(const NodeExpr& expr, uint64_t value)
+{
+    return expr.kind == NodeKind::term_int_lit && expr.value == value;
+}
+
+// Structural equality of two expression trees. Pairs still to compare wait on
+// `pending`, which the caller keeps so it is not reallocated for every call.
+static bool same_expr(const NodeProg& prog, NodeIndex a, NodeIndex b, std::vector<std::pair<NodeIndex, NodeIndex>>& pending)
+{
+    pending.clear();
+    pending.push_back({ a, b });
+    while (!pending.empty())
+    {
+        auto [left, right] = pending.back();
+        pending.pop_back();
+        const NodeExpr& lhs = prog.expr(left);
+        const NodeExpr& rhs = prog.expr(right);
+        if (lhs.kind != rhs.kind)
+        {
+            return false;
+        }
+        switch (lhs.kind)
+        {
+            case NodeKind::term_int_lit:
+                if (lhs.value != rhs.value)
+                    return false;
+                break;
+            case NodeKind::term_ident:
+                if (lhs.name != rhs.name)
+                    return false;
+                break;
+            case NodeKind::bin_expr:
+                if (lhs.op != rhs.op)
+                    return false;
+                pending.push_back({ lhs.rhs, rhs.rhs });
+                pending.push_back({ lhs.lhs, rhs.lhs });
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static inline NodeExpr int_lit(uint64_t value)
+{
+    return { .kind = NodeKind::term_int_lit, .value = value };
+}
+
+size_t fold_constants(NodeProg& prog)
+{
+    size_t folded = 0;
+    std::vector<std::pair<NodeIndex, NodeIndex>> pending;
+    // Per expression: whether evaluating it can divide by zero. Such an
+    // operand is never dropped by an identity, so the program traps at
+    // runtime exactly where -O0 would.
+    std::vector<bool> may_trap(prog.exprs.size(), false);
+    // Operands precede their users, so one forward pass folds bottom-up.
+    for (NodeIndex index = 0; index < prog.exprs.size(); index++)
+    {
+        NodeExpr& expr = prog.exprs[index];
+        if (expr.kind != NodeKind::bin_expr)
+        {
+            continue;
+        }
+        const NodeExpr lhs = prog.expr(expr.lhs);
+        const NodeExpr rhs = prog.expr(expr.rhs);
+        bool keep_lhs = may_trap[expr.lhs];
+        bool keep_rhs = may_trap[expr.rhs];
+        
+        std::optional<NodeExpr> result;
+        if (expr.op == BinOp::div && is_const(rhs, 0))
+        {
+            // Left to trap at runtime, as it does without optimization.
+        }
+        else if (lhs.kind == NodeKind::term_int_lit && rhs.kind == NodeKind::term_int_lit)
+        {
+            // Same unsigned 64-bit semantics as the emitted add/sub/mul/div.
+            switch (expr.op)
+            {
+                case BinOp::add:
+                    result = int_lit(lhs.value + rhs.value);
+                    break;
+                case BinOp::sub:
+                    result = int_lit(lhs.value - rhs.value);
+                    break;
+                case BinOp::mul:
+                    result = int_lit(lhs.value * rhs.value);
+                    break;
+                case BinOp::div:
+                    result = int_lit(lhs.value / rhs.value);
+                    break;
+                case BinOp::eq:
+                    result = int_lit(lhs.value == rhs.value);
+                    break;
+                case BinOp::ne:
+                    result = int_lit(lhs.value != rhs.value);
+                    break;
+                case BinOp::lt:
+                    result = int_lit(lhs.value < rhs.value);
+                    break;
+                case BinOp::le:
+                    result = int_lit(lhs.value <= rhs.value);
+                    break;
+                case BinOp::gt:
+                    result = int_lit(lhs.value > rhs.value);
+                    break;
+                case BinOp::ge:
+                    result = int_lit(lhs.value >= rhs.value);
+                    break;
+                case BinOp::log_and:
+                    result = int_lit(lhs.value != 0 && rhs.value != 0);
+                    break;
+                case BinOp::log_or:
+                    result = int_lit(lhs.value != 0 || rhs.value != 0);
+                    break;
+            }
+        }
+        else
+        {
+            switch (expr.op)
+            {
+                case BinOp::add:
+                    if (is_const(rhs, 0))
+                        result = lhs;
+                    else if (is_const(lhs, 0))
+                        result = rhs;
+                    break;
+                case BinOp::sub:
+                    if (is_const(rhs, 0))
+                        result = lhs;
+                    else if (!keep_lhs && same_expr(prog, expr.lhs, expr.rhs, pending))
+                        result = int_lit(0);
+                    break;
+                case BinOp::mul:
+                    if (is_const(rhs, 1))
+                        result = lhs;
+                    else if (is_const(lhs, 1))
+                        result = rhs;
+                    else if ((is_const(rhs, 0) && !keep_lhs) || (is_const(lhs, 0) && !keep_rhs))
+                        result = int_lit(0);
+                    break;
+                case BinOp::div:
+                    if (is_const(rhs, 1))
+                        result = lhs;
+                    break;
+                case BinOp::eq:
+                case BinOp::le:
+                case BinOp::ge:
+                    if (!keep_lhs && same_expr(prog, expr.lhs, expr.rhs, pending))
+                        result = int_lit(1);
+                    break;
+                case BinOp::ne:
+                case BinOp::lt:
+                case BinOp::gt:
+                    if (!keep_lhs && same_expr(prog, expr.lhs, expr.rhs, pending))
+                        result = int_lit(0);
+                    break;
+                // A constant left operand decides these without the right one.
+                case BinOp::log_and:
+                    if (is_const(lhs, 0))
+                        result = int_lit(0);
+                    break;
+                case BinOp::log_or:
+                    if (lhs.kind == NodeKind::term_int_lit && lhs.value != 0)
+                        result = int_lit(1);
+                    break;
+            }
+        }
+        
+        if (result.has_value())
+        {
+            expr = result.value();
+            folded++;
+        }
+        if (expr.kind == NodeKind::bin_expr)
+        {
+            const NodeExpr& divisor = prog.expr(expr.rhs);
+            bool safe_divisor = divisor.kind == NodeKind::term_int_lit && divisor.value != 0;
+            may_trap[index] = may_trap[expr.lhs] || may_trap[expr.rhs] || (expr.op == BinOp::div && !safe_divisor);
+        }
+    }
+    return folded;
+}
@@ -0,0 +1,20 @@
+//
+//  Optimization.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "Parser.hpp"
+
+// AST-level passes run between parsing and code generation.
+
+// Folds constant subexpressions and applies algebraic identities
+// (x + 0, x - 0, x * 1, x / 1, x * 0, x - x, x == x and the like, and && or ||
+// with a constant left operand) in place. A division by zero is left to trap
+// at runtime, and no identity drops an operand that could divide by zero, so
+// a program fails the same way at every optimization level. Returns the
+// number of expressions rewritten.
+size_t fold_constants(NodeProg& prog);
@@ -0,0 +1,158 @@
+//
+//  Output.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Output.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static constexpr size_t max_chunk_size = 16 * 1024 * 1024;
+
+OutputBuffer::OutputBuffer(size_t size_hint)
+    : m_next_size(std::clamp<size_t>(size_hint, 4096, max_chunk_size))
+{
+    new_chunk(0);
+}
+
+void OutputBuffer::new_chunk(size_t min_size)
+{
+    size_t capacity = std::max(m_next_size, min_size);
+    m_chunks.push_back({ std::make_unique<char[]>(capacity), capacity });
+    m_cur = m_chunks.back().data.get();
+    m_end = m_cur + capacity;
+    m_next_size = std::min(capacity * 2, max_chunk_size);
+}
+
+void OutputBuffer::append_slow(const char* data, size_t size)
+{
+    // Fill what is left of this chunk so chunks stay densely packed for writev.
+    size_t room = static_cast<size_t>(m_end - m_cur);
+    std::memcpy(m_cur, data, room);
+    m_cur += room;
+    // A new chunk is only started once the current one is completely full,
+    // which is what chunk_used() relies on.
+    new_chunk(size - room);
+    std::memcpy(m_cur, data + room, size - room);
+    m_cur += size - room;
+}
+
+void OutputBuffer::append_uint(uint64_t value)
+{
+    char buf[20];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    append(std::string_view(buf, end - buf));
+}
+
+void OutputBuffer::append_int(int64_t value)
+{
+    char buf[21];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    append(std::string_view(buf, end - buf));
+}
+
+size_t OutputBuffer::size() const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < m_chunks.size(); i++)
+    {
+        total += chunk_used(i);
+    }
+    return total;
+}
+
+std::string OutputBuffer::str() const
+{
+    std::string result;
+    result.reserve(size());
+    for (size_t i = 0; i < m_chunks.size(); i++)
+    {
+        result.append(m_chunks[i].data.get(), chunk_used(i));
+    }
+    return result;
+}
+
+static bool write_all(int fd, std::vector<iovec> iov)
+{
+    size_t first = 0;
+    while (first < iov.size())
+    {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        ssize_t written = writev(fd, iov.data() + first, count);
+        if (written < 0)
+        {
+            return false;
+        }
+        // Skip whatever was fully written and trim a partially written entry.
+        size_t left = static_cast<size_t>(written);
+        while (first < iov.size() && left >= iov[first].iov_len)
+        {
+            left -= iov[first].iov_len;
+            first++;
+        }
+        if (first < iov.size())
+        {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// A regular file is written under a temporary name beside it and renamed over
+// it, so nobody sees it half written and two writers of one path cannot
+// interleave. Anything else (a device, a FIFO, a symlink) is written in place.
+static bool replace_file(const std::string& path, bool executable, std::vector<iovec> iov)
+{
+    static std::atomic<unsigned> temp_count { 0 };
+    mode_t mode = executable ? 0755 : 0644;
+    struct stat status;
+    bool in_place = lstat(path.c_str(), &status) == 0 && !S_ISREG(status.st_mode);
+    std::string temp = in_place ? path : path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(temp_count++);
+    int fd = in_place ? open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode) : open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, mode);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = write_all(fd, std::move(iov));
+    ok = close(fd) == 0 && ok;
+    if (in_place)
+    {
+        return ok;
+    }
+    if (!ok || std::rename(temp.c_str(), path.c_str()) != 0)
+    {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool OutputBuffer::write_to(const std::string& path, bool executable) const
+{
+    std::vector<iovec> iov;
+    iov.reserve(m_chunks.size());
+    for (size_t i = 0; i < m_chunks.size(); i++)
+    {
+        if (chunk_used(i) > 0)
+        {
+            iov.push_back({ m_chunks[i].data.get(), chunk_used(i) });
+        }
+    }
+    return replace_file(path, executable, std::move(iov));
+}
+
+bool write_file(const std::string& path, const void* data, size_t size, bool executable)
+{
+    return replace_file(path, executable, { { const_cast<void*>(data), size } });
+}
@@ -0,0 +1,84 @@
+//
+//  Output.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Append-only text buffer for code emission. Text is copied into large chunks
+// that are never reallocated, integers are formatted with to_chars, and the
+// whole thing is written out with one writev() per batch of chunks.
+class OutputBuffer
+{
+public:
+    // `size_hint` sizes the first chunk; later chunks double up to a cap.
+    OutputBuffer(size_t size_hint = 64 * 1024);
+    
+    inline void append(std::string_view text)
+    {
+        if (static_cast<size_t>(m_end - m_cur) >= text.size())
+        {
+            std::memcpy(m_cur, text.data(), text.size());
+            m_cur += text.size();
+            return;
+        }
+        append_slow(text.data(), text.size());
+    }
+    
+    inline void append(char c)
+    {
+        if (m_cur == m_end)
+        {
+            new_chunk(1);
+        }
+        *m_cur++ = c;
+    }
+    
+    inline void append_bytes(const void* data, size_t size)
+    {
+        append(std::string_view(static_cast<const char*>(data), size));
+    }
+    
+    void append_uint(uint64_t value);
+    void append_int(int64_t value);
+    
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] std::string str() const;
+    
+    // Replaces `path` with the buffer's contents, atomically when it is a
+    // regular file or does not exist yet; false on any I/O error.
+    bool write_to(const std::string& path, bool executable = false) const;
+    
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+    };
+    
+    void append_slow(const char* data, size_t size);
+    void new_chunk(size_t min_size);
+    
+    // Bytes used in chunk `index`; only the last chunk is partially filled.
+    inline size_t chunk_used(size_t index) const
+    {
+        return index + 1 == m_chunks.size() ? static_cast<size_t>(m_cur - m_chunks[index].data.get()) : m_chunks[index].capacity;
+    }
+    
+    std::vector<Chunk> m_chunks;
+    char* m_cur = nullptr;
+    char* m_end = nullptr;
+    size_t m_next_size;
+};
+
+// Writes a single block to `path`, replacing it as write_to() does.
+bool write_file(const std::string& path, const void* data, size_t size, bool executable = false);
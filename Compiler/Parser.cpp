@@ -6,219 +6,314 @@
 //
 
 #include "Parser.hpp"
+#include "Diagnostics.hpp"
 
 std::optional<int> bin_prec(TokenType type)
 {
     switch (type) 
     {
+        case TokenType::pipe_pipe:
+            return 0;
+        case TokenType::amp_amp:
+            return 1;
+        case TokenType::eq_eq:
+        case TokenType::bang_eq:
+            return 2;
+        case TokenType::lt:
+        case TokenType::lt_eq:
+        case TokenType::gt:
+        case TokenType::gt_eq:
+            return 3;
         case TokenType::plus:
         case TokenType::minus:
-            return 0;
+            return 4;
         case TokenType::star:
         case TokenType::fslash:
-            return 1;
+            return 5;
         default:
             return {};
     }
 }
 
-Parser::Parser(std::vector<Token> tokens)
-    : m_tokens(std::move(tokens)), m_allocator(4 * 1024 * 1024) {}
-
-std::optional<NodeTerm*> Parser::parse_term()
+BinOp bin_op(TokenType type)
 {
-    if (auto int_lit = try_consume(TokenType::int_lit))
+    switch (type)
     {
-        auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
-        term_int_lit->int_lit = int_lit.value();
-        auto term = m_allocator.alloc<NodeTerm>();
-        term->var = term_int_lit;
-        return term;
+        case TokenType::plus:
+            return BinOp::add;
+        case TokenType::minus:
+            return BinOp::sub;
+        case TokenType::star:
+            return BinOp::mul;
+        case TokenType::fslash:
+            return BinOp::div;
+        case TokenType::eq_eq:
+            return BinOp::eq;
+        case TokenType::bang_eq:
+            return BinOp::ne;
+        case TokenType::lt:
+            return BinOp::lt;
+        case TokenType::lt_eq:
+            return BinOp::le;
+        case TokenType::gt:
+            return BinOp::gt;
+        case TokenType::gt_eq:
+            return BinOp::ge;
+        case TokenType::amp_amp:
+            return BinOp::log_and;
+        case TokenType::pipe_pipe:
+            return BinOp::log_or;
+        default:
+            throw std::runtime_error("Unreachable");
     }
-    if (auto ident = try_consume(TokenType::ident))
+}
+
+std::span<const NodeIndex> ExprWalk::postorder(const NodeProg& prog, NodeIndex root)
+{
+    m_order.clear();
+    m_stack.clear();
+    m_stack.push_back({ root, false });
+    while (!m_stack.empty())
     {
-        auto term_ident = m_allocator.alloc<NodeTermIdent>();
-        term_ident->ident = ident.value();
-        auto term = m_allocator.alloc<NodeTerm>();
-        term->var = term_ident;
-        return term;
+        auto [index, expanded] = m_stack.back();
+        m_stack.pop_back();
+        const NodeExpr& expr = prog.expr(index);
+        if (expanded || expr.kind != NodeKind::bin_expr)
+        {
+            m_order.push_back(index);
+            continue;
+        }
+        // The operand pushed last is visited first.
+        m_stack.push_back({ index, true });
+        m_stack.push_back({ expr.rhs, false });
+        m_stack.push_back({ expr.lhs, false });
     }
-    if (auto open_paren = try_consume(TokenType::open_paren))
+    return m_order;
+}
+
+Parser::Parser(Tokenizer& tokenizer)
+    : m_tokenizer(tokenizer) {}
+
+std::optional<NodeIndex> Parser::parse_term()
+{
+    if (auto int_lit = try_consume(TokenType::int_lit))
     {
-        auto expr = parse_expr();
-        if (!expr.has_value())
+        if (int_lit->out_of_range)
         {
-            error_expected("expression");
+            throw CompileError("[Parser error] Integer literal out of range on line " + std::to_string(int_lit->line));
         }
-        try_consume_err(TokenType::close_paren);
-        auto term_paren = m_allocator.alloc<NodeTermParen>();
-        term_paren->expr = expr.value();
-        auto term = m_allocator.alloc<NodeTerm>();
-        term->var = term_paren;
-        return term;
+        return add_expr({ .kind = NodeKind::term_int_lit, .value = int_lit->int_value });
     }
-    else
+    if (auto ident = try_consume(TokenType::ident))
     {
-        return {};
+        return add_expr({ .kind = NodeKind::term_ident, .name = ident->symbol });
     }
+    return {};
 }
 
-std::optional<NodeExpr*> Parser::parse_expr(int min_prec)
+// Shunting-yard: terms go straight into the pool, operators wait on m_ops
+// until one that binds no tighter (or a closing parenthesis) arrives. Nodes
+// come out in the same order as a recursive descent would create them.
+std::optional<NodeIndex> Parser::parse_expr()
 {
-    std::optional<NodeTerm*> term_lhs = parse_term();
-    if (!term_lhs.has_value())
-    {
-        return {};
-    }
-    
-    auto expr_lhs = m_allocator.alloc<NodeExpr>();
-    expr_lhs->var = term_lhs.value();
-    
+    m_ops.clear();
+    m_operands.clear();
+    size_t open_parens = 0;
+    bool want_operand = true;
     while (true)
     {
-        std::optional<Token> curr_tok = peek();
-        std::optional<int> prec;
-        if (curr_tok.has_value())
+        if (want_operand)
         {
-            prec = bin_prec(curr_tok->type);
-            if (!prec.has_value() || prec < min_prec)
+            if (try_consume(TokenType::open_paren))
             {
-                break;
+                m_ops.push_back(TokenType::open_paren);
+                open_parens++;
+                continue;
             }
+            std::optional<NodeIndex> term = parse_term();
+            if (!term.has_value())
+            {
+                if (m_ops.empty() && m_operands.empty())
+                {
+                    return {};
+                }
+                error_expected("expression");
+            }
+            m_operands.push_back(term.value());
+            want_operand = false;
+            continue;
         }
-        else
-        {
-            break;
-        }
-        
-        Token op = consume();
-        int next_min_prec = prec.value() + 1;
-        auto expr_rhs = parse_expr(next_min_prec);
-        
-        if (!expr_rhs.has_value())
-        {
-            error_expected("expression");
-        }
-        
-        auto expr = m_allocator.alloc<NodeBinExpr>();
-        auto expr_lhs2 = m_allocator.alloc<NodeExpr>();
         
-        if (op.type == TokenType::plus)
+        const Token* curr_tok = peek();
+        if (curr_tok && curr_tok->type == TokenType::close_paren && open_parens > 0)
         {
-            auto add = m_allocator.alloc<NodeBinExprAdd>();
-            expr_lhs2->var = expr_lhs->var;
-            add->lhs = expr_lhs2;
-            add->rhs = expr_rhs.value();
-            expr->var = add;
-            
-        }
-        else if (op.type == TokenType::star)
-        {
-            auto multi = m_allocator.alloc<NodeBinExprMulti>();
-            expr_lhs2->var = expr_lhs->var;
-            multi->lhs = expr_lhs2;
-            multi->rhs = expr_rhs.value();
-            expr->var = multi;
+            consume();
+            while (m_ops.back() != TokenType::open_paren)
+            {
+                reduce();
+            }
+            m_ops.pop_back();
+            open_parens--;
+            continue;
         }
-        else if (op.type == TokenType::minus)
+        std::optional<int> prec = curr_tok ? bin_prec(curr_tok->type) : std::nullopt;
+        if (!prec.has_value())
         {
-            auto minus = m_allocator.alloc<NodeBinExprSub>();
-            expr_lhs2->var = expr_lhs->var;
-            minus->lhs = expr_lhs2;
-            minus->rhs = expr_rhs.value();
-            expr->var = minus;
+            break;
         }
-        else if (op.type == TokenType::fslash)
+        // All operators are left-associative, so equal precedence reduces too.
+        while (!m_ops.empty() && m_ops.back() != TokenType::open_paren && bin_prec(m_ops.back()).value() >= prec.value())
         {
-            auto fslash = m_allocator.alloc<NodeBinExprDiv>();
-            expr_lhs2->var = expr_lhs->var;
-            fslash->lhs = expr_lhs2;
-            fslash->rhs = expr_rhs.value();
-            expr->var = fslash;
+            reduce();
         }
-        else
-        {
-            throw std::runtime_error("Unreachable");
-        }
-        expr_lhs->var = expr;
+        m_ops.push_back(consume().type);
+        want_operand = true;
+    }
+    
+    if (open_parens > 0)
+    {
+        error_expected(to_string(TokenType::close_paren));
     }
-    return expr_lhs;
+    while (!m_ops.empty())
+    {
+        reduce();
+    }
+    return m_operands.back();
 }
 
-std::optional<NodeScope*> Parser::parse_scope()
+void Parser::reduce()
 {
-    if (!try_consume(TokenType::open_curly))
+    TokenType op = m_ops.back();
+    m_ops.pop_back();
+    NodeIndex rhs = m_operands.back();
+    m_operands.pop_back();
+    m_operands.back() = add_expr({ .kind = NodeKind::bin_expr, .op = bin_op(op), .lhs = m_operands.back(), .rhs = rhs });
+}
+
+void Parser::add_to_scope(NodeIndex stmt)
+{
+    if (m_blocks.empty())
     {
-        return {};
+        m_prog.stmts.push_back(stmt);
     }
-    
-    auto scope = m_allocator.alloc<NodeScope>();
-    while (auto stmt = parse_stmt())
+    else
     {
-        scope->stmts.push_back(stmt.value());
+        m_scope_stack.push_back(stmt);
     }
-    try_consume_err(TokenType::close_curly);
-    return scope;
 }
 
-std::optional<NodeIfPred*> Parser::parse_if_pred()
+void Parser::open_block(const NodeStmt& arm, NodeIndex chain, NodeIndex prev)
+{
+    m_blocks.push_back({ .base = m_scope_stack.size(), .arm = arm, .chain = chain, .prev = prev });
+}
+
+// Parses the condition (for if, elif and while) and the `{` of one arm of an
+// if chain or of a loop. Its body is then parsed as the innermost open block.
+void Parser::open_arm(NodeKind kind, NodeIndex chain, NodeIndex prev)
 {
-    if (try_consume(TokenType::elif))
+    NodeStmt arm { .kind = kind, .scope = no_node, .pred = no_node };
+    if (kind != NodeKind::if_pred_else)
     {
         try_consume_err(TokenType::open_paren);
-        auto elif = m_allocator.alloc<NodeIfPredElif>();
         if (auto expr = parse_expr())
         {
-            elif->expr = expr.value();
+            arm.expr = expr.value();
         }
         else
         {
             error_expected("expression");
         }
         try_consume_err(TokenType::close_paren);
-        if (auto scope = parse_scope())
-        {
-            elif->scope = scope.value();
-        }
-        else
-        {
-            error_expected("statement");
-        }
-        elif->pred = parse_if_pred();
-        auto pred = m_allocator.alloc<NodeIfPred>();
-        pred->var = elif;
-        return pred;
     }
-    if (try_consume(TokenType::else_))
+    if (!try_consume(TokenType::open_curly))
+    {
+        error_expected("statement");
+    }
+    open_block(arm, chain, prev);
+}
+
+// Called once the `}` of the innermost block has been consumed.
+void Parser::close_block()
+{
+    OpenBlock block = m_blocks.back();
+    m_blocks.pop_back();
+    
+    NodeStmt scope {
+        .kind = NodeKind::scope,
+        .first = static_cast<NodeIndex>(m_prog.stmt_lists.size()),
+        .count = static_cast<NodeIndex>(m_scope_stack.size() - block.base)
+    };
+    m_prog.stmt_lists.insert(m_prog.stmt_lists.end(), m_scope_stack.begin() + block.base, m_scope_stack.end());
+    m_scope_stack.resize(block.base);
+    NodeIndex scope_index = add_stmt(scope);
+    if (block.arm.kind == NodeKind::scope)
+    {
+        add_to_scope(scope_index);
+        return;
+    }
+    if (block.arm.kind == NodeKind::stmt_while)
+    {
+        NodeStmt loop = block.arm;
+        loop.scope = scope_index;
+        loop.pred = no_node;
+        m_open_loops--;
+        add_to_scope(add_stmt(loop));
+        return;
+    }
+    
+    // Each arm is added as soon as its body is complete and linked from the
+    // one before it, so an elif chain of any length needs no stack at all.
+    NodeStmt arm = block.arm;
+    arm.scope = scope_index;
+    arm.pred = no_node;
+    NodeIndex index = add_stmt(arm);
+    if (block.prev != no_node)
     {
-        auto else_ = m_allocator.alloc<NodeIfPredElse>();
-        if (auto scope = parse_scope())
+        m_prog.stmt_pool[block.prev].pred = index;
+    }
+    NodeIndex chain = block.chain == no_node ? index : block.chain;
+    if (arm.kind != NodeKind::if_pred_else)
+    {
+        if (try_consume(TokenType::elif))
         {
-            else_->scope = scope.value();
+            open_arm(NodeKind::if_pred_elif, chain, index);
+            return;
         }
-        else
+        if (try_consume(TokenType::else_))
         {
-            error_expected("statement");
+            open_arm(NodeKind::if_pred_else, chain, index);
+            return;
         }
-        auto pred = m_allocator.alloc<NodeIfPred>();
-        pred->var = else_;
-        return pred;
     }
-    return {};
+    add_to_scope(chain);
 }
 
-std::optional<NodeStmt*> Parser::parse_stmt()
+// `break;` or `continue;`, whose keyword has been consumed. Both belong to
+// the innermost enclosing while.
+void Parser::add_jump(NodeKind kind, const Token& keyword)
 {
-    if (peek().has_value() && peek().value().type == TokenType::exit && peek(1).has_value()
-        && peek(1).value().type == TokenType::open_paren) //exit
+    if (m_open_loops == 0)
+    {
+        throw CompileError("[Parser error] " + to_string(keyword.type) + " outside of a loop on line " + std::to_string(keyword.line));
+    }
+    try_consume_err(TokenType::semi);
+    add_to_scope(add_stmt({ .kind = kind, .scope = no_node, .pred = no_node }));
+}
+
+// Parses one statement. Simple statements are added to the innermost open
+// block; `{`, `if` and `while` open a block of their own. False if no statement starts here.
+bool Parser::parse_stmt()
+{
+    if (peek() && peek()->type == TokenType::exit && peek(1)
+        && peek(1)->type == TokenType::open_paren) //exit
     {
         consume();
         consume();
         
-        auto stmt_exit = m_allocator.alloc<NodeStmtExit>();
+        NodeStmt stmt_exit { .kind = NodeKind::stmt_exit, .scope = no_node, .pred = no_node };
         if (auto node_expr = parse_expr())
         {
-            stmt_exit->expr = node_expr.value();
+            stmt_exit.expr = node_expr.value();
         }
         else
         {
@@ -227,43 +322,37 @@ std::optional<NodeStmt*> Parser::parse_stmt()
         try_consume_err(TokenType::close_paren);
         try_consume_err(TokenType::semi);
 
-        auto stmt = m_allocator.alloc<NodeStmt>();
-        stmt->var = stmt_exit;
-        return stmt;
+        add_to_scope(add_stmt(stmt_exit));
+        return true;
     }
-    if (peek().has_value() && peek().value().type == TokenType::let
-             && peek(1).has_value() && peek(1).value().type == TokenType::ident
-             && peek(2).has_value() && peek(2).value().type == TokenType::eq) //let
+    if (peek() && peek()->type == TokenType::let
+             && peek(1) && peek(1)->type == TokenType::ident
+             && peek(2) && peek(2)->type == TokenType::eq) //let
     {
         consume();
-        auto stmt_let = m_allocator.alloc<NodeStmtLet>();
-        stmt_let->ident = consume();
+        NodeStmt stmt_let { .kind = NodeKind::stmt_let, .name = consume().symbol, .pred = no_node };
         consume();
         if (auto expr = parse_expr())
         {
-            stmt_let->expr = expr.value();
+            stmt_let.expr = expr.value();
         }
         else
         {
             error_expected("expression");
-            //std::cerr << "Invalid variable expression" << std::endl;
         }
        
         try_consume_err(TokenType::semi);
 
-        auto stmt = m_allocator.alloc<NodeStmt>();
-        stmt->var = stmt_let;
-        
-        return stmt;
+        add_to_scope(add_stmt(stmt_let));
+        return true;
     }
-    if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value() && peek(1).value().type == TokenType::eq)
+    if (peek() && peek()->type == TokenType::ident && peek(1) && peek(1)->type == TokenType::eq)
     {
-        auto assign = m_allocator.alloc<NodeStmtAsign>();
-        assign->ident = consume();
+        NodeStmt assign { .kind = NodeKind::stmt_asign, .name = consume().symbol, .pred = no_node };
         consume();
         if (auto expr = parse_expr())
         {
-            assign->expr = expr.value();
+            assign.expr = expr.value();
         }
         else
         {
@@ -271,91 +360,112 @@ std::optional<NodeStmt*> Parser::parse_stmt()
         }
         try_consume_err(TokenType::semi);
         
-        auto stmt = m_allocator.alloc<NodeStmt>();
-        stmt->var = assign;
-        return stmt;
+        add_to_scope(add_stmt(assign));
+        return true;
     }
-    if (peek().has_value() && peek().value().type == TokenType::open_curly)
+    if (try_consume(TokenType::open_curly))
     {
-        if (auto scope = parse_scope())
-        {
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = scope.value();
-            return stmt;
-        }
-        else
-        {
-            error_expected("scope");
-        }
+        open_block({ .kind = NodeKind::scope, .first = 0, .count = 0 });
+        return true;
     }
-    if (auto if_ = try_consume(TokenType::if_))
+    if (try_consume(TokenType::if_))
     {
-        try_consume_err(TokenType::open_paren);
-        auto stmt_if = m_allocator.alloc<NodeStmtIf>();
-        if (auto expr = parse_expr())
+        open_arm(NodeKind::stmt_if, no_node, no_node);
+        return true;
+    }
+    if (try_consume(TokenType::while_))
+    {
+        open_arm(NodeKind::stmt_while, no_node, no_node);
+        m_open_loops++;
+        return true;
+    }
+    if (auto keyword = try_consume(TokenType::break_))
+    {
+        add_jump(NodeKind::stmt_break, keyword.value());
+        return true;
+    }
+    if (auto keyword = try_consume(TokenType::continue_))
+    {
+        add_jump(NodeKind::stmt_continue, keyword.value());
+        return true;
+    }
+    return false;
+}
+
+std::optional<NodeProg> Parser::parse_prog()
+{
+    while (true)
+    {
+        if (!m_blocks.empty() && try_consume(TokenType::close_curly))
         {
-            stmt_if->expr = expr.value();
+            close_block();
+            continue;
         }
-        else
+        if (parse_stmt())
         {
-            error_expected("expression");
+            continue;
         }
-        try_consume_err(TokenType::close_paren);
-        if (auto scope = parse_scope())
+        if (!m_blocks.empty())
         {
-            stmt_if->scope = scope.value();
+            error_expected(to_string(TokenType::close_curly));
         }
-        else
+        if (peek())
         {
             error_expected("statement");
         }
-        stmt_if->pred = parse_if_pred();
-        
-        auto stmt = m_allocator.alloc<NodeStmt>();
-        stmt->var = stmt_if;
-        return stmt;
+        break;
     }
-    return {};
+    m_prog.interner = &m_tokenizer.interner();
+    m_prog.symbol_count = m_tokenizer.interner().size();
+    return std::move(m_prog);
 }
 
-std::optional<NodeProg> Parser::parse_prog()
+NodeIndex Parser::add_expr(const NodeExpr& expr)
+{
+    m_prog.exprs.push_back(expr);
+    m_prog.expr_lines.push_back(m_last_line);
+    return static_cast<NodeIndex>(m_prog.exprs.size() - 1);
+}
+
+NodeIndex Parser::add_stmt(const NodeStmt& stmt)
+{
+    m_prog.stmt_pool.push_back(stmt);
+    return static_cast<NodeIndex>(m_prog.stmt_pool.size() - 1);
+}
+
+const Token* Parser::peek(int offset)
 {
-    NodeProg prog;
-    while (peek().has_value())
+    while (m_count <= static_cast<size_t>(offset) && !m_exhausted)
     {
-        if (auto stmt = parse_stmt())
+        if (m_tokenizer.next(m_ring[(m_head + m_count) & (ring_size - 1)]))
         {
-            prog.stmts.push_back(stmt.value());
+            m_count++;
         }
         else
         {
-            error_expected("statement");
+            m_exhausted = true;
         }
     }
-    m_index = 0;
-    return prog;
-}
-
-std::optional<Token> Parser::peek(int offset) const
-{
-    if (m_index + offset >= m_tokens.size())
-    {
-        return {};
-    }
-    else
+    if (static_cast<size_t>(offset) >= m_count)
     {
-        return m_tokens.at(m_index + offset);
+        return nullptr;
     }
+    return &m_ring[(m_head + offset) & (ring_size - 1)];
 }
 
 Token Parser::consume()
 {
-    return m_tokens.at(m_index++);
+    peek();
+    Token token = m_ring[m_head];
+    m_head = (m_head + 1) & (ring_size - 1);
+    m_count--;
+    m_last_line = token.line;
+    return token;
 }
 
 Token Parser::try_consume_err(TokenType type)
 {
-    if (peek().has_value() && peek().value().type == type)
+    if (peek() && peek()->type == type)
     {
         return consume();
     }
@@ -368,7 +478,7 @@ Token Parser::try_consume_err(TokenType type)
 
 std::optional<Token> Parser::try_consume(TokenType type)
 {
-    if (peek().has_value() && peek().value().type == type)
+    if (peek() && peek()->type == type)
     {
         return consume();
     }
@@ -380,6 +490,5 @@ std::optional<Token> Parser::try_consume(TokenType type)
 
 const void Parser::error_expected(const std::string& msg)
 {
-    std::cerr << "[Parser error] Expected " << msg << " on line " << peek(-1).value().line << std::endl;
-    exit(1);
+    throw CompileError("[Parser error] Expected " + msg + " on line " + std::to_string(m_last_line));
 }
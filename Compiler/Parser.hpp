@@ -7,141 +7,165 @@
 
 #pragma once
 
-#include "Arena.hpp"
+#include "SymbolTable.hpp"
 #include "Tokenization.hpp"
-#include <variant>
-
-struct NodeTermIntLit
-{
-    Token int_lit;
-};
-
-struct NodeTermIdent
-{
-    Token ident;
-};
-
-struct NodeExpr;
-
-struct NodeBinExprAdd
-{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-struct NodeBinExprSub
-{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprMulti
-{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprDiv
-{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeTermParen
-{
-    NodeExpr* expr;
-};
-
-struct NodeBinExpr
-{
-    std::variant<NodeBinExprAdd*, NodeBinExprMulti*, NodeBinExprSub*, NodeBinExprDiv*> var;
-};
-
-struct NodeTerm
-{
-    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*> var;
-};
+#include <array>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+// The AST is a flat pool: expressions and statements live in two contiguous
+// arrays inside NodeProg and refer to each other by 32-bit index. A whole tree
+// is therefore a handful of vectors that can be copied or written out as-is.
+// An expression's operands always sit at lower indices than the expression
+// itself, so a forward walk over NodeProg::exprs visits operands first.
+
+using NodeIndex = uint32_t;
+
+static constexpr NodeIndex no_node = UINT32_MAX;
+
+enum class NodeKind : uint8_t
+{
+    // Expressions, stored in NodeProg::exprs
+    term_int_lit,
+    term_ident,
+    bin_expr,
+    // Statements, stored in NodeProg::stmt_pool
+    stmt_exit,
+    stmt_let,
+    stmt_asign,
+    scope,
+    stmt_if,
+    if_pred_elif,
+    if_pred_else,
+    stmt_while,
+    stmt_break,
+    stmt_continue
+};
+
+enum class BinOp : uint8_t
+{
+    add,
+    sub,
+    mul,
+    div,
+    // Comparisons are unsigned and give 0 or 1.
+    eq,
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+    // Short-circuit: the right operand is only evaluated when it decides the result.
+    log_and,
+    log_or
+};
+
+inline bool is_comparison(BinOp op)
+{
+    return op >= BinOp::eq && op <= BinOp::ge;
+}
+
+inline bool is_logical(BinOp op)
+{
+    return op == BinOp::log_and || op == BinOp::log_or;
+}
 
 struct NodeExpr
 {
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-};
-
-struct NodeStmtLet
-{
-    Token ident;
-    NodeExpr* expr;
-};
-
-struct NodeStmtExit
-{
-    NodeExpr* expr;
-};
-
-struct NodeStmt;
-
-struct NodeScope
-{
-    std::vector<NodeStmt*> stmts;
-};
-
-struct NodeIfPred;
-
-struct NodeStmtIf
-{
-    NodeExpr* expr;
-    NodeScope* scope;
-    std::optional<NodeIfPred*> pred;
-};
-
-struct NodeIfPredElif
-{
-    NodeExpr* expr;
-    NodeScope* scope;
-    std::optional<NodeIfPred*> pred;
-};
-
-struct NodeIfPredElse
-{
-    NodeScope* scope;
-};
-
-struct NodeIfPred
-{
-    std::variant<NodeIfPredElif*, NodeIfPredElse*> var;
+    NodeKind kind;
+    BinOp op {};            // bin_expr
+    NodeIndex lhs = no_node;    // bin_expr
+    union
+    {
+        NodeIndex rhs;      // bin_expr
+        Symbol name;        // term_ident
+        uint64_t value;     // term_int_lit
+    };
 };
 
-struct NodeStmtAsign
+struct NodeStmt
 {
-    Token ident;
-    NodeExpr* expr;
+    NodeKind kind;
+    NodeIndex expr = no_node;   // exit, let, asign, if, elif, while
+    union
+    {
+        Symbol name;        // let, asign
+        NodeIndex scope;    // if, elif, else, while: a scope statement
+        NodeIndex first;    // scope: start of its run in NodeProg::stmt_lists
+    };
+    union
+    {
+        NodeIndex pred;     // if, elif: the following elif/else, or no_node; while: no_node
+        NodeIndex count;    // scope: number of statements
+    };
 };
 
-struct NodeStmt
+struct NodeProg
 {
-    std::variant<NodeStmtExit*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAsign*> var;
+    std::vector<NodeIndex> stmts;       // top-level statements
+    std::vector<NodeExpr> exprs;
+    std::vector<int> expr_lines;        // source line of each expression
+    std::vector<NodeStmt> stmt_pool;
+    std::vector<NodeIndex> stmt_lists;  // children of every scope, back to back
+    const Interner* interner = nullptr; // the Tokenizer's, for the text of each Symbol
+    size_t symbol_count = 0;            // every Symbol in the tree is below this
+    
+    inline const NodeExpr& expr(NodeIndex index) const { return exprs[index]; }
+    inline const NodeStmt& stmt(NodeIndex index) const { return stmt_pool[index]; }
+    
+    inline std::span<const NodeIndex> scope_stmts(const NodeStmt& scope) const
+    {
+        return { stmt_lists.data() + scope.first, scope.count };
+    }
 };
 
-struct NodeProg
+// Post-order over one expression tree with an explicit stack: operands come
+// before the expression that uses them, however deep the tree is. Keeping one
+// around reuses its buffers from one expression to the next.
+class ExprWalk
 {
-    std::vector<NodeStmt*> stmts;
+public:
+    // The nodes under `root`, the left operand's subtree first.
+    std::span<const NodeIndex> postorder(const NodeProg& prog, NodeIndex root);
+    
+private:
+    std::vector<std::pair<NodeIndex, bool>> m_stack;    // (node, operands already pushed)
+    std::vector<NodeIndex> m_order;
 };
 
 class Parser
 {
 public:
-    Parser(std::vector<Token> tokens);
+    Parser(Tokenizer& tokenizer);
     
-    std::optional<NodeTerm*> parse_term();
-    std::optional<NodeBinExpr*> parse_bin_expr();
-    std::optional<NodeExpr*> parse_expr(int min_prec = 0);
-    std::optional<NodeStmt*> parse_stmt();
-    std::optional<NodeScope*> parse_scope();
-    std::optional<NodeIfPred*> parse_if_pred();
-
+    // Nothing here recurses: expressions go through an explicit operator
+    // stack and open blocks through m_blocks, so nesting depth is limited by
+    // memory rather than by the call stack.
+    std::optional<NodeIndex> parse_expr();
     std::optional<NodeProg> parse_prog();
 
 private:
-    std::optional<Token> peek(int offset = 0) const;
+    // A `{` not closed yet, and the statement it is the body of.
+    struct OpenBlock
+    {
+        size_t base;            // start of its statements in m_scope_stack
+        NodeStmt arm;           // if, elif, else or while being built; kind == scope for a bare block
+        NodeIndex chain;        // the if statement heading the arm's chain
+        NodeIndex prev;         // the arm before this one, whose pred this arm becomes
+    };
+    
+    std::optional<NodeIndex> parse_term();
+    bool parse_stmt();
+    void open_block(const NodeStmt& arm, NodeIndex chain = no_node, NodeIndex prev = no_node);
+    void close_block();
+    void open_arm(NodeKind kind, NodeIndex chain, NodeIndex prev);
+    void reduce();
+    void add_to_scope(NodeIndex stmt);
+    void add_jump(NodeKind kind, const Token& keyword);
+    
+    // Tokens are pulled from the Tokenizer on demand; nullptr past the end.
+    const Token* peek(int offset = 0);
     
     Token consume();
     Token try_consume_err(TokenType type);
@@ -149,8 +173,29 @@ private:
     
     [[noreturn]] const void error_expected(const std::string& msg);
     
-    const std::vector<Token> m_tokens;
-    size_t m_index = 0;
+    NodeIndex add_expr(const NodeExpr& expr);
+    NodeIndex add_stmt(const NodeStmt& stmt);
+    
+    // Lookahead window. parse_stmt needs at most three tokens (`let ident =`).
+    static constexpr size_t max_lookahead = 3;
+    static constexpr size_t ring_size = 4;
+    static_assert(ring_size >= max_lookahead && (ring_size & (ring_size - 1)) == 0);
+    
+    Tokenizer& m_tokenizer;
+    std::array<Token, ring_size> m_ring {};
+    size_t m_head = 0;
+    size_t m_count = 0;
+    bool m_exhausted = false;
+    int m_last_line = 1;
     
-    ArenaAllocator m_allocator;
+    NodeProg m_prog;
+    // Statements of the scopes currently open, innermost last. A scope's run is
+    // moved into NodeProg::stmt_lists when it closes, so each stays contiguous.
+    std::vector<NodeIndex> m_scope_stack;
+    std::vector<OpenBlock> m_blocks;
+    size_t m_open_loops = 0;    // while bodies among m_blocks
+    // Shunting-yard state for parse_expr: pending operators (open_paren marks
+    // a parenthesis) and the operands built so far.
+    std::vector<TokenType> m_ops;
+    std::vector<NodeIndex> m_operands;
 };
@@ -0,0 +1,400 @@
+//
+//  Peephole.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Peephole.hpp"
+
+#include <initializer_list>
+
+// Whether `operand` reads `reg`, either as the register itself or in a memory address.
+static inline bool mentions(const Operand& operand, Reg reg)
+{
+    return ((operand.is_reg() || operand.is_mem()) && operand.reg == reg)
+        || (operand.is_mem() && operand.scale != 0 && operand.index == reg);
+}
+
+// Whether `operand` is memory addressed through `reg`.
+static inline bool addresses(const Operand& operand, Reg reg)
+{
+    return operand.is_mem() && mentions(operand, reg);
+}
+
+// Labels, branches, returns and system calls end the straight-line region a pattern may reason about.
+static inline bool is_barrier(const Instr& instr)
+{
+    return instr.op == Op::label || instr.op == Op::jmp || instr.op == Op::jz || instr.op == Op::jcc || instr.op == Op::syscall || instr.op == Op::ret;
+}
+
+static bool reads(const Instr& instr, Reg reg)
+{
+    switch (instr.op)
+    {
+        case Op::mov:
+            return mentions(instr.src, reg) || addresses(instr.dst, reg);
+        case Op::push:
+            return reg == Reg::rsp || mentions(instr.dst, reg);
+        case Op::pop:
+            return reg == Reg::rsp || addresses(instr.dst, reg);
+        case Op::xor_:
+            if (instr.dst == instr.src)
+                return false;   // zeroing idiom
+            return mentions(instr.dst, reg) || mentions(instr.src, reg);
+        case Op::imul:
+            if (instr.src2.kind != Operand::Kind::none)
+                return mentions(instr.src, reg) || addresses(instr.dst, reg);
+            return mentions(instr.dst, reg) || mentions(instr.src, reg);
+        case Op::lea:
+        case Op::movzx:
+            return mentions(instr.src, reg) || addresses(instr.dst, reg);
+        case Op::setcc:
+            // Only the low byte is written, so the rest of the register lives on.
+            return mentions(instr.dst, reg);
+        case Op::add:
+        case Op::sub:
+        case Op::shl:
+        case Op::shr:
+        case Op::test:
+        case Op::cmp:
+            return mentions(instr.dst, reg) || mentions(instr.src, reg);
+        case Op::mul:
+            return reg == Reg::rax || mentions(instr.dst, reg);
+        case Op::div:
+            return reg == Reg::rax || reg == Reg::rdx || mentions(instr.dst, reg);
+        case Op::jz:
+        case Op::jcc:
+        case Op::jmp:
+        case Op::label:
+        case Op::syscall:
+        case Op::ret:
+            return true;
+    }
+    return true;
+}
+
+static bool writes(const Instr& instr, Reg reg)
+{
+    switch (instr.op)
+    {
+        case Op::mov:
+        case Op::add:
+        case Op::sub:
+        case Op::xor_:
+        case Op::imul:
+        case Op::shl:
+        case Op::shr:
+        case Op::lea:
+        case Op::movzx:
+        case Op::setcc:
+            return instr.dst.is_reg(reg);
+        case Op::push:
+        case Op::ret:
+            return reg == Reg::rsp;
+        case Op::pop:
+            return reg == Reg::rsp || instr.dst.is_reg(reg);
+        case Op::mul:
+        case Op::div:
+            return reg == Reg::rax || reg == Reg::rdx;
+        case Op::syscall:
+            return reg == Reg::rax || reg == Reg::rcx || reg == Reg::r11;
+        case Op::test:
+        case Op::cmp:
+        case Op::jz:
+        case Op::jcc:
+        case Op::jmp:
+        case Op::label:
+            return false;
+    }
+    return true;
+}
+
+namespace {
+
+// Output built so far plus the input still to come. Patterns look at the last
+// few instructions of the output and may peek at what follows.
+class Window
+{
+public:
+    Window(const std::vector<Instr>& in)
+        : m_in(in)
+    {
+        m_out.reserve(in.size());
+    }
+    
+    // The k-th instruction of a window of `size` at the end of the output.
+    inline Instr& at(size_t size, size_t k) { return m_out[m_out.size() - size + k]; }
+    
+    inline size_t size() const { return m_out.size(); }
+    
+    // Replaces the last `count` instructions.
+    void replace(size_t count, std::initializer_list<Instr> with)
+    {
+        m_out.resize(m_out.size() - count);
+        m_out.insert(m_out.end(), with.begin(), with.end());
+    }
+    
+    // The first instruction after the output, if any.
+    inline const Instr* following() const
+    {
+        return m_next < m_in.size() ? &m_in[m_next] : nullptr;
+    }
+    
+    // True if `reg` is overwritten before it is read again, looking past the
+    // window but not past a label or branch.
+    bool dead_after_output(Reg reg) const
+    {
+        static constexpr size_t max_scan = 32;
+        for (size_t i = m_next; i < m_in.size() && i < m_next + max_scan; i++)
+        {
+            const Instr& instr = m_in[i];
+            if (is_barrier(instr) || reads(instr, reg))
+            {
+                return false;
+            }
+            if (writes(instr, reg))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    inline void push(const Instr& instr) { m_out.push_back(instr); }
+    inline void advance() { m_next++; }
+    inline std::vector<Instr> take() { return std::move(m_out); }
+    
+private:
+    const std::vector<Instr>& m_in;
+    std::vector<Instr> m_out;
+    size_t m_next = 0;
+};
+
+using Rule = bool (*)(Window& w);
+
+struct Pattern
+{
+    const char* name;
+    size_t window;
+    Rule apply;
+};
+
+inline bool is_rsp_adjust(const Instr& instr)
+{
+    return (instr.op == Op::add || instr.op == Op::sub) && instr.dst.is_reg(Reg::rsp) && instr.src.is_imm();
+}
+
+// Instructions that do nothing but set flags can only go if nothing tests the flags next.
+inline bool flags_unused(const Window& w)
+{
+    const Instr* next = w.following();
+    return !next || (next->op != Op::jz && next->op != Op::jcc && next->op != Op::setcc);
+}
+
+// True if `instr` can be moved across a push or pop: no stack access, no rsp and no control flow.
+inline bool stack_independent(const Instr& instr)
+{
+    return !is_barrier(instr) && instr.op != Op::push && instr.op != Op::pop
+        && !mentions(instr.dst, Reg::rsp) && !mentions(instr.src, Reg::rsp) && !mentions(instr.src2, Reg::rsp);
+}
+
+// push X; pop X  =>  (nothing)
+bool push_pop_same(Window& w)
+{
+    Instr& push = w.at(2, 0);
+    Instr& pop = w.at(2, 1);
+    if (push.op != Op::push || pop.op != Op::pop || !pop.dst.is_reg() || push.dst != pop.dst)
+        return false;
+    w.replace(2, {});
+    return true;
+}
+
+// push X; pop R  =>  mov R, X
+bool push_pop_move(Window& w)
+{
+    Instr push = w.at(2, 0);
+    Instr pop = w.at(2, 1);
+    if (push.op != Op::push || pop.op != Op::pop || !pop.dst.is_reg() || push.dst.is_imm())
+        return false;
+    w.replace(2, { { Op::mov, pop.dst, push.dst } });
+    return true;
+}
+
+// push X; I; pop R  =>  mov R, X; I   when I neither touches the stack nor R
+bool push_op_pop(Window& w)
+{
+    Instr push = w.at(3, 0);
+    Instr mid = w.at(3, 1);
+    Instr pop = w.at(3, 2);
+    if (push.op != Op::push || pop.op != Op::pop || !pop.dst.is_reg() || push.dst.is_imm())
+        return false;
+    Reg reg = pop.dst.reg;
+    if (!stack_independent(mid) || reads(mid, reg) || writes(mid, reg))
+        return false;
+    w.replace(3, { { Op::mov, pop.dst, push.dst }, mid });
+    return true;
+}
+
+// push X; add rsp, 8n  =>  add rsp, 8(n - 1)
+bool push_then_drop(Window& w)
+{
+    Instr& push = w.at(2, 0);
+    Instr add = w.at(2, 1);
+    if (push.op != Op::push || add.op != Op::add || !add.dst.is_reg(Reg::rsp) || !add.src.is_imm() || add.src.imm < 8)
+        return false;
+    w.replace(2, { { Op::add, add.dst, Operand::i(add.src.imm - 8) } });
+    return true;
+}
+
+// add rsp, 0  =>  (nothing)
+bool zero_adjust(Window& w)
+{
+    Instr& instr = w.at(1, 0);
+    if (!is_rsp_adjust(instr) || instr.src.imm != 0 || !flags_unused(w))
+        return false;
+    w.replace(1, {});
+    return true;
+}
+
+// add rsp, a; add rsp, b  =>  add rsp, a + b
+bool merge_adjust(Window& w)
+{
+    Instr first = w.at(2, 0);
+    Instr second = w.at(2, 1);
+    if (!is_rsp_adjust(first) || !is_rsp_adjust(second) || first.op != second.op)
+        return false;
+    uint64_t total = first.src.imm + second.src.imm;
+    if (!fits_imm32(total))
+        return false;
+    w.replace(2, { { first.op, first.dst, Operand::i(total) } });
+    return true;
+}
+
+// mov R, R  =>  (nothing)
+bool self_move(Window& w)
+{
+    Instr& instr = w.at(1, 0);
+    if (instr.op != Op::mov || !instr.dst.is_reg() || instr.dst != instr.src)
+        return false;
+    w.replace(1, {});
+    return true;
+}
+
+// mov R, A; mov S, R  =>  mov S, A   when R is dead afterwards
+bool forward_move(Window& w)
+{
+    Instr first = w.at(2, 0);
+    Instr second = w.at(2, 1);
+    if (first.op != Op::mov || second.op != Op::mov || !first.dst.is_reg() || !second.src.is_reg(first.dst.reg))
+        return false;
+    Reg reg = first.dst.reg;
+    if (second.dst.is_reg(reg) || mentions(second.dst, reg) || !w.dead_after_output(reg))
+        return false;
+    if (second.dst.is_mem() && (first.src.is_mem() || (first.src.is_imm() && !fits_imm32(first.src.imm))))
+        return false;
+    w.replace(2, { { Op::mov, second.dst, first.src } });
+    return true;
+}
+
+// mov R, A; I  =>  I   when I overwrites R without reading it
+bool dead_move(Window& w)
+{
+    Instr first = w.at(2, 0);
+    Instr second = w.at(2, 1);
+    if (first.op != Op::mov || !first.dst.is_reg() || is_barrier(second))
+        return false;
+    Reg reg = first.dst.reg;
+    if (reads(second, reg) || !writes(second, reg))
+        return false;
+    w.replace(2, { second });
+    return true;
+}
+
+// jmp L; label L  =>  label L
+bool jump_to_next(Window& w)
+{
+    Instr jump = w.at(2, 0);
+    Instr label = w.at(2, 1);
+    if ((jump.op != Op::jmp && jump.op != Op::jz && jump.op != Op::jcc) || label.op != Op::label || jump.dst != label.dst)
+        return false;
+    w.replace(2, { label });
+    return true;
+}
+
+// test X, X; label L  =>  label L   (left behind once its jz is gone)
+bool dead_test(Window& w)
+{
+    Instr test = w.at(2, 0);
+    Instr label = w.at(2, 1);
+    if ((test.op != Op::test && test.op != Op::cmp) || label.op != Op::label)
+        return false;
+    w.replace(2, { label });
+    return true;
+}
+
+// jmp L; I  =>  jmp L   when I is not a label, so nothing can reach it (likewise after ret)
+bool unreachable(Window& w)
+{
+    Instr jump = w.at(2, 0);
+    Instr& next = w.at(2, 1);
+    if ((jump.op != Op::jmp && jump.op != Op::ret) || next.op == Op::label)
+        return false;
+    w.replace(2, { jump });
+    return true;
+}
+
+constexpr Pattern patterns[] = {
+    { "push/pop same register", 2, push_pop_same },
+    { "push/pop to move", 2, push_pop_move },
+    { "push/op/pop to move", 3, push_op_pop },
+    { "push then drop", 2, push_then_drop },
+    { "zero stack adjustment", 1, zero_adjust },
+    { "merge stack adjustments", 2, merge_adjust },
+    { "self move", 1, self_move },
+    { "forward move", 2, forward_move },
+    { "dead move", 2, dead_move },
+    { "jump to next", 2, jump_to_next },
+    { "dead test", 2, dead_test },
+    { "unreachable", 2, unreachable },
+};
+
+// Tries every pattern against the end of the output; true if one fired.
+bool rewrite_tail(Window& w)
+{
+    for (const Pattern& pattern : patterns)
+    {
+        if (w.size() >= pattern.window && pattern.apply(w))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+size_t peephole(std::vector<Instr>& code)
+{
+    size_t total = 0;
+    while (true)
+    {
+        size_t rewrites = 0;
+        Window window(code);
+        for (const Instr& instr : code)
+        {
+            window.push(instr);
+            window.advance();
+            while (rewrite_tail(window))
+            {
+                rewrites++;
+            }
+        }
+        code = window.take();
+        total += rewrites;
+        if (rewrites == 0)
+        {
+            return total;
+        }
+    }
+}
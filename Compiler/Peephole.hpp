@@ -0,0 +1,18 @@
+//
+//  Peephole.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "X86.hpp"
+
+// Rewrites short redundant sequences in final machine code: push/pop pairs,
+// moves through a register that dies straight after, empty stack
+// adjustments, jumps to the next instruction and code after a jmp. Patterns
+// are matched against a window sliding over the output and re-tried after
+// every rewrite, with whole passes repeated until nothing changes. Returns
+// the number of rewrites made.
+size_t peephole(std::vector<Instr>& code);
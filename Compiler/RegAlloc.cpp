@@ -0,0 +1,469 @@
+//
+//  RegAlloc.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "RegAlloc.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+static constexpr Reg allocatable[] = {
+    Reg::rbx, Reg::rcx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9, Reg::r10,
+    Reg::r11, Reg::r12, Reg::r13, Reg::r14, Reg::r15, Reg::rbp
+};
+
+struct Interval
+{
+    VReg vreg;
+    uint32_t start;
+    uint32_t end;
+    uint32_t uses;
+    
+    // Lower is a better spill candidate: long-lived, rarely used values.
+    inline double weight() const { return static_cast<double>(uses) / (end - start + 1); }
+};
+
+struct Location
+{
+    bool in_reg = false;
+    Reg reg = Reg::rax;
+    int32_t slot = -1;
+};
+
+static inline const VOperand* jump_target(const VInstr& instr)
+{
+    switch (instr.op)
+    {
+        case VOp::jmp:
+        case VOp::jcc:
+            return &instr.dst;
+        case VOp::jz:
+        case VOp::jnz:
+            return &instr.src;
+        default:
+            return nullptr;
+    }
+}
+
+// An interval with start < label <= end for some backward jump to `label`
+// is live into that loop and must last until the jump. Loops are not always
+// laid out contiguously, so reaching one jump can bring the interval up to
+// another loop's label; it is extended until that stops happening. The
+// furthest jump back to any label in a range is a range maximum over the
+// backward jumps sorted by label, answered from a sparse table.
+static void extend_over_loops(const VCode& code, std::vector<Interval>& intervals)
+{
+    // Labels are block numbers, and a jump back comes after its label.
+    std::vector<uint32_t> label_pos;
+    std::vector<std::pair<uint32_t, uint32_t>> back_jumps;     // (label position, jump position)
+    for (uint32_t pos = 0; pos < code.instrs.size(); pos++)
+    {
+        const VInstr& instr = code.instrs[pos];
+        if (instr.op == VOp::label)
+        {
+            if (label_pos.size() <= instr.dst.value)
+            {
+                label_pos.resize(instr.dst.value + 1, UINT32_MAX);
+            }
+            label_pos[instr.dst.value] = pos;
+            continue;
+        }
+        const VOperand* target = jump_target(instr);
+        if (target && target->value < label_pos.size() && label_pos[target->value] != UINT32_MAX)
+        {
+            back_jumps.emplace_back(label_pos[target->value], pos);
+        }
+    }
+    if (back_jumps.empty())
+    {
+        return;
+    }
+    std::sort(back_jumps.begin(), back_jumps.end());
+    
+    // furthest[k][i]: the latest jump among back_jumps[i, i + 2^k).
+    size_t count = back_jumps.size();
+    std::vector<std::vector<uint32_t>> furthest(1, std::vector<uint32_t>(count));
+    for (size_t i = 0; i < count; i++)
+    {
+        furthest[0][i] = back_jumps[i].second;
+    }
+    for (size_t k = 1; (size_t(1) << k) <= count; k++)
+    {
+        const std::vector<uint32_t>& prev = furthest[k - 1];
+        std::vector<uint32_t> level(count - (size_t(1) << k) + 1);
+        for (size_t i = 0; i < level.size(); i++)
+        {
+            level[i] = std::max(prev[i], prev[i + (size_t(1) << (k - 1))]);
+        }
+        furthest.push_back(std::move(level));
+    }
+    auto furthest_jump = [&](uint32_t after, uint32_t upto) -> uint32_t {
+        auto first = std::upper_bound(back_jumps.begin(), back_jumps.end(), std::make_pair(after, UINT32_MAX));
+        auto last = std::upper_bound(back_jumps.begin(), back_jumps.end(), std::make_pair(upto, UINT32_MAX));
+        if (first >= last)
+        {
+            return 0;
+        }
+        size_t lo = first - back_jumps.begin();
+        size_t len = last - first;
+        size_t k = std::bit_width(len) - 1;
+        return std::max(furthest[k][lo], furthest[k][lo + len - (size_t(1) << k)]);
+    };
+    
+    for (Interval& interval : intervals)
+    {
+        while (true)
+        {
+            uint32_t jump = furthest_jump(interval.start, interval.end);
+            if (jump <= interval.end)
+            {
+                break;
+            }
+            interval.end = jump;
+        }
+    }
+}
+
+static std::vector<Interval> build_intervals(const VCode& code)
+{
+    std::vector<Interval> intervals(code.vreg_count, { 0, UINT32_MAX, 0, 0 });
+    for (uint32_t pos = 0; pos < code.instrs.size(); pos++)
+    {
+        const VInstr& instr = code.instrs[pos];
+        for (const VOperand* operand : { &instr.dst, &instr.src })
+        {
+            if (!operand->is_vreg())
+                continue;
+            Interval& interval = intervals[operand->vreg()];
+            interval.vreg = operand->vreg();
+            interval.start = std::min(interval.start, pos);
+            interval.end = pos;
+            interval.uses++;
+        }
+    }
+    std::erase_if(intervals, [](const Interval& interval) { return interval.uses == 0; });
+    extend_over_loops(code, intervals);
+    std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) { return a.start < b.start; });
+    return intervals;
+}
+
+static std::vector<Location> linear_scan(const std::vector<Interval>& intervals, VReg vreg_count, int32_t& slot_count)
+{
+    std::vector<Location> locations(vreg_count);
+    std::vector<Reg> free_regs(std::rbegin(allocatable), std::rend(allocatable));
+    std::vector<const Interval*> active;
+    std::vector<const Interval*> spilled;
+    
+    for (const Interval& cur : intervals)
+    {
+        // An interval ending here can hand its register to one starting here,
+        // since reads happen before the write within an instruction.
+        std::erase_if(active, [&](const Interval* interval) {
+            if (interval->end <= cur.start)
+            {
+                free_regs.push_back(locations[interval->vreg].reg);
+                return true;
+            }
+            return false;
+        });
+        
+        if (!free_regs.empty())
+        {
+            locations[cur.vreg] = { .in_reg = true, .reg = free_regs.back() };
+            free_regs.pop_back();
+            active.push_back(&cur);
+            continue;
+        }
+        
+        auto victim = std::min_element(active.begin(), active.end(), [](const Interval* a, const Interval* b) {
+            return a->weight() < b->weight();
+        });
+        if ((*victim)->weight() < cur.weight())
+        {
+            locations[cur.vreg] = { .in_reg = true, .reg = locations[(*victim)->vreg].reg };
+            locations[(*victim)->vreg].in_reg = false;
+            spilled.push_back(*victim);
+            *victim = &cur;
+        }
+        else
+        {
+            spilled.push_back(&cur);
+        }
+    }
+    
+    // Spilled values share stack slots when their lifetimes do not overlap.
+    std::sort(spilled.begin(), spilled.end(), [](const Interval* a, const Interval* b) { return a->start < b->start; });
+    std::vector<std::pair<uint32_t, int32_t>> slot_ends;   // (end, slot)
+    std::vector<int32_t> free_slots;
+    slot_count = 0;
+    for (const Interval* interval : spilled)
+    {
+        std::erase_if(slot_ends, [&](const std::pair<uint32_t, int32_t>& used) {
+            if (used.first < interval->start)
+            {
+                free_slots.push_back(used.second);
+                return true;
+            }
+            return false;
+        });
+        int32_t slot;
+        if (free_slots.empty())
+        {
+            slot = slot_count++;
+        }
+        else
+        {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        locations[interval->vreg].slot = slot;
+        slot_ends.push_back({ interval->end, slot });
+    }
+    return locations;
+}
+
+class Rewriter
+{
+public:
+    Rewriter(const std::vector<Location>& locations, ExitConvention exit)
+        : m_locations(locations), m_exit(exit) {}
+    
+    std::vector<Instr> rewrite(const VCode& code, int32_t slot_count)
+    {
+        m_frame_bytes = static_cast<uint64_t>(slot_count) * 8;
+        if (m_exit == ExitConvention::ret)
+        {
+            append_entry(m_code);
+        }
+        if (slot_count > 0)
+        {
+            emit(Op::sub, Operand::r(Reg::rsp), Operand::i(static_cast<uint64_t>(slot_count) * 8));
+        }
+        for (const VInstr& instr : code.instrs)
+        {
+            rewrite(instr);
+        }
+        return std::move(m_code);
+    }
+    
+private:
+    Operand operand(const VOperand& operand) const
+    {
+        switch (operand.kind)
+        {
+            case VOperand::Kind::vreg:
+            {
+                const Location& loc = m_locations[operand.vreg()];
+                return loc.in_reg ? Operand::r(loc.reg) : Operand::m(Reg::rsp, loc.slot * 8);
+            }
+            case VOperand::Kind::imm:
+                return Operand::i(operand.value);
+            case VOperand::Kind::label:
+                return Operand::l(static_cast<uint32_t>(operand.value));
+            case VOperand::Kind::none:
+                return {};
+        }
+        return {};
+    }
+    
+    void emit(Op op, Operand dst = {}, Operand src = {}, Operand src2 = {})
+    {
+        m_code.push_back({ op, dst, src, src2 });
+    }
+    
+    // Makes `src` usable alongside `dst` in one instruction, going through rax
+    // when both would be memory or the immediate does not fit in 32 bits.
+    Operand legalize_src(const Operand& dst, Operand src)
+    {
+        if ((src.is_imm() && !fits_imm32(src.imm)) || (src.is_mem() && dst.is_mem()))
+        {
+            emit(Op::mov, Operand::r(Reg::rax), src);
+            return Operand::r(Reg::rax);
+        }
+        return src;
+    }
+    
+    void rewrite(const VInstr& instr)
+    {
+        Operand dst = operand(instr.dst);
+        Operand src = operand(instr.src);
+        switch (instr.op)
+        {
+            case VOp::mov:
+                if (dst == src)
+                    break;
+                if (src.is_imm() && !fits_imm32(src.imm) && dst.is_reg())
+                    emit(Op::mov, dst, src);
+                else
+                    emit(Op::mov, dst, legalize_src(dst, src));
+                break;
+            case VOp::add:
+                emit(Op::add, dst, legalize_src(dst, src));
+                break;
+            case VOp::sub:
+                emit(Op::sub, dst, legalize_src(dst, src));
+                break;
+            case VOp::mul:
+            {
+                // Two-operand imul gives the same low 64 bits as mul without
+                // tying up rax and rdx.
+                Operand target = dst;
+                if (dst.is_mem())
+                {
+                    emit(Op::mov, Operand::r(Reg::rax), dst);
+                    target = Operand::r(Reg::rax);
+                }
+                if (src.is_imm() && fits_imm32(src.imm))
+                {
+                    emit(Op::imul, target, target, src);
+                }
+                else if (src.is_imm())
+                {
+                    emit(Op::mov, Operand::r(Reg::rdx), src);
+                    emit(Op::imul, target, Operand::r(Reg::rdx));
+                }
+                else
+                {
+                    emit(Op::imul, target, src);
+                }
+                if (dst.is_mem())
+                {
+                    emit(Op::mov, dst, Operand::r(Reg::rax));
+                }
+                break;
+            }
+            case VOp::div:
+                if (src.is_imm())
+                {
+                    throw std::runtime_error("Divisor must be in a register or memory");
+                }
+                emit(Op::mov, Operand::r(Reg::rax), dst);
+                emit(Op::xor_, Operand::r(Reg::rdx), Operand::r(Reg::rdx));
+                emit(Op::div, src);
+                emit(Op::mov, dst, Operand::r(Reg::rax));
+                break;
+            case VOp::mulhi:
+                // mul leaves the high half in rdx.
+                emit(Op::mov, Operand::r(Reg::rax), src);
+                emit(Op::mul, dst);
+                emit(Op::mov, dst, Operand::r(Reg::rdx));
+                break;
+            case VOp::shl:
+                emit(Op::shl, dst, src);
+                break;
+            case VOp::shr:
+                emit(Op::shr, dst, src);
+                break;
+            case VOp::lea:
+            {
+                Reg target = dst.is_reg() ? dst.reg : Reg::rax;
+                if (dst.is_mem())
+                {
+                    emit(Op::mov, Operand::r(Reg::rax), dst);
+                }
+                emit(Op::lea, Operand::r(target), Operand::m(target, target, static_cast<uint8_t>(src.imm)));
+                if (dst.is_mem())
+                {
+                    emit(Op::mov, dst, Operand::r(Reg::rax));
+                }
+                break;
+            }
+            case VOp::cmp:
+            {
+                // Only the right side of cmp can be an immediate, and only a 32-bit one.
+                Operand lhs = dst;
+                if (lhs.is_imm())
+                {
+                    emit(Op::mov, Operand::r(Reg::rax), lhs);
+                    lhs = Operand::r(Reg::rax);
+                }
+                Operand rhs = src;
+                if ((rhs.is_imm() && !fits_imm32(rhs.imm)) || (rhs.is_mem() && lhs.is_mem()))
+                {
+                    emit(Op::mov, Operand::r(Reg::rdx), rhs);
+                    rhs = Operand::r(Reg::rdx);
+                }
+                emit(Op::cmp, lhs, rhs);
+                break;
+            }
+            case VOp::setcc:
+            {
+                // setcc writes a byte; the zero-extension cannot be xor beforehand, which would clobber the flags.
+                Operand target = dst.is_reg() ? dst : Operand::r(Reg::rax);
+                m_code.push_back({ .op = Op::setcc, .dst = target, .cond = instr.cond });
+                emit(Op::movzx, target, target);
+                if (dst.is_mem())
+                {
+                    emit(Op::mov, dst, target);
+                }
+                break;
+            }
+            case VOp::jcc:
+                m_code.push_back({ .op = Op::jcc, .dst = dst, .cond = instr.cond });
+                break;
+            case VOp::jz:
+                if (dst.is_imm())
+                {
+                    if (dst.imm == 0)
+                        emit(Op::jmp, src);
+                    break;
+                }
+                if (dst.is_reg())
+                    emit(Op::test, dst, dst);
+                else
+                    emit(Op::cmp, dst, Operand::i(0));
+                emit(Op::jz, src);
+                break;
+            case VOp::jnz:
+                if (dst.is_imm())
+                {
+                    if (dst.imm != 0)
+                        emit(Op::jmp, src);
+                    break;
+                }
+                if (dst.is_reg())
+                    emit(Op::test, dst, dst);
+                else
+                    emit(Op::cmp, dst, Operand::i(0));
+                m_code.push_back({ .op = Op::jcc, .dst = src, .cond = Cond::ne });
+                break;
+            case VOp::jmp:
+                emit(Op::jmp, dst);
+                break;
+            case VOp::label:
+                emit(Op::label, dst);
+                break;
+            case VOp::exit:
+                if (m_exit == ExitConvention::ret)
+                {
+                    if (!dst.is_reg(Reg::rax))
+                        emit(Op::mov, Operand::r(Reg::rax), dst);
+                    append_return(m_code, m_frame_bytes);
+                    break;
+                }
+                if (!dst.is_reg(Reg::rdi))
+                    emit(Op::mov, Operand::r(Reg::rdi), dst);
+                emit(Op::mov, Operand::r(Reg::rax), Operand::i(60));
+                emit(Op::syscall);
+                break;
+        }
+    }
+    
+    const std::vector<Location>& m_locations;
+    const ExitConvention m_exit;
+    uint64_t m_frame_bytes = 0;
+    std::vector<Instr> m_code;
+};
+
+std::vector<Instr> allocate_registers(const VCode& code, ExitConvention exit)
+{
+    std::vector<Interval> intervals = build_intervals(code);
+    int32_t slot_count = 0;
+    std::vector<Location> locations = linear_scan(intervals, code.vreg_count, slot_count);
+    Rewriter rewriter(locations, exit);
+    return rewriter.rewrite(code, slot_count);
+}
@@ -0,0 +1,84 @@
+//
+//  RegAlloc.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "X86.hpp"
+
+// Lowered code over an unlimited supply of virtual registers. lower_ir()
+// produces this at -O1 and allocate_registers() maps it onto real registers.
+
+using VReg = uint32_t;
+
+struct VOperand
+{
+    enum class Kind : uint8_t
+    {
+        none,
+        vreg,
+        imm,
+        label
+    };
+    
+    Kind kind = Kind::none;
+    uint64_t value = 0;
+    
+    static inline VOperand v(VReg vreg) { return { .kind = Kind::vreg, .value = vreg }; }
+    static inline VOperand i(uint64_t value) { return { .kind = Kind::imm, .value = value }; }
+    static inline VOperand l(uint32_t label) { return { .kind = Kind::label, .value = label }; }
+    
+    inline bool is_vreg() const { return kind == Kind::vreg; }
+    inline bool is_imm() const { return kind == Kind::imm; }
+    inline VReg vreg() const { return static_cast<VReg>(value); }
+};
+
+// Two-address forms: every write happens after all reads of the instruction.
+enum class VOp : uint8_t
+{
+    mov,    // dst = src
+    add,    // dst += src
+    sub,    // dst -= src
+    mul,    // dst *= src
+    div,    // dst /= src, src must be a vreg
+    mulhi,  // dst = high 64 bits of dst * src
+    shl,    // dst <<= src, an immediate count
+    shr,    // dst >>= src, logical
+    lea,    // dst += dst * src, an immediate 2, 4 or 8
+    cmp,    // compare dst with src, for the jcc or setcc right after
+    setcc,  // dst = 1 if cond holds, else 0
+    jz,     // if dst == 0 goto src
+    jnz,    // if dst != 0 goto src
+    jcc,    // if cond holds goto dst
+    jmp,    // goto dst
+    label,  // defines dst
+    exit    // exit with status dst
+};
+
+struct VInstr
+{
+    VOp op;
+    VOperand dst {};
+    VOperand src {};
+    Cond cond = Cond::e;    // setcc, jcc
+};
+
+struct VCode
+{
+    std::vector<VInstr> instrs;
+    VReg vreg_count = 0;
+    
+    inline VReg new_vreg() { return vreg_count++; }
+};
+
+// Linear-scan register allocation. rax and rdx are kept back as scratch for
+// div and memory-to-memory moves; everything else but rsp is allocatable.
+// Intervals run from first to last mention in program order, which is exact
+// as long as every branch jumps forward. A value that is live into a loop
+// (mentioned before a backward jump's target and again after it) is stretched
+// to the jump, so it survives every iteration. `exit` decides how VOp::exit
+// ends the program.
+std::vector<Instr> allocate_registers(const VCode& code, ExitConvention exit = ExitConvention::syscall);
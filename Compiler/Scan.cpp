@@ -0,0 +1,340 @@
+//
+//  Scan.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Scan.hpp"
+
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_HAS_X86 1
+#include <immintrin.h>
+#endif
+
+static inline bool is_space(unsigned char c)
+{
+    return c == ' ' || static_cast<unsigned char>(c - '\t') < 5;
+}
+
+static inline bool is_alpha(unsigned char c)
+{
+    return static_cast<unsigned char>((c | 0x20) - 'a') < 26;
+}
+
+static inline bool is_digit(unsigned char c)
+{
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+// Scalar kernels. The vector versions below finish their tails with these.
+
+static const char* skip_whitespace_scalar(const char* p, const char* end, int& lines)
+{
+    while (p < end && is_space(*p))
+    {
+        lines += *p == '\n';
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_alpha_scalar(const char* p, const char* end)
+{
+    while (p < end && is_alpha(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_digits_scalar(const char* p, const char* end)
+{
+    while (p < end && is_digit(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char* find_newline_scalar(const char* p, const char* end)
+{
+    while (p < end && *p != '\n')
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char* find_comment_end_scalar(const char* p, const char* end, int& lines)
+{
+    while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+    {
+        lines += *p == '\n';
+        p++;
+    }
+    if (p + 1 >= end)
+    {
+        lines += p < end && *p == '\n';
+        return end;
+    }
+    return p;
+}
+
+static constexpr ScanKernels scalar_kernels {
+    skip_whitespace_scalar,
+    skip_alpha_scalar,
+    skip_digits_scalar,
+    find_newline_scalar,
+    find_comment_end_scalar,
+    "scalar"
+};
+
+#ifdef SCAN_HAS_X86
+
+// Range checks use the usual trick of biasing by 128 so that an unsigned
+// "c - lo < n" becomes a single signed compare.
+
+static inline __m128i in_range_sse2(__m128i c, char lo, char n)
+{
+    __m128i biased = _mm_add_epi8(c, _mm_set1_epi8(static_cast<char>(128 - lo)));
+    return _mm_cmplt_epi8(biased, _mm_set1_epi8(static_cast<char>(-128 + n)));
+}
+
+static inline __m128i space_mask_sse2(__m128i c)
+{
+    return _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), in_range_sse2(c, '\t', 5));
+}
+
+static const char* skip_whitespace_sse2(const char* p, const char* end, int& lines)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t stop = ~_mm_movemask_epi8(space_mask_sse2(c)) & 0xFFFF;
+        uint32_t nl = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+        if (stop)
+        {
+            unsigned idx = __builtin_ctz(stop);
+            lines += __builtin_popcount(nl & ((1u << idx) - 1));
+            return p + idx;
+        }
+        lines += __builtin_popcount(nl);
+        p += 16;
+    }
+    return skip_whitespace_scalar(p, end, lines);
+}
+
+static const char* skip_alpha_sse2(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        uint32_t stop = ~_mm_movemask_epi8(in_range_sse2(lower, 'a', 26)) & 0xFFFF;
+        if (stop)
+        {
+            return p + __builtin_ctz(stop);
+        }
+        p += 16;
+    }
+    return skip_alpha_scalar(p, end);
+}
+
+static const char* skip_digits_sse2(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t stop = ~_mm_movemask_epi8(in_range_sse2(c, '0', 10)) & 0xFFFF;
+        if (stop)
+        {
+            return p + __builtin_ctz(stop);
+        }
+        p += 16;
+    }
+    return skip_digits_scalar(p, end);
+}
+
+static const char* find_newline_sse2(const char* p, const char* end)
+{
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t hit = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+        if (hit)
+        {
+            return p + __builtin_ctz(hit);
+        }
+        p += 16;
+    }
+    return find_newline_scalar(p, end);
+}
+
+static const char* find_comment_end_sse2(const char* p, const char* end, int& lines)
+{
+    // Compare each block against itself shifted by one byte to find "*/"
+    // pairs, which needs one byte of lookahead past the block.
+    while (end - p >= 17)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        uint32_t hit = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('*')),
+                                                       _mm_cmpeq_epi8(next, _mm_set1_epi8('/'))));
+        uint32_t nl = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+        if (hit)
+        {
+            unsigned idx = __builtin_ctz(hit);
+            lines += __builtin_popcount(nl & ((1u << idx) - 1));
+            return p + idx;
+        }
+        lines += __builtin_popcount(nl);
+        p += 16;
+    }
+    return find_comment_end_scalar(p, end, lines);
+}
+
+static constexpr ScanKernels sse2_kernels {
+    skip_whitespace_sse2,
+    skip_alpha_sse2,
+    skip_digits_sse2,
+    find_newline_sse2,
+    find_comment_end_sse2,
+    "sse2"
+};
+
+#define SCAN_AVX2 __attribute__((target("avx2")))
+
+SCAN_AVX2 static inline __m256i in_range_avx2(__m256i c, char lo, char n)
+{
+    __m256i biased = _mm256_add_epi8(c, _mm256_set1_epi8(static_cast<char>(128 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + n)), biased);
+}
+
+SCAN_AVX2 static const char* skip_whitespace_avx2(const char* p, const char* end, int& lines)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), in_range_avx2(c, '\t', 5));
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(space));
+        uint32_t nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')));
+        if (stop)
+        {
+            unsigned idx = __builtin_ctz(stop);
+            lines += __builtin_popcount(nl & ((1u << idx) - 1));
+            return p + idx;
+        }
+        lines += __builtin_popcount(nl);
+        p += 32;
+    }
+    return skip_whitespace_sse2(p, end, lines);
+}
+
+SCAN_AVX2 static const char* skip_alpha_avx2(const char* p, const char* end)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(in_range_avx2(lower, 'a', 26)));
+        if (stop)
+        {
+            return p + __builtin_ctz(stop);
+        }
+        p += 32;
+    }
+    return skip_alpha_sse2(p, end);
+}
+
+SCAN_AVX2 static const char* skip_digits_avx2(const char* p, const char* end)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(in_range_avx2(c, '0', 10)));
+        if (stop)
+        {
+            return p + __builtin_ctz(stop);
+        }
+        p += 32;
+    }
+    return skip_digits_sse2(p, end);
+}
+
+SCAN_AVX2 static const char* find_newline_avx2(const char* p, const char* end)
+{
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t hit = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')));
+        if (hit)
+        {
+            return p + __builtin_ctz(hit);
+        }
+        p += 32;
+    }
+    return find_newline_sse2(p, end);
+}
+
+SCAN_AVX2 static const char* find_comment_end_avx2(const char* p, const char* end, int& lines)
+{
+    while (end - p >= 33)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        uint32_t hit = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('*')),
+                                                             _mm256_cmpeq_epi8(next, _mm256_set1_epi8('/'))));
+        uint32_t nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')));
+        if (hit)
+        {
+            unsigned idx = __builtin_ctz(hit);
+            lines += __builtin_popcount(nl & ((1u << idx) - 1));
+            return p + idx;
+        }
+        lines += __builtin_popcount(nl);
+        p += 32;
+    }
+    return find_comment_end_sse2(p, end, lines);
+}
+
+static constexpr ScanKernels avx2_kernels {
+    skip_whitespace_avx2,
+    skip_alpha_avx2,
+    skip_digits_avx2,
+    find_newline_avx2,
+    find_comment_end_avx2,
+    "avx2"
+};
+
+#endif
+
+static const ScanKernels* pick_kernels(ScanLevel level)
+{
+#ifdef SCAN_HAS_X86
+    __builtin_cpu_init();
+    if ((level == ScanLevel::avx2 || level == ScanLevel::best) && __builtin_cpu_supports("avx2"))
+    {
+        return &avx2_kernels;
+    }
+    if (level != ScanLevel::scalar)
+    {
+        return &sse2_kernels;
+    }
+#endif
+    return &scalar_kernels;
+}
+
+static const ScanKernels* s_kernels = pick_kernels(ScanLevel::best);
+
+const ScanKernels& scan_kernels()
+{
+    return *s_kernels;
+}
+
+void scan_select(ScanLevel level)
+{
+    s_kernels = pick_kernels(level);
+}
@@ -0,0 +1,44 @@
+//
+//  Scan.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+// Bulk scanning kernels used by the Tokenizer for the long runs that make up
+// most of a source file: whitespace, comment bodies and identifier/digit runs.
+// Each kernel returns a pointer to the first byte that does not belong to the
+// run (or `end`). Vector versions are picked at startup from what the CPU
+// supports; the scalar versions are always available as a fallback.
+
+enum class ScanLevel
+{
+    scalar,
+    sse2,
+    avx2,
+    best
+};
+
+struct ScanKernels
+{
+    // Skips ' ', '\t', '\n', '\v', '\f' and '\r', adding the newlines seen to `lines`.
+    const char* (*skip_whitespace)(const char* p, const char* end, int& lines);
+    // Skips [A-Za-z].
+    const char* (*skip_alpha)(const char* p, const char* end);
+    // Skips [0-9].
+    const char* (*skip_digits)(const char* p, const char* end);
+    // Finds the next '\n'.
+    const char* (*find_newline)(const char* p, const char* end);
+    // Finds the '*' of the next "*/", adding the newlines passed to `lines`.
+    const char* (*find_comment_end)(const char* p, const char* end, int& lines);
+    const char* name;
+};
+
+// The kernels currently in use; defaults to the best level the CPU supports.
+const ScanKernels& scan_kernels();
+
+// Overrides the dispatch, e.g. to compare against the scalar path. Levels the
+// CPU cannot run fall back to the best supported one below them.
+void scan_select(ScanLevel level);
@@ -0,0 +1,136 @@
+//
+//  Semantic.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Semantic.hpp"
+#include "Diagnostics.hpp"
+
+class SemanticChecker
+{
+public:
+    SemanticChecker(const NodeProg& prog)
+        : m_prog(prog), m_scopes(prog.symbol_count) {}
+    
+    // Blocks are walked with an explicit stack of frames, so nesting depth and
+    // elif chain length are not limited by the call stack.
+    void check_prog()
+    {
+        m_frames.push_back({ .stmts = m_prog.stmts, .arm = no_node });
+        while (true)
+        {
+            Frame& frame = m_frames.back();
+            if (frame.next < frame.stmts.size())
+            {
+                check_stmt(frame.stmts[frame.next++]);
+                continue;
+            }
+            NodeIndex arm = frame.arm;
+            m_frames.pop_back();
+            if (m_frames.empty())
+            {
+                break;
+            }
+            m_scopes.exit_scope();
+            if (arm != no_node && m_prog.stmt(arm).pred != no_node)
+            {
+                enter_arm(m_prog.stmt(arm).pred);
+            }
+        }
+    }
+    
+private:
+    // Statements of one open block; `arm` is the if/elif/else/while it belongs to.
+    struct Frame
+    {
+        std::span<const NodeIndex> stmts;
+        size_t next = 0;
+        NodeIndex arm;
+    };
+    
+    [[noreturn]] void error(const std::string& msg, Symbol name, int line)
+    {
+        throw CompileError("[Semantic error] " + msg + ": " + std::string(m_prog.interner->name(name)) + " on line " + std::to_string(line));
+    }
+    
+    void check_expr(NodeIndex root)
+    {
+        for (NodeIndex index : m_walk.postorder(m_prog, root))
+        {
+            const NodeExpr& expr = m_prog.expr(index);
+            if (expr.kind == NodeKind::term_ident && !m_scopes.find(expr.name))
+            {
+                error("Undeclared identifier", expr.name, m_prog.expr_lines[index]);
+            }
+        }
+    }
+    
+    void enter_scope(NodeIndex scope, NodeIndex arm)
+    {
+        m_scopes.enter_scope();
+        m_frames.push_back({ .stmts = m_prog.scope_stmts(m_prog.stmt(scope)), .arm = arm });
+    }
+    
+    void enter_arm(NodeIndex index)
+    {
+        const NodeStmt& arm = m_prog.stmt(index);
+        if (arm.kind != NodeKind::if_pred_else)
+        {
+            check_expr(arm.expr);
+        }
+        enter_scope(arm.scope, index);
+    }
+    
+    void check_stmt(NodeIndex index)
+    {
+        const NodeStmt& stmt = m_prog.stmt(index);
+        switch (stmt.kind)
+        {
+            case NodeKind::stmt_exit:
+                check_expr(stmt.expr);
+                break;
+            case NodeKind::stmt_let:
+            {
+                if (m_scopes.declared_in_scope(stmt.name))
+                {
+                    error("Identifier already declared in this scope", stmt.name, m_prog.expr_lines[stmt.expr]);
+                }
+                check_expr(stmt.expr);
+                m_scopes.declare(stmt.name, true);
+                break;
+            }
+            case NodeKind::stmt_asign:
+                if (!m_scopes.find(stmt.name))
+                {
+                    error("Undeclared identifier", stmt.name, m_prog.expr_lines[stmt.expr]);
+                }
+                check_expr(stmt.expr);
+                break;
+            case NodeKind::scope:
+                enter_scope(index, no_node);
+                break;
+            case NodeKind::stmt_if:
+            case NodeKind::stmt_while:
+                enter_arm(index);
+                break;
+            case NodeKind::stmt_break:
+            case NodeKind::stmt_continue:
+                break;
+            default:
+                throw std::runtime_error("Unreachable");
+        }
+    }
+    
+    const NodeProg& m_prog;
+    ScopedTable<bool> m_scopes;
+    std::vector<Frame> m_frames;
+    ExprWalk m_walk;
+};
+
+void check_semantics(const NodeProg& prog)
+{
+    SemanticChecker checker(prog);
+    checker.check_prog();
+}
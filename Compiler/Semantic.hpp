@@ -0,0 +1,15 @@
+//
+//  Semantic.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include "Parser.hpp"
+
+// Checks scoping: names must be declared before use and at most once per
+// scope, though an inner scope may shadow an outer one. Errors are reported
+// and stop the compile.
+void check_semantics(const NodeProg& prog);
@@ -0,0 +1,560 @@
+//
+//  Server.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Server.hpp"
+#include "Cache.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define SERVER_SUPPORTED 1
+#endif
+
+namespace
+{
+
+// Both ends are the same binary on the same machine, so integers travel in
+// native byte order; the magic number catches a client and server from
+// different builds.
+constexpr uint32_t wire_magic = 0x4E57'0002;    // "NW", format 2
+constexpr uint64_t max_message = uint64_t(1) << 30;
+
+// How long either side waits on the other before giving up: the server on a
+// client that sends nothing, a client on a server that does not accept its
+// request. Once accepted, the client waits for the compile however long it
+// takes; falling back then would race the server for the same outputs.
+constexpr time_t io_timeout_seconds = 30;
+
+// The server trims the cache after this many stores, as a one-shot build does once at its end.
+constexpr size_t trim_every_stores = 64;
+
+// A message is its length and then its fields, appended in order.
+class WireWriter
+{
+public:
+    WireWriter()
+    {
+        put(uint64_t(0));
+        put(wire_magic);
+    }
+
+    template<typename T>
+    void put(T value)
+    {
+        m_data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void put_string(std::string_view text)
+    {
+        put(uint64_t(text.size()));
+        m_data.append(text);
+    }
+
+    // The whole message with its length filled in.
+    std::string finish()
+    {
+        uint64_t length = m_data.size() - sizeof(uint64_t);
+        std::memcpy(m_data.data(), &length, sizeof(length));
+        return std::move(m_data);
+    }
+
+private:
+    std::string m_data;
+};
+
+// Reads the fields of a message back. A field past the end leaves the reader
+// failed and returns zero or empty, so a short message is checked once at the end.
+class WireReader
+{
+public:
+    WireReader(std::string_view data)
+        : m_data(data)
+    {
+        m_ok = get<uint32_t>() == wire_magic;
+    }
+
+    template<typename T>
+    T get()
+    {
+        T value {};
+        if (m_data.size() < sizeof(value))
+        {
+            m_ok = false;
+            return value;
+        }
+        std::memcpy(&value, m_data.data(), sizeof(value));
+        m_data.remove_prefix(sizeof(value));
+        return value;
+    }
+
+    std::string get_string()
+    {
+        uint64_t size = get<uint64_t>();
+        if (m_data.size() < size)
+        {
+            m_ok = false;
+            return {};
+        }
+        std::string text(m_data.substr(0, size));
+        m_data.remove_prefix(size);
+        return text;
+    }
+
+    [[nodiscard]] inline bool ok() const { return m_ok; }
+
+private:
+    std::string_view m_data;
+    bool m_ok = true;
+};
+
+std::string encode_request(const std::vector<CompileJob>& jobs, const CompileOptions& options)
+{
+    WireWriter out;
+    out.put(uint8_t(options.opt_level));
+    out.put(uint8_t(options.emit));
+    out.put(uint8_t(options.peephole));
+    out.put(uint32_t(jobs.size()));
+    for (const CompileJob& job : jobs)
+    {
+        out.put_string(job.input);
+        out.put_string(job.output);
+        out.put(uint8_t(job.source.has_value()));
+        out.put_string(job.source.value_or(""));
+    }
+    return out.finish();
+}
+
+bool decode_request(std::string_view message, std::vector<CompileJob>& jobs, CompileOptions& options)
+{
+    WireReader in(message);
+    options.opt_level = in.get<uint8_t>();
+    options.emit = static_cast<EmitKind>(in.get<uint8_t>());
+    options.peephole = in.get<uint8_t>() != 0;
+    uint32_t count = in.get<uint32_t>();
+    for (uint32_t i = 0; i < count && in.ok(); i++)
+    {
+        CompileJob job;
+        job.input = in.get_string();
+        job.output = in.get_string();
+        bool has_source = in.get<uint8_t>() != 0;
+        std::string source = in.get_string();
+        if (has_source)
+        {
+            job.source = std::move(source);
+        }
+        jobs.push_back(std::move(job));
+    }
+    // The server only compiles: a program that never ends would hold a worker forever.
+    return in.ok() && options.opt_level <= 1 && options.emit <= EmitKind::interpret && !executes(options.emit);
+}
+
+// Sent as soon as a request is decoded, before anything is compiled.
+std::string encode_accepted(size_t jobs)
+{
+    WireWriter out;
+    out.put(uint32_t(jobs));
+    return out.finish();
+}
+
+bool decode_accepted(std::string_view message, size_t expected)
+{
+    WireReader in(message);
+    uint32_t jobs = in.get<uint32_t>();
+    return in.ok() && jobs == expected;
+}
+
+std::string encode_results(const std::vector<CompileResult>& results)
+{
+    WireWriter out;
+    out.put(uint32_t(results.size()));
+    for (const CompileResult& result : results)
+    {
+        out.put(uint8_t(result.ok));
+        out.put(uint8_t(result.cached));
+        out.put_string(result.diagnostics);
+        out.put(uint8_t(result.status.has_value()));
+        out.put(result.status.value_or(0));
+        out.put(result.compile_ns);
+        out.put(result.run_ns);
+        out.put_string(result.output);
+    }
+    return out.finish();
+}
+
+std::optional<std::vector<CompileResult>> decode_results(std::string_view message, size_t expected)
+{
+    WireReader in(message);
+    std::vector<CompileResult> results(in.get<uint32_t>());
+    for (CompileResult& result : results)
+    {
+        result.ok = in.get<uint8_t>() != 0;
+        result.cached = in.get<uint8_t>() != 0;
+        result.diagnostics = in.get_string();
+        bool has_status = in.get<uint8_t>() != 0;
+        uint8_t status = in.get<uint8_t>();
+        if (has_status)
+        {
+            result.status = status;
+        }
+        result.compile_ns = in.get<uint64_t>();
+        result.run_ns = in.get<uint64_t>();
+        result.output = in.get_string();
+        if (!in.ok())
+        {
+            break;
+        }
+    }
+    if (!in.ok() || results.size() != expected)
+    {
+        return {};
+    }
+    return results;
+}
+
+#ifdef SERVER_SUPPORTED
+
+bool send_all(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+#ifdef MSG_NOSIGNAL
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+#else
+        ssize_t sent = send(fd, data.data(), data.size(), 0);
+#endif
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+bool receive_exactly(int fd, char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t got = recv(fd, data, size, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        data += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// One length-prefixed message, without its length.
+std::optional<std::string> receive_message(int fd)
+{
+    uint64_t length = 0;
+    if (!receive_exactly(fd, reinterpret_cast<char*>(&length), sizeof(length)) || length > max_message)
+    {
+        return {};
+    }
+    std::string message(length, '\0');
+    if (!receive_exactly(fd, message.data(), message.size()))
+    {
+        return {};
+    }
+    return message;
+}
+
+bool make_address(const std::string& path, sockaddr_un& address)
+{
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+void set_timeouts(int fd)
+{
+    timeval timeout { .tv_sec = io_timeout_seconds, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+void clear_receive_timeout(int fd)
+{
+    timeval never {};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &never, sizeof(never));
+}
+
+// Connects with the timeouts set, so a full backlog does not block either.
+int connect_to(const std::string& path)
+{
+    sockaddr_un address;
+    if (!make_address(path, address))
+    {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    set_timeouts(fd);
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Whether the process at the other end of `fd` runs as the same user as the
+// server. Outputs are written with the server's permissions, so no one else
+// may ask for them.
+bool peer_is_owner(int fd)
+{
+#if defined(SO_PEERCRED)
+    ucred credentials {};
+    socklen_t size = sizeof(credentials);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == geteuid();
+#else
+    uid_t uid = 0;
+    gid_t gid = 0;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+// Shared by the server's threads: trim() is not safe to run concurrently.
+class CacheTrimmer
+{
+public:
+    CacheTrimmer(BuildCache* cache)
+        : m_cache(cache) {}
+    
+    void maybe_trim()
+    {
+        if (!m_cache)
+        {
+            return;
+        }
+        std::lock_guard lock(m_mutex);
+        size_t stores = m_cache->stats().stores;
+        if (stores >= m_stores_at_trim + trim_every_stores)
+        {
+            m_cache->trim();
+            m_stores_at_trim = stores;
+        }
+    }
+    
+private:
+    BuildCache* m_cache;
+    std::mutex m_mutex;
+    size_t m_stores_at_trim = 0;
+};
+
+void serve_connection(int fd, BuildCache* cache, CacheTrimmer& trimmer)
+{
+    // A client that connects and then says nothing must not hold a thread forever.
+    set_timeouts(fd);
+    if (!peer_is_owner(fd))
+    {
+        return;
+    }
+
+    std::optional<std::string> message = receive_message(fd);
+    std::vector<CompileJob> jobs;
+    CompileOptions options;
+    if (!message || !decode_request(*message, jobs, options) || !send_all(fd, encode_accepted(jobs.size())))
+    {
+        return;
+    }
+    std::vector<CompileResult> results;
+    results.reserve(jobs.size());
+    for (const CompileJob& job : jobs)
+    {
+        results.push_back(compile_file(job, options, cache));
+    }
+    send_all(fd, encode_results(results));
+    trimmer.maybe_trim();
+}
+
+// Removed on SIGINT or SIGTERM so the next server can bind it.
+char g_socket_path[sizeof(sockaddr_un::sun_path)];
+
+void on_stop(int)
+{
+    unlink(g_socket_path);
+    _exit(0);
+}
+
+#endif
+
+} // namespace
+
+int run_server(const std::string& socket_path, unsigned threads, BuildCache* cache)
+{
+#ifdef SERVER_SUPPORTED
+    sockaddr_un address;
+    if (!make_address(socket_path, address))
+    {
+        std::cerr << "Socket path too long: " << socket_path << std::endl;
+        return 1;
+    }
+    // A socket file nobody answers on is left over from a server that died.
+    int existing = connect_to(socket_path);
+    if (existing >= 0)
+    {
+        close(existing);
+        std::cerr << "A server is already running on " << socket_path << std::endl;
+        return 1;
+    }
+    // Only a stale socket is removed; anything else at the path is the user's file.
+    struct stat status;
+    if (lstat(socket_path.c_str(), &status) == 0)
+    {
+        if (!S_ISSOCK(status.st_mode))
+        {
+            std::cerr << "Not a socket, refusing to replace it: " << socket_path << std::endl;
+            return 1;
+        }
+        unlink(socket_path.c_str());
+    }
+
+    // Created owner-only. No other thread exists yet, so changing the umask is safe.
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t umask_before = umask(0077);
+    bool bound = listener >= 0 && bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    umask(umask_before);
+    if (!bound || listen(listener, 128) != 0)
+    {
+        std::cerr << "Could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::memcpy(g_socket_path, address.sun_path, sizeof(g_socket_path));
+    std::signal(SIGINT, on_stop);
+    std::signal(SIGTERM, on_stop);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // A cache left over its limit by earlier builds is trimmed before the first request.
+    CacheTrimmer trimmer(cache);
+    if (cache)
+    {
+        cache->trim();
+    }
+    std::cerr << "Serving on " << socket_path << " with " << threads << " threads" << std::endl;
+
+    // Every thread blocks in accept() on the same socket and the kernel hands
+    // each connection to one of them.
+    auto serve = [&] {
+        while (true)
+        {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)
+                {
+                    continue;
+                }
+                std::cerr << "Could not accept a connection: " << std::strerror(errno) << std::endl;
+                return;
+            }
+            serve_connection(fd, cache, trimmer);
+            close(fd);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++)
+    {
+        workers.emplace_back(serve);
+    }
+    serve();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    unlink(socket_path.c_str());
+    return 1;
+#else
+    (void)threads;
+    (void)cache;
+    std::cerr << "--server is not supported on this platform: " << socket_path << std::endl;
+    return 1;
+#endif
+}
+
+std::optional<std::vector<CompileResult>> compile_remote(const std::string& socket_path, const std::vector<CompileJob>& jobs, const CompileOptions& options)
+{
+#ifdef SERVER_SUPPORTED
+    try
+    {
+        int fd = connect_to(socket_path);
+        if (fd < 0)
+        {
+            return {};
+        }
+        // Until the server accepts, no output has been touched and falling
+        // back is safe; after that, only a closed connection gives up.
+        std::optional<std::string> message;
+        if (send_all(fd, encode_request(jobs, options)))
+        {
+            message = receive_message(fd);
+        }
+        if (message && decode_accepted(*message, jobs.size()))
+        {
+            clear_receive_timeout(fd);
+            message = receive_message(fd);
+        }
+        else
+        {
+            message.reset();
+        }
+        close(fd);
+        if (!message)
+        {
+            return {};
+        }
+        return decode_results(*message, jobs.size());
+    }
+    catch (const std::exception&)
+    {
+        return {};
+    }
+#else
+    (void)socket_path;
+    (void)jobs;
+    (void)options;
+    return {};
+#endif
+}
@@ -0,0 +1,44 @@
+//
+//  Server.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Driver.hpp"
+
+class BuildCache;
+
+// A resident compiler behind a Unix domain socket, and the client side that
+// forwards to it. A build that runs the compiler once per file otherwise pays
+// for process start-up, the dynamic loader and a cold heap every time.
+//
+// Each connection carries one request: the options and a list of jobs, each
+// naming its input by path or carrying the source itself, and its output by
+// path or asking for it back. The server accepts the request before it
+// compiles anything and then answers with one CompileResult per job. Paths
+// are used as they are, so a client sends absolute ones.
+//
+// The server only compiles: requests to run a program (--run, --interpret)
+// are refused, and the client runs those itself. Outputs are written with the
+// server's permissions, so the socket is created owner-only and connections
+// from other users are dropped.
+
+// Serves requests on `socket_path` until the process is killed, `threads`
+// connections at a time (0: one per hardware core). Each thread handles one
+// connection after another, so its heap arenas and buffers stay warm. With a
+// cache, the cache is trimmed to its size limit as entries are stored.
+// Returns the exit code if the socket cannot be set up.
+int run_server(const std::string& socket_path, unsigned threads, BuildCache* cache);
+
+// Compiles `jobs` on the server at `socket_path`. Nothing if no server is
+// listening there, the server refuses the request or does not accept it in
+// time, or the connection fails part way; the caller then compiles
+// in-process. Once accepted there is no time limit. Does not throw.
+std::optional<std::vector<CompileResult>> compile_remote(const std::string& socket_path, const std::vector<CompileJob>& jobs, const CompileOptions& options);
@@ -0,0 +1,74 @@
+//
+//  Source.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "Source.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SOURCE_HAS_MMAP 1
+#endif
+
+SourceFile::SourceFile(const std::string& path)
+{
+#ifdef SOURCE_HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        m_open = true;
+        m_size = static_cast<size_t>(st.st_size);
+        if (m_size > 0)
+        {
+            void* addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                madvise(addr, m_size, MADV_SEQUENTIAL);
+                m_data = static_cast<const char*>(addr);
+                m_mapped = true;
+            }
+        }
+    }
+    close(fd);
+    if (m_mapped || (m_open && m_size == 0))
+    {
+        return;
+    }
+#endif
+    // Fall back to reading the whole file (pipes, platforms without mmap).
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        m_open = false;
+        return;
+    }
+    std::stringstream contents_stream;
+    contents_stream << file.rdbuf();
+    m_fallback = contents_stream.str();
+    m_data = m_fallback.data();
+    m_size = m_fallback.size();
+    m_open = true;
+}
+
+SourceFile::~SourceFile()
+{
+#ifdef SOURCE_HAS_MMAP
+    if (m_mapped)
+    {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+#endif
+}
@@ -0,0 +1,37 @@
+//
+//  Source.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Read-only view of a source file. The file is memory-mapped once where the
+// platform supports it, so tokens can point straight into it instead of
+// copying their text. Must outlive every Token produced from it.
+class SourceFile
+{
+public:
+    SourceFile(const std::string& path);
+    
+    inline SourceFile(const SourceFile& other) = delete;
+    
+    inline SourceFile operator = (const SourceFile& other) = delete;
+    
+    ~SourceFile();
+    
+    [[nodiscard]] inline bool is_open() const { return m_open; }
+    [[nodiscard]] inline std::string_view view() const { return { m_data, m_size }; }
+    [[nodiscard]] inline size_t size() const { return m_size; }
+    
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+    bool m_mapped = false;
+    std::string m_fallback;
+};
@@ -0,0 +1,69 @@
+//
+//  SymbolTable.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "SymbolTable.hpp"
+
+#include <cstring>
+
+static inline uint64_t hash_name(std::string_view name)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : name)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+Interner::Interner()
+    : m_arena(4 * 1024), m_slots(64, 0) {}
+
+Symbol Interner::intern(std::string_view name)
+{
+    uint64_t hash = hash_name(name);
+    size_t mask = m_slots.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        uint32_t entry = m_slots[slot];
+        if (entry == 0)
+        {
+            Symbol symbol = static_cast<Symbol>(m_names.size());
+            char* copy = static_cast<char*>(m_arena.alloc_bytes(name.size(), 1));
+            std::memcpy(copy, name.data(), name.size());
+            m_names.push_back({ copy, name.size() });
+            m_hashes.push_back(hash);
+            m_slots[slot] = symbol + 1;
+            if (m_names.size() * 2 > m_slots.size())
+            {
+                grow();
+            }
+            return symbol;
+        }
+        if (m_hashes[entry - 1] == hash && m_names[entry - 1] == name)
+        {
+            return entry - 1;
+        }
+    }
+}
+
+void Interner::grow()
+{
+    std::vector<uint32_t> slots(m_slots.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+    for (Symbol symbol = 0; symbol < m_names.size(); symbol++)
+    {
+        size_t slot = m_hashes[symbol] & mask;
+        while (slots[slot] != 0)
+        {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = symbol + 1;
+    }
+    m_slots = std::move(slots);
+}
@@ -0,0 +1,120 @@
+//
+//  SymbolTable.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "Arena.hpp"
+
+// Dense id for an interned identifier; equal names get equal symbols.
+using Symbol = uint32_t;
+
+static constexpr uint32_t no_binding = UINT32_MAX;
+
+// Maps identifier text to Symbols with an open-addressing table (linear
+// probing, kept at most half full). The Tokenizer interns every identifier as
+// it reads it, so later phases only ever compare Symbols. Each distinct name
+// is copied into the table's arena once and every Symbol for it shares that
+// copy, so the table does not depend on the source staying mapped.
+//
+// One Interner serves a whole compile: the driver owns it and NodeProg points
+// at it for the names diagnostics print.
+class Interner
+{
+public:
+    Interner();
+    
+    Symbol intern(std::string_view name);
+    
+    [[nodiscard]] inline std::string_view name(Symbol symbol) const { return m_names[symbol]; }
+    [[nodiscard]] inline size_t size() const { return m_names.size(); }
+    
+private:
+    void grow();
+    
+    ArenaAllocator m_arena;
+    std::vector<std::string_view> m_names;      // into m_arena
+    std::vector<uint64_t> m_hashes;
+    std::vector<uint32_t> m_slots;      // symbol + 1, or 0 when empty
+};
+
+// Lexically scoped bindings from Symbol to T, supporting shadowing.
+//
+// Bindings are appended and never moved. Each symbol points at its newest
+// binding, and each binding links to the one it shadows. Leaving a scope only
+// marks it closed, which is O(1); lookups skip bindings of closed scopes and
+// remember the result, so every dead binding is skipped at most once.
+template<typename T>
+class ScopedTable
+{
+public:
+    ScopedTable(size_t symbol_count)
+        : m_current(symbol_count, no_binding)
+    {
+        enter_scope();
+    }
+    
+    inline void enter_scope()
+    {
+        m_scopes.push_back({ static_cast<uint32_t>(m_open.size()), 0 });
+        m_open.push_back(true);
+    }
+    
+    inline void exit_scope()
+    {
+        m_open[m_scopes.back().serial] = false;
+        m_scopes.pop_back();
+    }
+    
+    // Bindings made in the innermost open scope.
+    [[nodiscard]] inline size_t scope_size() const { return m_scopes.back().count; }
+    
+    inline void declare(Symbol symbol, T value)
+    {
+        m_bindings.push_back({ m_current[symbol], m_scopes.back().serial, std::move(value) });
+        m_current[symbol] = static_cast<uint32_t>(m_bindings.size() - 1);
+        m_scopes.back().count++;
+    }
+    
+    inline T* find(Symbol symbol)
+    {
+        uint32_t index = m_current[symbol];
+        while (index != no_binding && !m_open[m_bindings[index].scope])
+        {
+            index = m_bindings[index].prev;
+        }
+        m_current[symbol] = index;
+        return index == no_binding ? nullptr : &m_bindings[index].value;
+    }
+    
+    [[nodiscard]] inline bool declared_in_scope(Symbol symbol)
+    {
+        return find(symbol) && m_bindings[m_current[symbol]].scope == m_scopes.back().serial;
+    }
+    
+private:
+    struct Binding
+    {
+        uint32_t prev;
+        uint32_t scope;
+        T value;
+    };
+    
+    struct Scope
+    {
+        uint32_t serial;
+        uint32_t count;
+    };
+    
+    std::vector<Binding> m_bindings;
+    std::vector<uint32_t> m_current;    // per symbol: newest binding, possibly dead
+    std::vector<bool> m_open;           // per scope serial
+    std::vector<Scope> m_scopes;
+};
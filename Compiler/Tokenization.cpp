@@ -6,182 +6,317 @@
 //
 
 #include "Tokenization.hpp"
+#include "Diagnostics.hpp"
 
-Tokenizer::Tokenizer(const std::string src)
-    : m_src(std::move(src)) {}
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
 
-std::vector<Token> Tokenizer::tokenize()
+// The lexer is driven by two compile-time tables: a class for every byte and a
+// perfect hash over the keywords. New punctuation or keywords only need an
+// entry in `puncts` or `keywords` below. Punctuation is one or two characters;
+// a two-character one wins over its first character alone.
+
+enum class CharClass : uint8_t
 {
-    std::vector<Token> Tokens;
-    std::string buf;
-    int line_count = 1;
-    
-    while(peek().has_value())
+    invalid,
+    space,
+    newline,
+    alpha,
+    digit,
+    slash,
+    punct
+};
+
+struct Keyword
+{
+    std::string_view text;
+    TokenType type;
+};
+
+struct Punct
+{
+    std::string_view text;
+    TokenType type;
+};
+
+static constexpr Keyword keywords[] = {
+    { "exit", TokenType::exit },
+    { "let", TokenType::let },
+    { "if", TokenType::if_ },
+    { "elif", TokenType::elif },
+    { "else", TokenType::else_ },
+    { "while", TokenType::while_ },
+    { "break", TokenType::break_ },
+    { "continue", TokenType::continue_ },
+};
+
+// '/' is handled separately since it may also open a comment.
+static constexpr Punct puncts[] = {
+    { "(", TokenType::open_paren },
+    { ")", TokenType::close_paren },
+    { ";", TokenType::semi },
+    { "=", TokenType::eq },
+    { "+", TokenType::plus },
+    { "*", TokenType::star },
+    { "-", TokenType::minus },
+    { "{", TokenType::open_curly },
+    { "}", TokenType::close_curly },
+    { "<", TokenType::lt },
+    { ">", TokenType::gt },
+    { "==", TokenType::eq_eq },
+    { "!=", TokenType::bang_eq },
+    { "<=", TokenType::lt_eq },
+    { ">=", TokenType::gt_eq },
+    { "&&", TokenType::amp_amp },
+    { "||", TokenType::pipe_pipe },
+};
+
+struct CharTables
+{
+    std::array<CharClass, 256> cls {};
+    std::array<bool, 256> lone {};          // the character is a token by itself
+    std::array<TokenType, 256> punct {};
+    std::array<char, 256> pair_second {};   // second character of the one two-character token starting here, or 0
+    std::array<TokenType, 256> pair {};
+};
+
+static constexpr CharTables make_char_tables()
+{
+    CharTables tables;
+    for (int c = 0; c < 256; c++)
+    {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            tables.cls[c] = CharClass::alpha;
+        else if (c >= '0' && c <= '9')
+            tables.cls[c] = CharClass::digit;
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f')
+            tables.cls[c] = CharClass::space;
+        else if (c == '\n')
+            tables.cls[c] = CharClass::newline;
+        else if (c == '/')
+            tables.cls[c] = CharClass::slash;
+        else
+            tables.cls[c] = CharClass::invalid;
+    }
+    for (const Punct& punct : puncts)
     {
-        if (isalpha(peek().value()))
+        uint8_t first = static_cast<uint8_t>(punct.text[0]);
+        tables.cls[first] = CharClass::punct;
+        if (punct.text.size() == 1)
         {
-            buf.push_back(consume());
-            while (peek().has_value() && isalpha(peek().value()))
-            {
-                buf.push_back(consume());
-            }
-            if (buf == "exit")
-            {
-                Tokens.push_back({ TokenType::exit, line_count });
-                buf.clear();
-            }
-            else if (buf == "let")
-            {
-                Tokens.push_back({ TokenType::let, line_count });
-                buf.clear();
-            }
-            else if (buf == "if")
-            {
-                Tokens.push_back({ TokenType::if_, line_count });
-                buf.clear();
-            }
-            else if (buf == "elif")
-            {
-                Tokens.push_back({ TokenType::elif, line_count });
-                buf.clear();
-            }
-            else if (buf == "else")
-            {
-                Tokens.push_back({ TokenType::else_, line_count });
-                buf.clear();
-            }
-            else
-            {
-                Tokens.push_back({ TokenType::ident, line_count, buf });
-                buf.clear();
-            }
+            tables.lone[first] = true;
+            tables.punct[first] = punct.type;
         }
-        else if (isdigit(peek().value()))
-        {
-            buf.push_back(consume());
-            while (peek().has_value() && isdigit(peek().value()))
-            {
-                buf.push_back(consume());
-            }
-            
-            Tokens.push_back({ TokenType::int_lit, line_count, buf });
-            buf.clear();
-        }
-        else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/')
+        else
         {
-            consume();
-            consume();
-            while (peek().has_value() && peek().value() != '\n')
-            {
-                consume();
-            }
+            tables.pair_second[first] = punct.text[1];
+            tables.pair[first] = punct.type;
         }
-        else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*')
+    }
+    return tables;
+}
+
+static constexpr CharTables char_tables = make_char_tables();
+
+static inline CharClass char_class(char c)
+{
+    return char_tables.cls[static_cast<uint8_t>(c)];
+}
+
+static constexpr size_t keyword_slot_bits = 4;
+static constexpr size_t keyword_slots = size_t(1) << keyword_slot_bits;
+
+static constexpr uint32_t keyword_hash(std::string_view word, uint32_t seed)
+{
+    uint32_t h = static_cast<uint8_t>(word.front()) * seed;
+    h ^= static_cast<uint8_t>(word.back()) + static_cast<uint32_t>(word.size()) * 131u;
+    return (h * 2654435761u) >> (32 - keyword_slot_bits);
+}
+
+// Searched at compile time: the first seed under which no two keywords share a slot.
+static constexpr uint32_t find_keyword_seed()
+{
+    for (uint32_t seed = 1; seed < 100000; seed++)
+    {
+        bool used[keyword_slots] {};
+        bool ok = true;
+        for (const Keyword& kw : keywords)
         {
-            consume();
-            consume();
-            while (peek().has_value())
+            uint32_t slot = keyword_hash(kw.text, seed);
+            if (used[slot])
             {
-                if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/')
-                {
-                    break;
-                }
-                if (peek().value() == '\n')
-                {
-                    line_count++;
-                }
-                consume();
+                ok = false;
+                break;
             }
-            if (peek().has_value())
-            {
-                consume();
-            }
-            consume();
-        }
-        else if (peek().value() == '(')
-        {
-            consume();
-            Tokens.push_back({ TokenType::open_paren, line_count });
-        }
-        else if (peek().value() == ')')
-        {
-            consume();
-            Tokens.push_back({ TokenType::close_paren, line_count });
-        }
-        else if (peek().value() == ';')
-        {
-            consume();
-            Tokens.push_back({ TokenType::semi, line_count });
-        }
-        else if (peek().value() == '=')
-        {
-            consume();
-            Tokens.push_back({ TokenType::eq, line_count });
-        }
-        else if (peek().value() == '+')
-        {
-            consume();
-            Tokens.push_back({ TokenType::plus, line_count });
+            used[slot] = true;
         }
-        else if (peek().value() == '*')
+        if (ok)
         {
-            consume();
-            Tokens.push_back({ TokenType::star, line_count });
-        }
-        else if (peek().value() == '-')
-        {
-            consume();
-            Tokens.push_back({ TokenType::minus, line_count });
-        }
-        else if (peek().value() == '/')
-        {
-            consume();
-            Tokens.push_back({ TokenType::fslash, line_count });
-        }
-        else if (peek().value() == '{')
-        {
-            consume();
-            Tokens.push_back({ TokenType::open_curly, line_count });
-        }
-        else if (peek().value() == '}')
-        {
-            consume();
-            Tokens.push_back({ TokenType::close_curly, line_count });
-        }
-        else if (peek().value() == '\n')
-        {
-            consume();
-            line_count++;
-        }
-        else if (isspace(peek().value()))
-        {
-            consume();
-        }
-        else
-        {
-            std::cerr << "Invalid token" << std::endl;
+            return seed;
         }
     }
-    
-    m_index = 0;
-    return Tokens;
+    return 0;
 }
 
-std::optional<char> Tokenizer::peek(int offset) const
+static constexpr uint32_t keyword_seed = find_keyword_seed();
+static_assert(keyword_seed != 0, "No perfect hash for the keyword set; increase keyword_slot_bits");
+
+static constexpr std::array<int8_t, keyword_slots> make_keyword_slots()
 {
-    if (m_index + offset >= m_src.length())
+    std::array<int8_t, keyword_slots> slots {};
+    slots.fill(-1);
+    for (size_t i = 0; i < std::size(keywords); i++)
     {
-        return {};
+        slots[keyword_hash(keywords[i].text, keyword_seed)] = static_cast<int8_t>(i);
     }
-    else
+    return slots;
+}
+
+static constexpr std::array<int8_t, keyword_slots> keyword_table = make_keyword_slots();
+
+static constexpr size_t keyword_max_len = [] {
+    size_t len = 0;
+    for (const Keyword& kw : keywords)
+        len = std::max(len, kw.text.size());
+    return len;
+}();
+
+static inline TokenType classify_word(std::string_view word)
+{
+    if (word.size() > keyword_max_len)
+    {
+        return TokenType::ident;
+    }
+    int8_t index = keyword_table[keyword_hash(word, keyword_seed)];
+    if (index >= 0 && keywords[index].text == word)
     {
-        return m_src.at(m_index + offset);
+        return keywords[index].type;
     }
+    return TokenType::ident;
 }
 
-char Tokenizer::consume()
+Tokenizer::Tokenizer(std::string_view src, Interner& interner)
+    : m_src(src), m_pos(src.data()), m_end(src.data() + src.size()), m_scan(scan_kernels()), m_interner(interner) {}
+
+std::vector<Token> Tokenizer::tokenize()
 {
-    char c = m_src.at(m_index);
-    m_index++;
-    return c;
+    m_pos = m_src.data();
+    m_line = 1;
+    m_token_count = 0;
+    
+    std::vector<Token> Tokens;
+    Token token {};
+    while (next(token))
+    {
+        Tokens.push_back(token);
+    }
+    return Tokens;
+}
+
+bool Tokenizer::next(Token& token)
+{
+    const ScanKernels& scan = m_scan;
+    const char* p = m_pos;
+    const char* const end = m_end;
+    int line_count = m_line;
+    bool found = false;
+    
+    while (!found && p < end)
+    {
+        switch (char_class(*p))
+        {
+            case CharClass::alpha:
+            {
+                const char* start = p;
+                p = scan.skip_alpha(p + 1, end);
+                std::string_view word(start, p - start);
+                TokenType type = classify_word(word);
+                if (type == TokenType::ident)
+                {
+                    token = { .type = type, .line = line_count, .symbol = m_interner.intern(word) };
+                }
+                else
+                {
+                    token = { .type = type, .line = line_count, .int_value = 0 };
+                }
+                found = true;
+                break;
+            }
+            case CharClass::digit:
+            {
+                const char* start = p;
+                p = scan.skip_digits(p + 1, end);
+                token = { .type = TokenType::int_lit, .line = line_count, .int_value = 0 };
+                auto [ptr, ec] = std::from_chars(start, p, token.int_value);
+                token.out_of_range = ec != std::errc();
+                found = true;
+                break;
+            }
+            case CharClass::slash:
+            {
+                if (p + 1 < end && p[1] == '/')
+                {
+                    p = scan.find_newline(p + 2, end);
+                }
+                else if (p + 1 < end && p[1] == '*')
+                {
+                    int start_line = line_count;
+                    p = scan.find_comment_end(p + 2, end, line_count);
+                    if (p == end)
+                    {
+                        throw CompileError("[Tokenizer error] Unterminated comment on line " + std::to_string(start_line));
+                    }
+                    p += 2;
+                }
+                else
+                {
+                    token = { .type = TokenType::fslash, .line = line_count, .int_value = 0 };
+                    found = true;
+                    p++;
+                }
+                break;
+            }
+            case CharClass::punct:
+            {
+                uint8_t c = static_cast<uint8_t>(*p);
+                if (char_tables.pair_second[c] != 0 && p + 1 < end && p[1] == char_tables.pair_second[c])
+                {
+                    token = { .type = char_tables.pair[c], .line = line_count, .int_value = 0 };
+                    p += 2;
+                }
+                else if (char_tables.lone[c])
+                {
+                    token = { .type = char_tables.punct[c], .line = line_count, .int_value = 0 };
+                    p++;
+                }
+                else
+                {
+                    throw CompileError(std::string("[Tokenizer error] Invalid token '") + *p + "' on line " + std::to_string(line_count));
+                }
+                found = true;
+                break;
+            }
+            case CharClass::newline:
+                line_count++;
+                [[fallthrough]];
+            case CharClass::space:
+                // Single separators are by far the most common; only longer
+                // runs are worth handing to the bulk kernel.
+                p++;
+                if (p < end && (char_class(*p) == CharClass::space || char_class(*p) == CharClass::newline))
+                {
+                    p = scan.skip_whitespace(p, end, line_count);
+                }
+                break;
+            case CharClass::invalid:
+                throw CompileError(std::string("[Tokenizer error] Invalid token '") + *p + "' on line " + std::to_string(line_count));
+        }
+    }
+    
+    m_pos = p;
+    m_line = line_count;
+    m_token_count += found;
+    return found;
 }
@@ -13,9 +13,13 @@
 #include <sstream>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
-enum class TokenType
+#include "Scan.hpp"
+#include "SymbolTable.hpp"
+
+enum class TokenType : uint8_t
 {
     exit,
     int_lit,
@@ -33,29 +37,60 @@ enum class TokenType
     close_curly,
     if_,
     elif,
-    else_
+    else_,
+    eq_eq,
+    bang_eq,
+    lt,
+    lt_eq,
+    gt,
+    gt_eq,
+    amp_amp,
+    pipe_pipe,
+    while_,
+    break_,
+    continue_
 };
 
+// 16 bytes: identifiers are interned and literals converted as they are read,
+// so no token refers back into the source.
 struct Token
 {
     TokenType type;
+    bool out_of_range = false;  // int_lit: the literal does not fit in 64 bits
     int line;
-    std::optional<std::string> value {};
+    union
+    {
+        Symbol symbol;          // ident
+        uint64_t int_value = 0; // int_lit
+    };
 };
 
 class Tokenizer
 {
 public:
-    Tokenizer(const std::string src);
+    // Identifiers are interned into `interner`, which must outlive every use
+    // of the tokens' Symbols.
+    Tokenizer(std::string_view src, Interner& interner);
     
+    // Tokenizes the whole source from the start into a vector.
     std::vector<Token> tokenize();
+    
+    // Produces the next token, or returns false at the end of the source.
+    bool next(Token& token);
+    
+    // Tokens produced so far.
+    [[nodiscard]] inline size_t token_count() const { return m_token_count; }
+    
+    [[nodiscard]] inline const Interner& interner() const { return m_interner; }
 
 private:
-    [[nodiscard]] std::optional<char> peek(int offset = 0) const;
-    char consume();
-    
-    const std::string m_src;
-    size_t m_index = 0;
+    const std::string_view m_src;
+    const char* m_pos;
+    const char* m_end;
+    int m_line = 1;
+    size_t m_token_count = 0;
+    const ScanKernels& m_scan;
+    Interner& m_interner;
 };
 
 inline std::string to_string(TokenType type)
@@ -95,6 +130,28 @@ inline std::string to_string(TokenType type)
             return "'elif'";
         case TokenType::else_:
             return "'else'";
+        case TokenType::eq_eq:
+            return "'=='";
+        case TokenType::bang_eq:
+            return "'!='";
+        case TokenType::lt:
+            return "'<'";
+        case TokenType::lt_eq:
+            return "'<='";
+        case TokenType::gt:
+            return "'>'";
+        case TokenType::gt_eq:
+            return "'>='";
+        case TokenType::amp_amp:
+            return "'&&'";
+        case TokenType::pipe_pipe:
+            return "'||'";
+        case TokenType::while_:
+            return "'while'";
+        case TokenType::break_:
+            return "'break'";
+        case TokenType::continue_:
+            return "'continue'";
         default:
             throw std::runtime_error("");
     }
@@ -0,0 +1,139 @@
+//
+//  WorkPool.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "WorkPool.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Remaining positions [begin, end) of one worker. The owner takes from the front
+// and thieves take from the back, so they only contend on the last few items.
+struct alignas(64) Slice
+{
+    std::mutex lock;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+bool take_own(Slice& slice, size_t& position)
+{
+    std::lock_guard guard(slice.lock);
+    if (slice.begin == slice.end)
+    {
+        return false;
+    }
+    position = slice.begin++;
+    return true;
+}
+
+// Moves the back half of the fullest other slice into `self`. False once every
+// slice is empty; no work is added after the start, so that is final.
+bool steal(Slice* slices, unsigned count, unsigned self)
+{
+    while (true)
+    {
+        unsigned victim = count;
+        size_t most = 0;
+        for (unsigned i = 1; i < count; i++)
+        {
+            unsigned other = (self + i) % count;
+            std::lock_guard guard(slices[other].lock);
+            size_t left = slices[other].end - slices[other].begin;
+            if (left > most)
+            {
+                most = left;
+                victim = other;
+            }
+        }
+        if (victim == count)
+        {
+            return false;
+        }
+        
+        std::scoped_lock guard(slices[victim].lock, slices[self].lock);
+        Slice& from = slices[victim];
+        size_t left = from.end - from.begin;
+        if (left == 0)
+        {
+            continue; // drained while we were looking; pick again
+        }
+        size_t mid = from.begin + left / 2;
+        slices[self].begin = mid;
+        slices[self].end = from.end;
+        from.end = mid;
+        return true;
+    }
+}
+
+}
+
+WorkPool::WorkPool(unsigned threads)
+    : m_threads(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+void WorkPool::for_each(size_t count, const std::function<void(size_t index, unsigned worker)>& fn)
+{
+    unsigned workers = static_cast<unsigned>(std::min<size_t>(m_threads, count));
+    if (workers <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            fn(i, 0);
+        }
+        return;
+    }
+    
+    // Slices hold positions, not indices: worker w's slice is the run of
+    // positions standing for indices w, w + workers, w + 2 * workers, ... The
+    // first `longer` residues have one index more than the rest.
+    size_t shorter = count / workers;
+    size_t longer = count % workers;
+    size_t split = longer * (shorter + 1);
+    auto index_at = [&](size_t position) {
+        size_t w = position < split ? position / (shorter + 1) : longer + (position - split) / shorter;
+        size_t k = position < split ? position % (shorter + 1) : (position - split) % shorter;
+        return w + workers * k;
+    };
+    
+    std::unique_ptr<Slice[]> slices(new Slice[workers]);
+    for (unsigned w = 0; w < workers; w++)
+    {
+        slices[w].begin = w * shorter + std::min<size_t>(w, longer);
+        slices[w].end = slices[w].begin + shorter + (w < longer ? 1 : 0);
+    }
+    
+    auto run = [&](unsigned self) {
+        size_t position;
+        while (true)
+        {
+            while (take_own(slices[self], position))
+            {
+                fn(index_at(position), self);
+            }
+            if (!steal(slices.get(), workers, self))
+            {
+                return;
+            }
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (unsigned w = 1; w < workers; w++)
+    {
+        threads.emplace_back(run, w);
+    }
+    run(0);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
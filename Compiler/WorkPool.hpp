@@ -0,0 +1,32 @@
+//
+//  WorkPool.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Runs a loop body over [0, count) on a fixed number of threads. Indices are
+// dealt out round-robin: worker w starts on w, then w + workers, and so on, so
+// the lowest indices all start at once. Once its own share runs dry a worker
+// steals the back half of the fullest remaining one, so a few expensive items
+// cannot leave the other workers idle.
+class WorkPool
+{
+public:
+    // `threads == 0` uses one thread per hardware core.
+    WorkPool(unsigned threads = 0);
+    
+    [[nodiscard]] inline unsigned thread_count() const { return m_threads; }
+    
+    // Blocks until fn(index, worker) has returned for every index. The calling
+    // thread takes part as worker 0. `fn` must not throw.
+    void for_each(size_t count, const std::function<void(size_t index, unsigned worker)>& fn);
+    
+private:
+    unsigned m_threads;
+};
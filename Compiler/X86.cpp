@@ -0,0 +1,186 @@
+//
+//  X86.cpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#include "X86.hpp"
+
+#include <iterator>
+#include <stdexcept>
+
+static std::string_view reg_name(Reg reg)
+{
+    static constexpr std::string_view names[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    return names[static_cast<uint8_t>(reg)];
+}
+
+static std::string_view reg_name8(Reg reg)
+{
+    static constexpr std::string_view names[] = {
+        "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+        "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+    };
+    return names[static_cast<uint8_t>(reg)];
+}
+
+static std::string_view cond_name(Cond cond)
+{
+    switch (cond)
+    {
+        case Cond::b: return "b";
+        case Cond::ae: return "ae";
+        case Cond::e: return "e";
+        case Cond::ne: return "ne";
+        case Cond::be: return "be";
+        case Cond::a: return "a";
+    }
+    throw std::runtime_error("Unreachable");
+}
+
+static std::string_view op_name(Op op)
+{
+    switch (op)
+    {
+        case Op::mov: return "mov";
+        case Op::push: return "push";
+        case Op::pop: return "pop";
+        case Op::add: return "add";
+        case Op::sub: return "sub";
+        case Op::mul: return "mul";
+        case Op::imul: return "imul";
+        case Op::div: return "div";
+        case Op::shl: return "shl";
+        case Op::shr: return "shr";
+        case Op::lea: return "lea";
+        case Op::movzx: return "movzx";
+        case Op::xor_: return "xor";
+        case Op::test: return "test";
+        case Op::cmp: return "cmp";
+        case Op::jz: return "jz";
+        case Op::jmp: return "jmp";
+        case Op::syscall: return "syscall";
+        case Op::ret: return "ret";
+        default:
+            throw std::runtime_error("Unreachable");
+    }
+}
+
+static void print_label(OutputBuffer& out, uint64_t label)
+{
+    out.append("label");
+    out.append_uint(label);
+}
+
+enum class Width
+{
+    qword,
+    byte,       // setcc and the source of movzx
+    address     // lea computes an address without accessing memory
+};
+
+static void print_operand(OutputBuffer& out, const Operand& operand, Width width = Width::qword)
+{
+    switch (operand.kind)
+    {
+        case Operand::Kind::reg:
+            out.append(width == Width::byte ? reg_name8(operand.reg) : reg_name(operand.reg));
+            break;
+        case Operand::Kind::imm:
+            out.append_uint(operand.imm);
+            break;
+        case Operand::Kind::mem:
+            out.append(width == Width::qword ? "QWORD [" : width == Width::byte ? "BYTE [" : "[");
+            out.append(reg_name(operand.reg));
+            if (operand.scale != 0)
+            {
+                out.append(" + ");
+                out.append(reg_name(operand.index));
+                out.append('*');
+                out.append_uint(operand.scale);
+            }
+            if (operand.disp < 0)
+            {
+                out.append(" - ");
+                out.append_uint(static_cast<uint64_t>(-static_cast<int64_t>(operand.disp)));
+            }
+            else if (operand.disp > 0 || operand.scale == 0)
+            {
+                out.append(" + ");
+                out.append_uint(static_cast<uint64_t>(operand.disp));
+            }
+            out.append(']');
+            break;
+        case Operand::Kind::label:
+            print_label(out, operand.imm);
+            break;
+        case Operand::Kind::none:
+            break;
+    }
+}
+
+void append_entry(std::vector<Instr>& code)
+{
+    for (Reg reg : callee_saved)
+    {
+        code.push_back({ Op::push, Operand::r(reg) });
+    }
+}
+
+void append_return(std::vector<Instr>& code, uint64_t frame_bytes)
+{
+    if (frame_bytes > 0)
+    {
+        code.push_back({ Op::add, Operand::r(Reg::rsp), Operand::i(frame_bytes) });
+    }
+    for (size_t i = std::size(callee_saved); i-- > 0;)
+    {
+        code.push_back({ Op::pop, Operand::r(callee_saved[i]) });
+    }
+    code.push_back({ Op::ret });
+}
+
+void emit_nasm(const std::vector<Instr>& code, OutputBuffer& out)
+{
+    out.append("global _start\n_start:\n");
+    for (const Instr& instr : code)
+    {
+        if (instr.op == Op::label)
+        {
+            print_label(out, instr.dst.imm);
+            out.append(":\n");
+            continue;
+        }
+        out.append("    ");
+        if (instr.op == Op::jcc || instr.op == Op::setcc)
+        {
+            out.append(instr.op == Op::jcc ? "j" : "set");
+            out.append(cond_name(instr.cond));
+        }
+        else
+        {
+            out.append(op_name(instr.op));
+        }
+        if (instr.dst.kind != Operand::Kind::none)
+        {
+            out.append(' ');
+            print_operand(out, instr.dst, instr.op == Op::setcc ? Width::byte : Width::qword);
+        }
+        if (instr.src.kind != Operand::Kind::none)
+        {
+            out.append(", ");
+            Width width = instr.op == Op::lea ? Width::address : instr.op == Op::movzx ? Width::byte : Width::qword;
+            print_operand(out, instr.src, width);
+        }
+        if (instr.src2.kind != Operand::Kind::none)
+        {
+            out.append(", ");
+            print_operand(out, instr.src2);
+        }
+        out.append('\n');
+    }
+}
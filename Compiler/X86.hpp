@@ -0,0 +1,137 @@
+//
+//  X86.hpp
+//  Compiler
+//
+//  Created by Nathan Thurber on 17/10/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Output.hpp"
+
+// Structured x86-64 instructions. The Generator builds a list of these and
+// only turns them into text (or bytes) at the very end, so later passes can
+// work on instructions rather than strings.
+
+// Numbered by hardware encoding.
+enum class Reg : uint8_t
+{
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+struct Operand
+{
+    enum class Kind : uint8_t
+    {
+        none,
+        reg,
+        imm,
+        mem,    // QWORD [reg + index * scale + disp]
+        label
+    };
+    
+    Kind kind = Kind::none;
+    Reg reg = Reg::rax;
+    Reg index = Reg::rax;
+    uint8_t scale = 0;      // 1, 2, 4 or 8 with an index register, 0 without
+    int32_t disp = 0;
+    uint64_t imm = 0;       // immediate value, or label id
+    
+    static inline Operand r(Reg reg) { return { .kind = Kind::reg, .reg = reg }; }
+    static inline Operand i(uint64_t value) { return { .kind = Kind::imm, .imm = value }; }
+    static inline Operand m(Reg base, int32_t disp) { return { .kind = Kind::mem, .reg = base, .disp = disp }; }
+    static inline Operand m(Reg base, Reg index, uint8_t scale) { return { .kind = Kind::mem, .reg = base, .index = index, .scale = scale }; }
+    static inline Operand l(uint32_t label) { return { .kind = Kind::label, .imm = label }; }
+    
+    inline bool is_reg() const { return kind == Kind::reg; }
+    inline bool is_reg(Reg other) const { return kind == Kind::reg && reg == other; }
+    inline bool is_imm() const { return kind == Kind::imm; }
+    inline bool is_mem() const { return kind == Kind::mem; }
+    
+    inline bool operator == (const Operand& other) const = default;
+};
+
+// Condition codes, numbered by encoding. All comparisons are unsigned.
+enum class Cond : uint8_t
+{
+    b = 2,      // below
+    ae = 3,     // above or equal
+    e = 4,
+    ne = 5,
+    be = 6,     // below or equal
+    a = 7       // above
+};
+
+// The condition that holds exactly when `cond` does not.
+inline Cond invert(Cond cond)
+{
+    return static_cast<Cond>(static_cast<uint8_t>(cond) ^ 1);
+}
+
+enum class Op : uint8_t
+{
+    mov,
+    push,
+    pop,
+    add,
+    sub,
+    mul,        // rdx:rax = rax * src
+    imul,       // dst = dst * src, or dst = src * src2 with an immediate src2
+    div,        // rax = rdx:rax / src
+    shl,        // dst <<= src, an immediate count
+    shr,        // dst >>= src, logical
+    lea,        // dst = address of the memory operand src
+    movzx,      // dst = src, the low byte of a register, zero-extended
+    setcc,      // low byte of dst = 1 if cond holds, else 0
+    xor_,
+    test,
+    cmp,
+    jz,
+    jcc,        // jump to dst if cond holds
+    jmp,
+    label,      // defines dst
+    syscall,
+    ret
+};
+
+struct Instr
+{
+    Op op;
+    Operand dst {};
+    Operand src {};
+    Operand src2 {};
+    Cond cond = Cond::e;    // jcc, setcc
+};
+
+// True if `value` survives sign-extension from a 32-bit immediate field.
+inline bool fits_imm32(uint64_t value)
+{
+    return static_cast<int64_t>(value) == static_cast<int32_t>(value);
+}
+
+// How a program ends. An executable makes the exit system call; code run
+// in-process (--run) is instead a function that returns the status in rax.
+enum class ExitConvention : uint8_t
+{
+    syscall,
+    ret
+};
+
+// Registers a System V function must leave as it found them. A program that
+// returns saves them all on entry rather than keep track of which it uses.
+inline constexpr Reg callee_saved[] = { Reg::rbx, Reg::rbp, Reg::r12, Reg::r13, Reg::r14, Reg::r15 };
+
+// The start of a program built to return: saves the callee-saved registers.
+void append_entry(std::vector<Instr>& code);
+
+// Returns from a program built to return, with the status already in rax.
+// `frame_bytes` is what it has pushed or reserved since append_entry().
+void append_return(std::vector<Instr>& code, uint64_t frame_bytes);
+
+// NASM syntax for a whole program, entered at _start.
+void emit_nasm(const std::vector<Instr>& code, OutputBuffer& out);
@@ -5,48 +5,446 @@
 //  Created by Nathan Thurber on 24/6/24.
 //
 
-#include <iostream>
-#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
-#include <sstream>
+#include <iomanip>
+#include <iostream>
 #include <optional>
+#include <set>
+#include <string>
 #include <vector>
 
-#include "Tokenization.hpp"
-#include "Parser.hpp"
-#include "Generation.hpp"
-#include "Arena.hpp"
+#include "Cache.hpp"
+#include "Driver.hpp"
+#include "Instrumentation.hpp"
+#include "Output.hpp"
+#include "Server.hpp"
+#include "WorkPool.hpp"
+
+namespace fs = std::filesystem;
+
+static int usage()
+{
+    std::cerr << "Usage: newton [-O0|-O1] [-f[no-]peephole] [-S|-c|--emit-ir|--emit-bytecode|--run|--interpret]" << std::endl;
+    std::cerr << "              [-j <threads>] [-o <output>] [--cache-dir <dir>] [--cache-size <MiB>] [--cache-stats]" << std::endl;
+    std::cerr << "              [-ftime-report] [--stats-json <file>] [--trace <file>] [--connect <socket>] <input>..." << std::endl;
+    std::cerr << "       newton --server <socket> [-j <threads>] [--cache-dir <dir>] [--cache-size <MiB>]" << std::endl;
+    std::cerr << "  An input is a .newton file, a directory searched for .newton files," << std::endl;
+    std::cerr << "  or @<file> listing one input per line. With several inputs, -o names" << std::endl;
+    std::cerr << "  the directory the outputs are written to." << std::endl;
+    std::cerr << "  --cache-dir (or NEWTON_CACHE_DIR) reuses outputs of unchanged sources." << std::endl;
+    std::cerr << "  --run executes each program in-process instead of writing it, and prints" << std::endl;
+    std::cerr << "  its exit status with the compile and run times. --interpret does the same" << std::endl;
+    std::cerr << "  through the bytecode interpreter, without generating native code." << std::endl;
+    std::cerr << "  --server stays resident and compiles for clients on a Unix socket." << std::endl;
+    std::cerr << "  --connect (or NEWTON_SERVER) sends the inputs to that server, and" << std::endl;
+    std::cerr << "  compiles in-process if none is running." << std::endl;
+    return 1;
+}
+
+static bool has_source_ext(const std::string& path)
+{
+    return path.size() > source_ext.size() && std::string_view(path).substr(path.size() - source_ext.size()) == source_ext;
+}
+
+// Adds `arg` to `inputs`, expanding directories (sorted, so the order does not
+// depend on the file system) and response files. False if it cannot be read.
+static bool collect_inputs(const std::string& arg, std::vector<std::string>& inputs, bool allow_response = true)
+{
+    if (allow_response && !arg.empty() && arg[0] == '@')
+    {
+        std::ifstream list(arg.substr(1));
+        if (!list)
+        {
+            std::cerr << "Could not open response file " << arg.substr(1) << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line))
+        {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && !collect_inputs(line, inputs, false))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    std::error_code ec;
+    if (fs::is_directory(arg, ec))
+    {
+        std::vector<std::string> found;
+        for (fs::recursive_directory_iterator it(arg, ec), end; !ec && it != end; it.increment(ec))
+        {
+            if (it->is_regular_file(ec) && has_source_ext(it->path().string()))
+            {
+                found.push_back(it->path().string());
+            }
+        }
+        if (ec)
+        {
+            std::cerr << "Could not read directory " << arg << ": " << ec.message() << std::endl;
+            return false;
+        }
+        std::sort(found.begin(), found.end());
+        inputs.insert(inputs.end(), found.begin(), found.end());
+        return true;
+    }
+    
+    if (!has_source_ext(arg))
+    {
+        std::cerr << "Invalid file format: " << arg << std::endl;
+        return false;
+    }
+    inputs.push_back(arg);
+    return true;
+}
 
 int main(int argc, const char * argv[]) {
-    std::string fileName;
-    std::cin >> fileName;
+    CompileOptions options;
+    std::optional<bool> peephole;
+    unsigned threads = 0;
+    std::vector<std::string> inputs;
+    std::string output;
+    const char* cache_env = std::getenv("NEWTON_CACHE_DIR");
+    std::string cache_dir = cache_env ? cache_env : "";
+    uint64_t cache_mib = 256;
+    bool cache_stats = false;
+    bool time_report = false;
+    std::string stats_json;
+    std::string trace;
+    std::string server;
+    const char* connect_env = std::getenv("NEWTON_SERVER");
+    std::string connect = connect_env ? connect_env : "";
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "-O0" || arg == "-O1")
+        {
+            options.opt_level = arg[2] - '0';
+        }
+        else if (arg == "-S")
+        {
+            options.emit = EmitKind::asm_;
+        }
+        else if (arg == "-c")
+        {
+            options.emit = EmitKind::obj;
+        }
+        else if (arg == "-fpeephole" || arg == "-fno-peephole")
+        {
+            peephole = arg == "-fpeephole";
+        }
+        else if (arg == "--emit-ir")
+        {
+            options.emit = EmitKind::ir;
+        }
+        else if (arg == "--run")
+        {
+            options.emit = EmitKind::run;
+        }
+        else if (arg == "--interpret")
+        {
+            options.emit = EmitKind::interpret;
+        }
+        else if (arg == "--emit-bytecode")
+        {
+            options.emit = EmitKind::bytecode;
+        }
+        else if (arg == "--cache-stats")
+        {
+            cache_stats = true;
+        }
+        else if (arg == "-ftime-report")
+        {
+            time_report = true;
+        }
+        else if (arg == "-o" || arg == "-j" || arg == "--cache-dir" || arg == "--cache-size" || arg == "--stats-json" || arg == "--trace" || arg == "--server" || arg == "--connect")
+        {
+            if (++i == argc)
+            {
+                std::cerr << "Missing argument after " << arg << std::endl;
+                return usage();
+            }
+            if (arg == "-o")
+            {
+                output = argv[i];
+            }
+            else if (arg == "--cache-dir")
+            {
+                cache_dir = argv[i];
+            }
+            else if (arg == "--stats-json")
+            {
+                stats_json = argv[i];
+            }
+            else if (arg == "--trace")
+            {
+                trace = argv[i];
+            }
+            else if (arg == "--server")
+            {
+                server = argv[i];
+            }
+            else if (arg == "--connect")
+            {
+                connect = argv[i];
+            }
+            else if (arg == "--cache-size")
+            {
+                cache_mib = std::strtoull(argv[i], nullptr, 10);
+                if (cache_mib == 0)
+                {
+                    std::cerr << "Invalid cache size " << argv[i] << std::endl;
+                    return usage();
+                }
+            }
+            else
+            {
+                threads = static_cast<unsigned>(std::strtoul(argv[i], nullptr, 10));
+                if (threads == 0)
+                {
+                    std::cerr << "Invalid thread count " << argv[i] << std::endl;
+                    return usage();
+                }
+            }
+        }
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return usage();
+        }
+        else if (!collect_inputs(std::string(arg), inputs))
+        {
+            return 1;
+        }
+    }
     
-    if (fileName.substr(fileName.size() - 7, fileName.size()) != ".newton")
-        std::cerr << "Invalid file format" << std::endl;
+    if (!server.empty())
+    {
+        if (!inputs.empty())
+        {
+            std::cerr << "--server takes no inputs" << std::endl;
+            return usage();
+        }
+        std::optional<BuildCache> cache;
+        if (!cache_dir.empty())
+        {
+            cache.emplace(cache_dir, cache_mib << 20, compiler_identity(argv[0]));
+            if (!cache->open())
+            {
+                std::cerr << "Could not use cache directory " << cache_dir << "; serving without it" << std::endl;
+                cache.reset();
+            }
+        }
+        return run_server(server, threads, cache ? &*cache : nullptr);
+    }
+    if (inputs.empty())
+    {
+        return usage();
+    }
+    options.peephole = peephole.value_or(options.opt_level >= 1);
+    bool run = executes(options.emit);
+    if (run && !output.empty())
+    {
+        std::cerr << "-o cannot be used with " << (options.emit == EmitKind::run ? "--run" : "--interpret") << std::endl;
+        return usage();
+    }
     
-    std::string contents;
+    std::vector<CompileJob> jobs(inputs.size());
+    std::error_code ec;
+    bool output_dir = !output.empty() && (inputs.size() > 1 || fs::is_directory(output, ec));
+    if (output_dir)
     {
-        std::fstream file(fileName, std::ios::in);
-        std::stringstream contents_stream;
-        contents_stream << file.rdbuf();
-        file.close();
-        contents = contents_stream.str();
+        fs::create_directories(output, ec);
+        if (ec)
+        {
+            std::cerr << "Could not create directory " << output << ": " << ec.message() << std::endl;
+            return 1;
+        }
     }
+    std::set<std::string> outputs;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        jobs[i].input = inputs[i];
+        if (output.empty())
+        {
+            jobs[i].output = default_output(inputs[i], options.emit);
+        }
+        else if (output_dir)
+        {
+            std::string name = fs::path(inputs[i]).filename().string();
+            jobs[i].output = (fs::path(output) / default_output(name, options.emit)).string();
+        }
+        else
+        {
+            jobs[i].output = output;
+        }
+        if (!run && !outputs.insert(jobs[i].output).second)
+        {
+            std::cerr << "More than one input would be written to " << jobs[i].output << std::endl;
+            return 1;
+        }
+    }
+    
+    // Sort the biggest files first: the pool starts its lowest indices on separate
+    // workers, so no large file is left running alone at the end.
+    std::vector<size_t> order(jobs.size());
+    std::vector<uintmax_t> sizes(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        order[i] = i;
+        sizes[i] = fs::file_size(jobs[i].input, ec);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+    
+    std::optional<BuildCache> cache;
+    if (!cache_dir.empty() && !run)
+    {
+        cache.emplace(cache_dir, cache_mib << 20, compiler_identity(argv[0]));
+        if (!cache->open())
+        {
+            std::cerr << "Could not use cache directory " << cache_dir << "; compiling without it" << std::endl;
+            cache.reset();
+        }
+    }
+    BuildCache* cache_ptr = cache ? &*cache : nullptr;
     
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> Tokens = tokenizer.tokenize();
+    bool collect = time_report || !stats_json.empty() || !trace.empty();
+    std::vector<CompileStats> stats(collect ? jobs.size() : 0);
     
-    Parser parser(std::move(Tokens));
-    std::optional<NodeProg> prog = parser.parse_prog();
+    // Statistics and the client's own cache only exist in this process, so
+    // either keeps the compile here, and programs are only ever run by the
+    // client that asked for them. After the first failed attempt to reach the
+    // server the rest of the jobs do not try again.
+    bool remote = !connect.empty() && !collect && !cache_ptr && !run;
+    std::vector<CompileResult> results(jobs.size());
+    std::atomic<bool> server_down = false;
+    auto compile_remotely = [&](size_t job) {
+        std::error_code path_ec;
+        CompileJob request = jobs[job];
+        request.input = fs::absolute(request.input, path_ec).string();
+        request.output = fs::absolute(request.output, path_ec).string();
+        std::optional<std::vector<CompileResult>> answer = compile_remote(connect, { request }, options);
+        if (!answer)
+        {
+            server_down = true;
+            return false;
+        }
+        results[job] = std::move(answer->front());
+        return true;
+    };
     
-    if (!prog.has_value())
-        std::cerr << "Invalid Program" << std::endl;
+    WorkPool pool(threads);
+    pool.for_each(jobs.size(), [&](size_t i, unsigned worker) {
+        size_t job = order[i];
+        if (remote && !server_down && compile_remotely(job))
+        {
+            return;
+        }
+        if (!collect)
+        {
+            results[job] = compile_file(jobs[job], options, cache_ptr);
+            return;
+        }
+        stats[job].input = jobs[job].input;
+        stats[job].worker = worker;
+        CollectStats scope(stats[job]);
+        PhaseScope phase("compile");
+        results[job] = compile_file(jobs[job], options, cache_ptr);
+    });
     
+    if (cache && (cache->stats().stores > 0 || cache_stats))
     {
-        Generator generator(prog.value());
-        std::fstream file("/Users/nathan/Documents/Coding/Compiler/out.asm", std::ios::out);
-        file << generator.gen_prog();
+        cache->trim();
     }
     
-    return 0;
+    // Reported in input order once everything has finished, so the log is the
+    // same whatever the scheduling was.
+    size_t failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (results[i].ok)
+        {
+            continue;
+        }
+        failed++;
+        if (jobs.size() > 1)
+        {
+            std::cerr << jobs[i].input << ": ";
+        }
+        std::cerr << results[i].diagnostics << std::endl;
+    }
+    if (failed > 0 && jobs.size() > 1)
+    {
+        std::cerr << failed << " of " << jobs.size() << " files failed to " << (run ? "run" : "compile") << std::endl;
+    }
+    
+    if (run)
+    {
+        std::cout << std::fixed << std::setprecision(3);
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            if (!results[i].status)
+            {
+                continue;
+            }
+            if (jobs.size() > 1)
+            {
+                std::cout << jobs[i].input << ": ";
+            }
+            std::cout << "exit " << static_cast<int>(*results[i].status)
+                      << ", compile " << results[i].compile_ns / 1e6 << " ms"
+                      << ", run " << results[i].run_ns / 1e6 << " ms" << std::endl;
+        }
+    }
+    
+    if (cache && cache_stats)
+    {
+        BuildCache::Stats stats = cache->stats();
+        size_t lookups = stats.hits + stats.misses;
+        std::cerr << "cache: " << stats.hits << " hits, " << stats.misses << " misses";
+        if (lookups > 0)
+        {
+            std::cerr << " (" << stats.hits * 100 / lookups << "% hit rate)";
+        }
+        std::cerr << ", " << stats.stores << " stored, " << stats.evictions << " evicted, "
+                  << (stats.bytes + 1023) / 1024 << " KiB in " << cache_dir << std::endl;
+    }
+    
+    if (time_report)
+    {
+        print_time_report(stats, std::cerr);
+    }
+    if (!stats_json.empty())
+    {
+        OutputBuffer json;
+        write_stats_json(stats, json);
+        if (!json.write_to(stats_json))
+        {
+            std::cerr << "Could not write " << stats_json << std::endl;
+            return 1;
+        }
+    }
+    if (!trace.empty())
+    {
+        OutputBuffer json;
+        write_chrome_trace(stats, json);
+        if (!json.write_to(trace))
+        {
+            std::cerr << "Could not write " << trace << std::endl;
+            return 1;
+        }
+    }
+    
+    // A single program run in-process exits with its own status, as it would have on its own.
+    if (run && jobs.size() == 1 && results[0].status)
+    {
+        return *results[0].status;
+    }
+    return failed > 0 ? 1 : 0;
 }